@@ -27,6 +27,8 @@
 #include <linux/writeback.h>
 #include <linux/task_io_accounting_ops.h>
 #include <linux/fault-inject.h>
+#include <linux/list_sort.h>
+#include <linux/blk-mq.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
@@ -457,6 +459,9 @@ void blk_cleanup_queue(struct request_queue *q)
 	if (q->elevator)
 		elevator_exit(q->elevator);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	blk_put_queue(q);
 }
 EXPORT_SYMBOL(blk_cleanup_queue);
@@ -865,6 +870,10 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 
 	BUG_ON(rw != READ && rw != WRITE);
 
+	/* multi-queue devices take no packet commands */
+	if (WARN_ON_ONCE(q->mq_ops))
+		return NULL;
+
 	spin_lock_irq(q->queue_lock);
 	if (gfp_mask & __GFP_WAIT) {
 		rq = get_request_wait(q, rw, NULL);
@@ -1150,19 +1159,263 @@ static inline bool queue_should_plug(struct request_queue *q)
 	return !(blk_queue_nonrot(q) && blk_queue_tagged(q));
 }
 
+#define PLUG_MAGIC	0x91827364
+
+/**
+ * blk_start_plug - hold back the I/O the current task submits
+ * @plug:	The &struct blk_plug to use, normally on the caller's stack
+ *
+ * Description:
+ *   Requests for bios submitted by the task from now on are kept on
+ *   @plug instead of being added to their queue, so that a batch of
+ *   submissions is merged and sorted without the queue lock and added to
+ *   each queue in one go. They are submitted by blk_finish_plug(), or
+ *   earlier when the plug fills up or the task goes to sleep.
+ *
+ *   Plugs do not nest: if the task already has one, that one is used
+ *   and @plug is left idle until blk_finish_plug().
+ **/
+void blk_start_plug(struct blk_plug *plug)
+{
+	struct task_struct *tsk = current;
+
+	plug->magic = PLUG_MAGIC;
+	INIT_LIST_HEAD(&plug->list);
+	plug->count = 0;
+	plug->should_sort = 0;
+
+	/*
+	 * Store ordering should not be needed here, since a potential
+	 * preempt will imply a full memory barrier
+	 */
+	if (!tsk->plug)
+		tsk->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct request *rqa = container_of(a, struct request, queuelist);
+	struct request *rqb = container_of(b, struct request, queuelist);
+
+	if (rqa->q != rqb->q)
+		return rqa->q < rqb->q ? -1 : 1;
+	return blk_rq_pos(rqa) < blk_rq_pos(rqb) ? -1 : 1;
+}
+
+/*
+ * Start the requests just added to q, and drop its queue_lock. From
+ * schedule() the queue is run by kblockd instead, so that a task going
+ * to sleep deep in a call chain does not also run the driver's
+ * request_fn on that stack.
+ */
+static void queue_unplugged(struct request_queue *q, bool from_schedule)
+	__releases(q->queue_lock)
+{
+	trace_block_unplug_io(q);
+
+	if (q->mq_ops) {
+		blk_mq_run_queues(q, from_schedule);
+		return;
+	}
+
+	if (from_schedule) {
+		if (!elv_queue_empty(q) && !blk_queue_stopped(q)) {
+			queue_flag_set(QUEUE_FLAG_PLUGGED, q);
+			kblockd_schedule_work(q, &q->unplug_work);
+		}
+	} else
+		__blk_run_queue(q);
+	spin_unlock(q->queue_lock);
+}
+
+/**
+ * blk_flush_plug_list - submit the requests held on a plug
+ * @plug:		The &struct blk_plug to flush
+ * @from_schedule:	Called from schedule() by a task about to sleep
+ *
+ * Description:
+ *   Adds the plugged requests to their queues' elevators, sorted by
+ *   queue and sector, taking each queue lock once, and starts the
+ *   queues. Requests for multi-queue devices go to their software
+ *   queues instead. The plug stays in place for further submissions.
+ **/
+void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+{
+	struct request_queue *q = NULL;
+	unsigned long flags;
+	struct request *rq;
+	LIST_HEAD(list);
+
+	BUG_ON(plug->magic != PLUG_MAGIC);
+
+	if (list_empty(&plug->list))
+		return;
+
+	/*
+	 * Take the requests off the plug first: anything the flush itself
+	 * submits, or a reschedule in the middle of it, finds it empty.
+	 */
+	list_splice_init(&plug->list, &list);
+	plug->count = 0;
+	if (plug->should_sort) {
+		list_sort(NULL, &list, plug_rq_cmp);
+		plug->should_sort = 0;
+	}
+
+	local_irq_save(flags);
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+		BUG_ON(!rq->q);
+		if (rq->q != q) {
+			if (q)
+				queue_unplugged(q, from_schedule);
+			q = rq->q;
+			if (!q->mq_ops)
+				spin_lock(q->queue_lock);
+		}
+		if (q->mq_ops)
+			blk_mq_insert_request(rq, false);
+		else
+			add_request(q, rq);
+	}
+	if (q)
+		queue_unplugged(q, from_schedule);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+/**
+ * blk_finish_plug - submit the I/O held back since blk_start_plug()
+ * @plug:	The &struct blk_plug passed to blk_start_plug()
+ **/
+void blk_finish_plug(struct blk_plug *plug)
+{
+	blk_flush_plug_list(plug, false);
+
+	if (plug == current->plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
+bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
+			    struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+
+	if (!ll_back_merge_fn(q, req, bio))
+		return false;
+
+	trace_block_bio_backmerge(q, bio);
+
+	if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff)
+		blk_rq_set_mixed_merge(req);
+
+	req->biotail->bi_next = bio;
+	req->biotail = bio;
+	req->__data_len += bio->bi_size;
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return true;
+}
+
+static bool bio_attempt_front_merge(struct request_queue *q,
+				    struct request *req, struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+
+	if (!ll_front_merge_fn(q, req, bio))
+		return false;
+
+	trace_block_bio_frontmerge(q, bio);
+
+	if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff) {
+		blk_rq_set_mixed_merge(req);
+		req->cmd_flags &= ~REQ_FAILFAST_MASK;
+		req->cmd_flags |= ff;
+	}
+
+	bio->bi_next = req->bio;
+	req->bio = bio;
+
+	/*
+	 * may not be valid. if the low level driver said
+	 * it didn't need a bounce buffer then it better
+	 * not touch req->buffer either...
+	 */
+	req->buffer = bio_data(bio);
+	req->__sector = bio->bi_sector;
+	req->__data_len += bio->bi_size;
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return true;
+}
+
+/*
+ * Try to merge bio into one of the requests on the submitting task's
+ * plug. Those requests belong to the task alone, so no lock is needed.
+ */
+bool blk_attempt_plug_merge(struct blk_plug *plug, struct request_queue *q,
+			    struct bio *bio)
+{
+	struct request *rq;
+
+	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
+		if (rq->q != q)
+			continue;
+
+		switch (elv_try_merge(rq, bio)) {
+		case ELEVATOR_BACK_MERGE:
+			if (bio_attempt_back_merge(q, rq, bio))
+				return true;
+			break;
+		case ELEVATOR_FRONT_MERGE:
+			if (bio_attempt_front_merge(q, rq, bio))
+				return true;
+			break;
+		}
+	}
+	return false;
+}
+
+/*
+ * Hold rq on the plug, flushing the plug first if it is full.
+ */
+void blk_add_plug_request(struct blk_plug *plug, struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (list_empty(&plug->list))
+		trace_block_plug(q);
+	else {
+		if (!plug->should_sort &&
+		    list_entry_rq(plug->list.prev)->q != q)
+			plug->should_sort = 1;
+		if (plug->count >= BLK_MAX_PLUG_REQUESTS) {
+			blk_flush_plug_list(plug, false);
+			trace_block_plug(q);
+		}
+	}
+	list_add_tail(&rq->queuelist, &plug->list);
+	plug->count++;
+}
+
 static int __make_request(struct request_queue *q, struct bio *bio)
 {
 	struct request *req;
+	struct blk_plug *plug;
 	int el_ret;
-	unsigned int bytes = bio->bi_size;
-	const unsigned short prio = bio_prio(bio);
 	const bool sync = bio_rw_flagged(bio, BIO_RW_SYNCIO);
 	const bool unplug = bio_rw_flagged(bio, BIO_RW_UNPLUG);
-	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	const bool barrier = bio_rw_flagged(bio, BIO_RW_BARRIER);
 	int rw_flags;
 
-	if (bio_rw_flagged(bio, BIO_RW_BARRIER) &&
-	    (q->next_ordered == QUEUE_ORDERED_NONE)) {
+	if (barrier && (q->next_ordered == QUEUE_ORDERED_NONE)) {
 		bio_endio(bio, -EOPNOTSUPP);
 		return 0;
 	}
@@ -1173,9 +1426,23 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	 */
 	blk_queue_bounce(q, &bio);
 
+	/*
+	 * A barrier must not overtake the writes plugged before it, and
+	 * is never held on a plug itself. Anything else is first offered
+	 * to the requests on the plug, without touching the queue lock.
+	 */
+	plug = current->plug;
+	if (plug) {
+		if (unlikely(barrier)) {
+			blk_flush_plug_list(plug, false);
+			plug = NULL;
+		} else if (blk_attempt_plug_merge(plug, q, bio))
+			return 0;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
-	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER)) || elv_queue_empty(q))
+	if (unlikely(barrier) || elv_queue_empty(q))
 		goto get_rq;
 
 	el_ret = elv_merge(q, &req, bio);
@@ -1183,21 +1450,8 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	case ELEVATOR_BACK_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_back_merge_fn(q, req, bio))
+		if (!bio_attempt_back_merge(q, req, bio))
 			break;
-
-		trace_block_bio_backmerge(q, bio);
-
-		if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff)
-			blk_rq_set_mixed_merge(req);
-
-		req->biotail->bi_next = bio;
-		req->biotail = bio;
-		req->__data_len += bytes;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_back_merge(q, req))
 			elv_merged_request(q, req, el_ret);
 		goto out;
@@ -1205,32 +1459,8 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	case ELEVATOR_FRONT_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_front_merge_fn(q, req, bio))
+		if (!bio_attempt_front_merge(q, req, bio))
 			break;
-
-		trace_block_bio_frontmerge(q, bio);
-
-		if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff) {
-			blk_rq_set_mixed_merge(req);
-			req->cmd_flags &= ~REQ_FAILFAST_MASK;
-			req->cmd_flags |= ff;
-		}
-
-		bio->bi_next = req->bio;
-		req->bio = bio;
-
-		/*
-		 * may not be valid. if the low level driver said
-		 * it didn't need a bounce buffer then it better
-		 * not touch req->buffer either...
-		 */
-		req->buffer = bio_data(bio);
-		req->__sector = bio->bi_sector;
-		req->__data_len += bytes;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_front_merge(q, req))
 			elv_merged_request(q, req, el_ret);
 		goto out;
@@ -1264,10 +1494,20 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
-	spin_lock_irq(q->queue_lock);
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
 	    bio_flagged(bio, BIO_CPU_AFFINE))
-		req->cpu = blk_cpu_to_group(smp_processor_id());
+		req->cpu = blk_cpu_to_group(raw_smp_processor_id());
+
+	/*
+	 * A plugged request waits for the plug to be flushed, even if
+	 * the bio asked for an unplug: the plug owner decides when.
+	 */
+	if (plug) {
+		blk_add_plug_request(plug, req);
+		return 0;
+	}
+
+	spin_lock_irq(q->queue_lock);
 	if (queue_should_plug(q) && elv_queue_empty(q))
 		blk_plug_device(q);
 	add_request(q, req);
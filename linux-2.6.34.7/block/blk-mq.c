@@ -0,0 +1,567 @@
+/*
+ * Multi-queue block submission: per-CPU software queues feeding the
+ * hardware queues of a driver, with requests preallocated per tag. See
+ * include/linux/blk-mq.h.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/workqueue.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+
+/*
+ * A software queue: the requests one CPU has submitted to a queue and
+ * that its hardware queue has not taken yet.
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+	unsigned int		last_tag;	/* where to look for a tag */
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * blk_mq_map_queue - default ->map_queue
+ * @q:		the queue
+ * @cpu:	the submitting CPU
+ *
+ * Spreads the CPUs over the hardware queues in order.
+ **/
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, int cpu)
+{
+	return q->queue_hw_ctx[cpu % q->nr_hw_queues];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct blk_mq_hw_ctx *blk_mq_ctx_to_hctx(struct blk_mq_ctx *ctx)
+{
+	struct request_queue *q = ctx->queue;
+
+	return q->mq_ops->map_queue(q, ctx->cpu);
+}
+
+/*
+ * Take a tag, and with it a request, on the hardware queue of the CPU
+ * we run on. If they are all in flight, run the hardware queue and wait
+ * for one to be freed. Returns with preemption disabled.
+ */
+static struct request *blk_mq_get_request(struct request_queue *q,
+					  struct blk_mq_ctx **ctxp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	DEFINE_WAIT(wait);
+	struct request *rq;
+	int tag;
+
+	for (;;) {
+		ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+		hctx = blk_mq_ctx_to_hctx(ctx);
+		tag = blk_tag_get(hctx->tags, ctx->last_tag);
+		if (tag >= 0)
+			break;
+		put_cpu();
+
+		prepare_to_wait_exclusive(&hctx->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		blk_mq_run_hw_queue(hctx, false);
+		if (find_first_zero_bit(hctx->tags->tag_map,
+					hctx->tags->max_depth) >=
+		    hctx->tags->max_depth)
+			io_schedule();
+		finish_wait(&hctx->wait, &wait);
+	}
+
+	ctx->last_tag = tag + 1;
+	rq = hctx->tags->tag_index[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	*ctxp = ctx;
+	return rq;
+}
+
+static void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(rq->mq_ctx);
+
+	blk_tag_put(hctx->tags, rq->tag);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->wait))
+		wake_up(&hctx->wait);
+}
+
+/*
+ * I/O accounting. There is no lock to keep part->in_flight with, so
+ * multi-queue devices count completed I/O and its time only.
+ */
+static void blk_mq_account_done(struct request *rq)
+{
+	struct hd_struct *part;
+	int rw = rq_data_dir(rq);
+	int cpu;
+
+	if (!blk_do_io_stat(rq))
+		return;
+
+	cpu = part_stat_lock();
+	part = disk_map_sector_rcu(rq->rq_disk, blk_rq_pos(rq));
+	part_stat_inc(cpu, part, ios[rw]);
+	part_stat_add(cpu, part, ticks[rw], jiffies - rq->start_time);
+	part_stat_unlock();
+}
+
+/**
+ * blk_mq_end_io - end all I/O on a request and free it
+ * @rq:		the request
+ * @error:	0 for success, < 0 for error
+ **/
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_mq_account_done(rq);
+	blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_softirq_done(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (q->mq_ops->complete)
+		q->mq_ops->complete(rq);
+	else
+		blk_mq_end_io(rq, rq->errors);
+}
+
+/**
+ * blk_mq_complete_request - end I/O on a request from the driver
+ * @rq:		the request, with rq->errors set
+ *
+ * Description:
+ *   Safe from interrupt context. The request is finished in the block
+ *   softirq of the CPU that submitted it, through blk_complete_request().
+ **/
+void blk_mq_complete_request(struct request *rq)
+{
+	blk_complete_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	trace_block_rq_issue(rq->q, rq);
+	rq->cmd_flags |= REQ_STARTED;
+}
+
+/*
+ * Collect the requests from the software queues with work, behind any
+ * the driver bounced earlier, and start as many as the driver takes.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK) {
+			hctx->dispatched++;
+			continue;
+		}
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			rq->cmd_flags &= ~REQ_STARTED;
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/*
+	 * The driver is full: keep the rest in order for the next run,
+	 * which the driver starts when it has room again.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+
+		/* in case the driver restarted the queue before we got here */
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - start the requests waiting on a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	leave it to kblockd instead of running it here
+ **/
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async) {
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+		return;
+	}
+
+	preempt_disable();
+	__blk_mq_run_hw_queue(hctx);
+	preempt_enable();
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+/**
+ * blk_mq_run_queues - run every hardware queue with work
+ * @q:		the queue
+ * @async:	leave it to kblockd instead of running them here
+ **/
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (find_first_bit(hctx->ctx_map, hctx->nr_ctx) >=
+		    hctx->nr_ctx && list_empty_careful(&hctx->dispatch))
+			continue;
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	blk_mq_run_hw_queue(hctx, false);
+}
+
+/**
+ * blk_mq_stop_hw_queue - stop starting requests on a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *   For a driver out of room, typically from ->queue_rq before it
+ *   returns BLK_MQ_RQ_QUEUE_BUSY.
+ **/
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart the stopped hardware queues
+ * @q:		the queue
+ *
+ * Description:
+ *   Safe from interrupt context: the queues are run by kblockd.
+ **/
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void __blk_mq_insert_request(struct blk_mq_ctx *ctx,
+				    struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+
+	trace_block_rq_insert(rq->q, rq);
+
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	set_bit(ctx->index_hw, hctx->ctx_map);
+	spin_unlock(&ctx->lock);
+	hctx->queued++;
+}
+
+/**
+ * blk_mq_insert_request - queue a request on its software queue
+ * @rq:		the request, from a multi-queue queue
+ * @run_queue:	run the hardware queue behind it too
+ **/
+void blk_mq_insert_request(struct request *rq, bool run_queue)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	__blk_mq_insert_request(ctx, rq);
+	if (run_queue)
+		blk_mq_run_hw_queue(blk_mq_ctx_to_hctx(ctx), false);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Try to add bio to the end of the last request on the software queue.
+ * Sequential streams from one CPU merge here; anything fancier is left
+ * to the task's plug.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	bool merged = false;
+
+	if (blk_queue_nomerges(q))
+		return false;
+
+	spin_lock(&ctx->lock);
+	if (!list_empty(&ctx->rq_list)) {
+		rq = list_entry_rq(ctx->rq_list.prev);
+		if (elv_try_merge(rq, bio) == ELEVATOR_BACK_MERGE)
+			merged = bio_attempt_back_merge(q, rq, bio);
+	}
+	spin_unlock(&ctx->lock);
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct blk_plug *plug = current->plug;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	if (bio_rw_flagged(bio, BIO_RW_BARRIER)) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	if (plug && blk_attempt_plug_merge(plug, q, bio))
+		return 0;
+
+	ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+	if (blk_mq_attempt_merge(q, ctx, bio)) {
+		put_cpu();
+		return 0;
+	}
+	put_cpu();
+
+	trace_block_getrq(q, bio, bio_data_dir(bio));
+
+	rq = blk_mq_get_request(q, &ctx);
+	init_request_from_bio(rq, bio);
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+	rq->cpu = ctx->cpu;
+
+	if (plug) {
+		put_cpu();
+		blk_add_plug_request(plug, rq);
+		return 0;
+	}
+
+	blk_mq_insert_request(rq, true);
+	put_cpu();
+	return 0;
+}
+
+static int blk_mq_init_hw_queue(struct request_queue *q,
+				struct blk_mq_hw_ctx *hctx,
+				struct blk_mq_reg *reg, unsigned int num)
+{
+	size_t rq_size = sizeof(struct request) + reg->cmd_size;
+	struct request *rq;
+	int i;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->wait);
+	hctx->queue = q;
+	hctx->queue_num = num;
+	hctx->numa_node = reg->numa_node;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  hctx->numa_node);
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) * sizeof(long),
+				     GFP_KERNEL, hctx->numa_node);
+	hctx->tags = blk_init_tags(reg->queue_depth);
+	if (!hctx->ctxs || !hctx->ctx_map || !hctx->tags)
+		return -ENOMEM;
+
+	for (i = 0; i < reg->queue_depth; i++) {
+		rq = kmalloc_node(rq_size, GFP_KERNEL, hctx->numa_node);
+		if (!rq)
+			return -ENOMEM;
+		hctx->tags->tag_index[i] = rq;
+	}
+
+	return 0;
+}
+
+static void blk_mq_free_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	int i;
+
+	if (hctx->tags) {
+		for (i = 0; i < hctx->tags->real_max_depth; i++)
+			kfree(hctx->tags->tag_index[i]);
+		blk_free_tags(hctx->tags);
+	}
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+/*
+ * Free the hardware and software queues; the driver set up the first
+ * nr_init hardware queues and gets to tear them down.
+ */
+static void __blk_mq_free_queue(struct request_queue *q, unsigned int nr_init)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_work_sync(&hctx->run_work);
+		if (i < nr_init && q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+		blk_mq_free_hw_queue(hctx);
+	}
+	kfree(q->queue_hw_ctx);
+	q->queue_hw_ctx = NULL;
+	q->nr_hw_queues = 0;
+
+	free_percpu(q->queue_ctx);
+	q->queue_ctx = NULL;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	the driver's operations, queue count and depth
+ * @driver_data: passed to ->init_hctx
+ *
+ * Description:
+ *   The queue is torn down by blk_cleanup_queue(). Only the driver sets
+ *   q->queuedata.
+ **/
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request_queue *q;
+	int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	/* Complete on the submitting CPU and account I/O, as by default */
+	q->queue_flags |= QUEUE_FLAG_DEFAULT;
+	q->mq_ops = reg->ops;
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		if (!hctx)
+			goto fail;
+		q->queue_hw_ctx[i] = hctx;
+		q->nr_hw_queues = i + 1;
+		if (blk_mq_init_hw_queue(q, hctx, reg, i))
+			goto fail;
+	}
+
+	for_each_possible_cpu(i) {
+		ctx = per_cpu_ptr(q->queue_ctx, i);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, i);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	blk_queue_softirq_done(q, blk_mq_softirq_done);
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			break;
+	}
+	if (i == q->nr_hw_queues)
+		return q;
+
+	__blk_mq_free_queue(q, i);
+	goto out_cleanup;
+fail:
+	__blk_mq_free_queue(q, 0);
+out_cleanup:
+	q->mq_ops = NULL;
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_cleanup_queue(), once no more I/O is coming.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	__blk_mq_free_queue(q, q->nr_hw_queues);
+}
@@ -166,6 +166,57 @@ struct blk_queue_tag *blk_init_tags(int depth)
 }
 EXPORT_SYMBOL(blk_init_tags);
 
+/**
+ * blk_tag_get - allocate a tag from a tag map without a lock
+ * @bqt:	the tag map, as set up by blk_init_tags()
+ * @hint:	the tag to start looking from
+ *
+ * Description:
+ *    For tag maps that are not tied to one queue_lock. The tag_map bit
+ *    is claimed atomically, as in blk_queue_start_tag(), so concurrent
+ *    callers never get the same tag. Callers on different CPUs should
+ *    pass different hints, so that they do not all fight over the
+ *    first word of the map.
+ *
+ *    Returns the tag, or -1 if all of them are busy.
+ **/
+int blk_tag_get(struct blk_queue_tag *bqt, unsigned int hint)
+{
+	unsigned int depth = bqt->max_depth;
+	unsigned long tag;
+
+	if (hint >= depth)
+		hint = 0;
+
+	do {
+		tag = find_next_zero_bit(bqt->tag_map, depth, hint);
+		if (tag >= depth) {
+			tag = find_first_zero_bit(bqt->tag_map, hint);
+			if (tag >= hint)
+				return -1;
+		}
+	} while (test_and_set_bit_lock(tag, bqt->tag_map));
+
+	return tag;
+}
+EXPORT_SYMBOL(blk_tag_get);
+
+/**
+ * blk_tag_put - release a tag allocated by blk_tag_get()
+ * @bqt:	the tag map
+ * @tag:	the tag
+ **/
+void blk_tag_put(struct blk_queue_tag *bqt, int tag)
+{
+	BUG_ON(tag < 0 || tag >= bqt->real_max_depth);
+	/*
+	 * As in blk_queue_end_tag(), the bit guards the tag's slot in
+	 * tag_index.
+	 */
+	clear_bit_unlock(tag, bqt->tag_map);
+}
+EXPORT_SYMBOL(blk_tag_put);
+
 /**
  * blk_queue_init_tags - initialize the queue tag info
  * @q:  the request queue for the device
@@ -105,6 +105,14 @@ int attempt_back_merge(struct request_queue *q, struct request *rq);
 int attempt_front_merge(struct request_queue *q, struct request *rq);
 void blk_recalc_rq_segments(struct request *rq);
 void blk_rq_set_mixed_merge(struct request *rq);
+int elv_try_merge(struct request *__rq, struct bio *bio);
+bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
+			    struct bio *bio);
+bool blk_attempt_plug_merge(struct blk_plug *plug, struct request_queue *q,
+			    struct bio *bio);
+void blk_add_plug_request(struct blk_plug *plug, struct request *rq);
+
+void blk_mq_free_queue(struct request_queue *q);
 
 void blk_queue_congestion_threshold(struct request_queue *q);
 
@@ -4,11 +4,23 @@
  * Ian Crawford, Sarah Clisby, Matt Martinson, Matt Thomas
  * 
  * We changed the data structure look_data to keep track of
- * the disk head position and motion of direction. The other
- * changes were made in look_dispatch, which searches through
- * the request list and finds the next largest request block
- * if the head is moving up, and the next smallest request
- * block if the head is moving down.
+ * the disk head position and motion of direction. Pending
+ * requests are kept in an rbtree sorted by sector, so
+ * look_dispatch can find the next larger request block if the
+ * head is moving up, and the next smaller request block if the
+ * head is moving down, without walking every queued request.
+ * The next request in the current direction is cached so a
+ * sweep usually dispatches in O(1).
+ *
+ * Requests are also kept on per-direction FIFOs with an expiry
+ * time, like the deadline scheduler. Every fifo_batch dispatches
+ * the FIFOs are checked, and if a request has expired the head
+ * jumps to it and carries on sweeping from there, which bounds
+ * how long a request far away from the head can wait.
+ *
+ * The sweep policy can be changed at runtime: plain LOOK, circular
+ * C-LOOK, and N-step and F-LOOK, which keep a second tree of requests
+ * that arrived too late to join the current sweep.
  */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
@@ -16,214 +28,958 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/init.h>
+#include <linux/rbtree.h>
+#include <linux/math64.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/look.h>
+
+#define LOOK_DOWN	0
+#define LOOK_UP		1
+
+enum look_policy {
+	LOOK_POLICY_LOOK,	/* sweep up and down, arrivals join the sweep */
+	LOOK_POLICY_CLOOK,	/* sweep up only, then wrap to the lowest */
+	LOOK_POLICY_NSTEP,	/* at most nstep requests join a sweep */
+	LOOK_POLICY_FLOOK,	/* the sweep is frozen when it starts */
+	LOOK_POLICY_NR,
+};
+
+static const char *look_policy_names[LOOK_POLICY_NR] = {
+	[LOOK_POLICY_LOOK]	= "look",
+	[LOOK_POLICY_CLOOK]	= "clook",
+	[LOOK_POLICY_NSTEP]	= "nstep",
+	[LOOK_POLICY_FLOOK]	= "flook",
+};
+
+/*
+ * See Documentation/block/look-iosched.txt
+ */
+static const int read_expire = HZ / 2;	/* max time before a read is submitted. */
+static const int write_expire = 5 * HZ;	/* ditto for writes, these limits are SOFT! */
+static const int writes_starved = 2;	/* max times expired reads can starve an expired write */
+static const int fifo_batch = 16;	/* # of sweep dispatches between expiry checks */
+static const int nstep = 16;		/* max requests in an N-step sweep */
+
+/*
+ * Seek distances are counted in power-of-8 buckets of sectors:
+ * 0, 1-7, 8-63, ..., and everything from 8^7 sectors (1GB) up.
+ */
+#define LOOK_SEEK_BUCKETS	9
 
 /**
- * struct look_data - Keeps track of the list head, disk head position and direction.
+ * struct look_data - Keeps track of the sorted requests, disk head position and direction.
  * 
- * @queue: the list head
- * @cur_pos: the current position of the disk head
- * @dir: the direction the disk head is traveling
+ * @sort_list: requests sorted by sector, one tree for the current sweep
+ *	and one for requests waiting for the next sweep
+ * @active: index in @sort_list of the tree being swept
+ * @sweep_len: number of requests that have joined the current sweep
+ * @next_rq: cached next request in the current direction, or NULL if unknown
+ * @cur_pos: where the head will be once everything dispatched is done
+ * @head_pos: where the last completed request left the head
+ * @act_pos: where the last request handed to the driver ends
+ * @nr_in_flight: requests handed to the driver and not yet completed
+ * @dir: the direction the disk head is traveling (LOOK_UP or LOOK_DOWN)
+ * @nr_queued: number of requests waiting in the scheduler
+ * @fifo_list: pending reads and writes in order of expiry
+ * @batching: number of requests dispatched since the last expiry check
+ * @starved: times expired reads have been preferred over expired writes
+ * @policy: tunable, one of enum look_policy
+ * @nstep: tunable, requests that may join a sweep under LOOK_POLICY_NSTEP
+ * @deadline: tunable, check the FIFOs for expired requests
+ * @fifo_expire: tunables, how long reads and writes may wait
+ * @fifo_batch: tunable, dispatches between expiry checks
+ * @writes_starved: tunable, limit for @starved
+ * @front_merges: tunable, look for front merges in the sort list
+ * @nr_front_merges: bios merged at the front of a queued request
+ * @nr_back_merges: bios merged at the back of a queued request
+ * @nr_rq_merges: queued requests merged into a neighbouring request
+ * @nr_dispatched: requests moved to the dispatch queue
+ * @nr_reversals: times the head changed direction
+ * @nr_activated: requests handed to the driver
+ * @seek_total: sum of the seek distances of the requests handed to the driver
+ * @seek_hist: histogram of those seek distances, see LOOK_SEEK_BUCKETS
  */
 struct look_data {
-	struct list_head queue;
+	struct rb_root sort_list[2];
+	unsigned int active;
+	unsigned int sweep_len;
+	struct request *next_rq;
 	sector_t cur_pos;
-	unsigned int dir;	//1 for up
-				//0 for down
+	sector_t head_pos;
+	sector_t act_pos;
+	unsigned int nr_in_flight;
+	unsigned int dir;
+	unsigned int nr_queued;
+
+	struct list_head fifo_list[2];
+	unsigned int batching;
+	unsigned int starved;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int policy;
+	int nstep;
+	int deadline;
+	int fifo_expire[2];
+	int fifo_batch;
+	int writes_starved;
+	int front_merges;
+
+	unsigned long nr_front_merges;
+	unsigned long nr_back_merges;
+	unsigned long nr_rq_merges;
+	unsigned long nr_dispatched;
+	unsigned long nr_reversals;
+	unsigned long nr_activated;
+	u64 seek_total;
+	unsigned long seek_hist[LOOK_SEEK_BUCKETS];
 };
 
+static void look_move_request(struct request_queue *q, struct request *rq);
+
+static inline struct rb_root *look_active(struct look_data *ld)
+{
+	return &ld->sort_list[ld->active];
+}
+
+static inline struct rb_root *look_waiting(struct look_data *ld)
+{
+	return &ld->sort_list[!ld->active];
+}
+
+/*
+ * each queued request remembers which of the two trees it is on
+ */
+static inline struct rb_root *look_rb_root(struct request *rq)
+{
+	return rq->elevator_private;
+}
+
+/**
+ * look_neighbour - Returns the request after @rq in the head's direction.
+ * @ld: look data
+ * @rq: a request on the sort list
+ *
+ * Only requests in the current sweep have a neighbour.
+ */
+static inline struct request *
+look_neighbour(struct look_data *ld, struct request *rq)
+{
+	struct rb_node *node;
+
+	if (look_rb_root(rq) != look_active(ld))
+		return NULL;
+
+	if (ld->dir == LOOK_UP)
+		node = rb_next(&rq->rb_node);
+	else
+		node = rb_prev(&rq->rb_node);
+
+	if (node)
+		return rb_entry_rq(node);
+
+	return NULL;
+}
+
+/**
+ * look_ahead_of_head - True if @rq can be serviced without reversing.
+ * @ld: look data
+ * @rq: a request on the sort list
+ *
+ * A request at exactly the head position counts for both directions,
+ * just like the original list scan.
+ */
+static inline int look_ahead_of_head(struct look_data *ld, struct request *rq)
+{
+	if (ld->dir == LOOK_UP)
+		return blk_rq_pos(rq) >= ld->cur_pos;
+	return blk_rq_pos(rq) <= ld->cur_pos;
+}
+
+/**
+ * look_find_next - Looks up the closest request in the current direction.
+ * @ld: look data
+ *
+ * Walks down the active rbtree once, so this is O(log n). Returns the
+ * request with the smallest sector at or above the head when moving up,
+ * or the largest sector at or below the head when moving down.
+ */
+static struct request *look_find_next(struct look_data *ld)
+{
+	struct rb_node *n = look_active(ld)->rb_node;
+	struct request *rq, *best = NULL;
+
+	while (n) {
+		rq = rb_entry_rq(n);
+
+		if (look_ahead_of_head(ld, rq)) {
+			best = rq;
+			n = ld->dir == LOOK_UP ? n->rb_left : n->rb_right;
+		} else
+			n = ld->dir == LOOK_UP ? n->rb_right : n->rb_left;
+	}
+
+	return best;
+}
+
+/**
+ * look_next_request - Returns the next request in the current direction.
+ * @ld: look data
+ *
+ * Uses the cached request when it is still ahead of the head, and
+ * falls back to an rbtree lookup otherwise.
+ */
+static struct request *look_next_request(struct look_data *ld)
+{
+	struct request *rq = ld->next_rq;
+
+	if (rq && look_ahead_of_head(ld, rq))
+		return rq;
+
+	rq = look_find_next(ld);
+	ld->next_rq = rq;
+	return rq;
+}
+
+/**
+ * look_update_next - Makes @rq the cached next request if it is closer.
+ * @ld: look data
+ * @rq: a request that was just (re)inserted into the sort list
+ *
+ * An unknown cached request stays unknown; look_next_request will find
+ * the right one when it is needed.
+ */
+static void look_update_next(struct look_data *ld, struct request *rq)
+{
+	if (!ld->next_rq || look_rb_root(rq) != look_active(ld) ||
+	    !look_ahead_of_head(ld, rq))
+		return;
+
+	if (ld->dir == LOOK_UP ?
+	    blk_rq_pos(rq) < blk_rq_pos(ld->next_rq) :
+	    blk_rq_pos(rq) > blk_rq_pos(ld->next_rq))
+		ld->next_rq = rq;
+}
+
+static void look_add_rq_rb(struct request_queue *q, struct request *rq,
+			   struct rb_root *root)
+{
+	struct request *__alias;
+
+	/*
+	 * Two requests can not share a node in the tree, so a request
+	 * for a sector that is already queued goes straight out.
+	 */
+	rq->elevator_private = root;
+	while (unlikely(__alias = elv_rb_add(root, rq)))
+		look_move_request(q, __alias);
+}
+
+static void look_del_rq_rb(struct look_data *ld, struct request *rq)
+{
+	if (ld->next_rq == rq)
+		ld->next_rq = look_neighbour(ld, rq);
+
+	elv_rb_del(look_rb_root(rq), rq);
+}
+
+/**
+ * look_trim_sweep - Sends all but nstep requests of a new sweep back to wait.
+ * @ld: look data
+ *
+ * The requests that expire first keep their place; the rest go on the
+ * (empty) waiting tree. Walking the two FIFOs together visits every
+ * queued request in order of expiry.
+ */
+static void look_trim_sweep(struct look_data *ld)
+{
+	struct list_head *r = ld->fifo_list[READ].next;
+	struct list_head *w = ld->fifo_list[WRITE].next;
+	struct request *rq;
+	unsigned int n = 0;
+
+	while (r != &ld->fifo_list[READ] || w != &ld->fifo_list[WRITE]) {
+		if (w == &ld->fifo_list[WRITE] ||
+		    (r != &ld->fifo_list[READ] &&
+		     !time_after(rq_fifo_time(rq_entry_fifo(r)),
+				 rq_fifo_time(rq_entry_fifo(w))))) {
+			rq = rq_entry_fifo(r);
+			r = r->next;
+		} else {
+			rq = rq_entry_fifo(w);
+			w = w->next;
+		}
+
+		if (++n <= ld->nstep)
+			continue;
+
+		/*
+		 * The request had a node of its own in the active tree,
+		 * so it can not find an alias in the waiting one.
+		 */
+		elv_rb_del(look_active(ld), rq);
+		rq->elevator_private = look_waiting(ld);
+		elv_rb_add(look_waiting(ld), rq);
+	}
+
+	ld->sweep_len = ld->nstep;
+}
+
+/**
+ * look_start_sweep - Makes the waiting requests the current sweep.
+ * @ld: look data
+ *
+ * Called once the current sweep has run dry, so that there is never a
+ * waiting request while the active tree is empty. Under N-step at most
+ * nstep of them make up the new sweep, see look_trim_sweep().
+ */
+static void look_start_sweep(struct look_data *ld)
+{
+	ld->active = !ld->active;
+	ld->sweep_len = ld->nr_queued;
+	ld->next_rq = NULL;
+
+	if (ld->policy == LOOK_POLICY_NSTEP && ld->nr_queued > ld->nstep)
+		look_trim_sweep(ld);
+}
+
+/**
+ * look_remove_request - Takes a request off the sort list and its FIFO.
+ */
+static void look_remove_request(struct look_data *ld, struct request *rq)
+{
+	rq_fifo_clear(rq);
+	look_del_rq_rb(ld, rq);
+	ld->nr_queued--;
+
+	if (RB_EMPTY_ROOT(look_active(ld)) && !RB_EMPTY_ROOT(look_waiting(ld)))
+		look_start_sweep(ld);
+}
+
+/**
+ * look_join_sweep - Picks the tree a new request goes on.
+ * @ld: look data
+ *
+ * With LOOK and C-LOOK every request joins the current sweep. F-LOOK
+ * only lets a request join a sweep that has not started yet, and
+ * N-step lets up to nstep requests join each sweep, counting the ones
+ * that were waiting when it started.
+ */
+static struct rb_root *look_join_sweep(struct look_data *ld)
+{
+	switch (ld->policy) {
+	case LOOK_POLICY_NSTEP:
+		if (ld->sweep_len < ld->nstep)
+			break;
+		/* fall through */
+	case LOOK_POLICY_FLOOK:
+		if (!RB_EMPTY_ROOT(look_active(ld)))
+			return look_waiting(ld);
+		break;
+	}
+
+	ld->sweep_len++;
+	return look_active(ld);
+}
+
 /**
- * look_merged_requests - Unchanged in this project.
+ * look_move_request - Moves a request from the sort list to the dispatch queue.
+ * @q: the request queue
+ * @rq: request to dispatch
+ *
+ * Updates the head position and caches the next request in the
+ * current direction.
+ */
+static void look_move_request(struct request_queue *q, struct request *rq)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+	struct request *next = look_neighbour(ld, rq);
+
+	trace_look_dispatch(rq, ld->dir, ld->cur_pos, ld->nr_queued);
+
+	ld->nr_dispatched++;
+
+	look_remove_request(ld, rq);
+	ld->next_rq = next;
+	ld->cur_pos = rq_end_sector(rq);
+
+	elv_dispatch_sort(q, rq);
+}
+
+/**
+ * look_merge - Looks for a queued request that @bio can be merged in front of.
+ * @q: the request queue
+ * @req: set to the request to merge with
+ * @bio: the bio being submitted
+ *
+ * Back merges are found by the elevator core through its merge hash
+ * before this is called, so only the front merge lookup is done here.
+ * The sort list is keyed on start sector, so the candidate is the
+ * request starting right where @bio ends.
+ */
+static int look_merge(struct request_queue *q, struct request **req,
+		      struct bio *bio)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+	struct request *__rq;
+
+	if (ld->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(look_active(ld), sector);
+		if (!__rq)
+			__rq = elv_rb_find(look_waiting(ld), sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+/**
+ * look_merged_request - Called after a bio was merged into @req.
+ * @q: the request queue
+ * @req: the request that grew
+ * @type: ELEVATOR_FRONT_MERGE or ELEVATOR_BACK_MERGE
+ *
+ * A front merge changes the start sector, so the request has to be
+ * moved to its new place in the sort list.
+ */
+static void look_merged_request(struct request_queue *q, struct request *req,
+				int type)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+
+	if (type == ELEVATOR_FRONT_MERGE) {
+		ld->nr_front_merges++;
+		elv_rb_del(look_rb_root(req), req);
+		look_add_rq_rb(q, req, look_rb_root(req));
+		look_update_next(ld, req);
+	} else
+		ld->nr_back_merges++;
+}
+
+/**
+ * look_merged_requests - Removes @next, which has been merged into @rq.
  */
 static void look_merged_requests(struct request_queue *q, struct request *rq,
 				 struct request *next)
 {
-	list_del_init(&next->queuelist);
+	struct look_data *ld = q->elevator->elevator_data;
+
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq_set_fifo_time(rq, rq_fifo_time(next));
+		}
+	}
+
+	ld->nr_rq_merges++;
+	look_remove_request(ld, next);
+}
+
+/**
+ * look_allow_merge - Decides whether @bio may be merged into @rq.
+ * @q: the request queue
+ * @rq: a queued request
+ * @bio: the bio being submitted
+ *
+ * A front merge moves the start of @rq back. If that would put a
+ * request the head is sweeping towards behind the head, the request
+ * would have to wait for the next sweep, so the bio is queued on its
+ * own instead.
+ */
+static int look_allow_merge(struct request_queue *q, struct request *rq,
+			    struct bio *bio)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+
+	/*
+	 * Moving down, a front merge only takes the request further in
+	 * the direction the head is already going.
+	 */
+	if (ld->dir == LOOK_DOWN ||
+	    bio->bi_sector + bio_sectors(bio) != blk_rq_pos(rq))
+		return 1;
+
+	return !look_ahead_of_head(ld, rq) || bio->bi_sector >= ld->cur_pos;
+}
+
+/**
+ * look_fifo_expired - True if the oldest request of @data_dir has expired.
+ */
+static inline int look_fifo_expired(struct look_data *ld, int data_dir)
+{
+	struct request *rq;
+
+	if (list_empty(&ld->fifo_list[data_dir]))
+		return 0;
+
+	rq = rq_entry_fifo(ld->fifo_list[data_dir].next);
+	return time_after(jiffies, rq_fifo_time(rq));
 }
 
 /**
- * look_dispatch - Loops through the request queue, dispatches the correct request.
+ * look_expired_request - Picks the expired request to dispatch, if any.
+ * @ld: look data
+ *
+ * Expired reads are preferred, but only writes_starved times in a row
+ * while there is an expired write waiting as well.
+ */
+static struct request *look_expired_request(struct look_data *ld)
+{
+	const int reads = look_fifo_expired(ld, READ);
+	const int writes = look_fifo_expired(ld, WRITE);
+
+	if (reads && !(writes && ld->starved >= ld->writes_starved)) {
+		if (writes)
+			ld->starved++;
+		return rq_entry_fifo(ld->fifo_list[READ].next);
+	}
+
+	if (writes) {
+		ld->starved = 0;
+		return rq_entry_fifo(ld->fifo_list[WRITE].next);
+	}
+
+	return NULL;
+}
+
+/**
+ * look_dispatch - Dispatches the next request in the direction of the head.
  * @*q: the request queue
  * @force: unused variable
  *
- * The search starts at the head of the list and searches for the request with the
- * smallest block number higher than the current disk head position and the request
- * with the largest block number lower than the current disk head position. It then
- * checks to see if the disk head needs to switch directions (if it has already
- * dispatched the highest or lowest request in the list) and dispatches the proper
- * request (higher or lower).
+ * The next request is the one with the smallest block number at or above
+ * the current disk head position when the head is moving up, or the one
+ * with the largest block number at or below it when the head is moving
+ * down. If there is no such request, the head has already dispatched the
+ * highest or lowest request in the queue and switches directions. C-LOOK
+ * instead goes back to the lowest request and sweeps up again.
+ *
+ * In deadline mode the FIFOs are checked every fifo_batch dispatches, and
+ * an expired request is dispatched instead, moving the head to it.
  */
 static int look_dispatch(struct request_queue *q, int force)
 {
-	struct look_data *nd = q->elevator->elevator_data;
-	struct request *rq, *higher = NULL, *lower = NULL;
-	struct list_head *pos;
-	
+	struct look_data *ld = q->elevator->elevator_data;
+	const int policy = ld->policy;
+	struct request *rq = NULL;
+
 	// Only dispatch if the request queue is not empty
-	if (!list_empty(&nd->queue)) {
-
-		// Find next higher and lower requests based 
-		// on current head location
-		list_for_each( pos, &nd->queue ) {
-
-			rq = list_entry( pos, struct request, queuelist );
-		
-			// Is this request the better higher one?
-			if( blk_rq_pos( rq ) >= nd->cur_pos ) {
-				if( higher != NULL ) {
-					if( blk_rq_pos( rq ) < blk_rq_pos( higher ) ) {
-						higher = rq;
-					}
-				}
-				else {
-					higher = rq;
-				}
-			}
-			
-			// Is this request the better lower one?
-			if( blk_rq_pos( rq ) <= nd->cur_pos ) {
-				if( lower != NULL ) {
-					if( blk_rq_pos( rq ) > blk_rq_pos( lower ) ) {
-						lower = rq;
-					}
-				}
-				else {
-					lower = rq;
-				}
-			}
+	if (!RB_EMPTY_ROOT(look_active(ld))) {
 
-		}
+		// With the driver idle, the head is where the last request ended
+		if (!ld->nr_in_flight && list_empty(&q->queue_head))
+			ld->cur_pos = ld->head_pos;
 
-		// Switch directions if needed
-		if( nd->dir == 1 && higher == NULL )
-			nd->dir = 0;
-		if( nd->dir == 0 && lower == NULL )
-			nd->dir = 1;
+		// C-LOOK only ever sweeps up
+		if (policy == LOOK_POLICY_CLOOK && ld->dir != LOOK_UP) {
+			ld->dir = LOOK_UP;
+			ld->next_rq = NULL;
+		}
 
-		// Dispatch request
-		if( nd->dir == 1 ) {
-			printk( "[LOOK] dsp %u %llu\n", nd->dir, blk_rq_pos( higher ) );
-			nd->cur_pos = higher->bio->bi_sector + bio_sectors(higher->bio);
-			list_del_init( &higher->queuelist );
-			elv_dispatch_sort( q, higher );
+		// Between batches, expired requests go first
+		if (ld->deadline && ld->batching >= ld->fifo_batch) {
+			rq = look_expired_request(ld);
+			ld->batching = 0;
 		}
-		if( nd->dir == 0 ) {
-			printk( "[LOOK] dsp %u %llu\n", nd->dir, blk_rq_pos( lower ) );
-			nd->cur_pos = lower->bio->bi_sector + bio_sectors(lower->bio);
-			list_del_init( &lower->queuelist );
-			elv_dispatch_sort( q, lower );
+
+		if (!rq)
+			rq = look_next_request(ld);
+
+		// Switch directions, or wrap around for C-LOOK, if needed
+		if (!rq) {
+			if (policy == LOOK_POLICY_CLOOK) {
+				rq = rb_entry_rq(rb_first(look_active(ld)));
+			} else {
+				ld->dir = !ld->dir;
+				ld->next_rq = NULL;
+				rq = look_next_request(ld);
+			}
+			ld->nr_reversals++;
 		}
 
+		// Dispatch request
+		ld->batching++;
+		look_move_request(q, rq);
+
 		return 1;
 
 	}
 
-	printk( "[LOOK] No request to dispatch\n" );
-
 	return 0;
 
 }
 
 /**
- * look_add_request - Adds a request to the request list.
+ * look_add_request - Adds a request to the sorted request tree.
  * @*q: request list
  * @*rq: request to add
  *
- * This function is unchanged, save for the addition of the
- * printk statement.  All the LOOK logic is implemented in
- * look_dispatch
+ * The policy decides whether the request joins the current sweep. If it
+ * does and lies between the head and the cached next request, it becomes
+ * the new next request. The request also gets an expiry time and goes on
+ * the FIFO for its data direction.
  */
 static void look_add_request(struct request_queue *q, struct request *rq)
 {
-	struct look_data *nd = q->elevator->elevator_data;
+	struct look_data *ld = q->elevator->elevator_data;
+	const int data_dir = rq_data_dir(rq);
+
+	look_add_rq_rb(q, rq, look_join_sweep(ld));
+	ld->nr_queued++;
+	trace_look_add_request(rq, ld->dir, ld->cur_pos, ld->nr_queued);
 
-	printk( "[LOOK] add %u %llu\n", nd->dir, blk_rq_pos( rq ) );
+	look_update_next(ld, rq);
 
-	list_add_tail(&rq->queuelist, &nd->queue);
+	rq_set_fifo_time(rq, jiffies + ld->fifo_expire[data_dir]);
+	list_add_tail(&rq->queuelist, &ld->fifo_list[data_dir]);
 }
 
 /**
- * look_queue_emtpy - This function is unchanged.
+ * look_seek_bucket - Returns the seek histogram bucket for @dist sectors.
  */
-static int look_queue_empty(struct request_queue *q)
+static inline int look_seek_bucket(sector_t dist)
 {
-	struct look_data *nd = q->elevator->elevator_data;
+	int bucket = 0;
 
-	return list_empty(&nd->queue);
+	while (dist && bucket < LOOK_SEEK_BUCKETS - 1) {
+		bucket++;
+		dist >>= 3;
+	}
+	return bucket;
 }
 
 /**
- * struct look_former_request - Returns the previous request.
- * This function is unchanged and unused.
+ * look_activate_request - Called when the driver starts on a request.
+ * @q: the request queue
+ * @rq: the request
+ *
+ * The driver services requests in the order it starts them, so this is
+ * where the real seek distance is known, whatever order the dispatch
+ * queue ended up in.
  */
-static struct request *
-look_former_request(struct request_queue *q, struct request *rq)
+static void look_activate_request(struct request_queue *q, struct request *rq)
 {
-	struct look_data *nd = q->elevator->elevator_data;
+	struct look_data *ld = q->elevator->elevator_data;
+	sector_t pos = blk_rq_pos(rq);
+	sector_t dist = pos > ld->act_pos ? pos - ld->act_pos :
+					    ld->act_pos - pos;
+
+	ld->nr_in_flight++;
+	ld->nr_activated++;
+	ld->seek_total += dist;
+	ld->seek_hist[look_seek_bucket(dist)]++;
+	ld->act_pos = rq_end_sector(rq);
+}
 
-	if (rq->queuelist.prev == &nd->queue)
-		return NULL;
-	return list_entry(rq->queuelist.prev, struct request, queuelist);
+/**
+ * look_deactivate_request - Called when the driver requeues a request.
+ */
+static void look_deactivate_request(struct request_queue *q,
+				    struct request *rq)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+
+	WARN_ON(!ld->nr_in_flight);
+	ld->nr_in_flight--;
 }
 
 /**
- * struct look_latter_request - Returns the next request.
- * This function is unchanged and used.
+ * look_completed_request - Called when the driver has finished a request.
+ * @q: the request queue
+ * @rq: the request
+ *
+ * The head is now at the end of @rq. look_dispatch picks this up once
+ * nothing else is in flight.
  */
-static struct request *
-look_latter_request(struct request_queue *q, struct request *rq)
+static void look_completed_request(struct request_queue *q,
+				   struct request *rq)
 {
-	struct look_data *nd = q->elevator->elevator_data;
+	struct look_data *ld = q->elevator->elevator_data;
 
-	if (rq->queuelist.next == &nd->queue)
-		return NULL;
-	return list_entry(rq->queuelist.next, struct request, queuelist);
+	WARN_ON(!ld->nr_in_flight);
+	ld->nr_in_flight--;
+	ld->head_pos = rq_end_sector(rq);
+}
+
+/**
+ * look_queue_empty - Returns true if no requests are waiting.
+ */
+static int look_queue_empty(struct request_queue *q)
+{
+	struct look_data *ld = q->elevator->elevator_data;
+
+	return RB_EMPTY_ROOT(look_active(ld));
 }
 
 /**
- * *look_init_queue - Initializes the request list.
+ * *look_init_queue - Initializes the request tree.
  * @*q: the request list
  *
- * Initializes the request queue and the disk head position
+ * Initializes the request tree and the disk head position
  * and direction.
  */
 static void *look_init_queue(struct request_queue *q)
 {
-	struct look_data *nd;
+	struct look_data *ld;
 
-	nd = kmalloc_node(sizeof(*nd), GFP_KERNEL, q->node);
-	if (!nd)
+	ld = kmalloc_node(sizeof(*ld), GFP_KERNEL, q->node);
+	if (!ld)
 		return NULL;
-	INIT_LIST_HEAD(&nd->queue);
-	nd->cur_pos = 0;
-	nd->dir = 1;	//Initially going up!
-	return nd;
+	ld->sort_list[0] = RB_ROOT;
+	ld->sort_list[1] = RB_ROOT;
+	ld->active = 0;
+	ld->sweep_len = 0;
+	ld->next_rq = NULL;
+	ld->cur_pos = 0;
+	ld->head_pos = 0;
+	ld->act_pos = 0;
+	ld->nr_in_flight = 0;
+	ld->dir = LOOK_UP;	//Initially going up!
+	ld->nr_queued = 0;
+	INIT_LIST_HEAD(&ld->fifo_list[READ]);
+	INIT_LIST_HEAD(&ld->fifo_list[WRITE]);
+	ld->batching = 0;
+	ld->starved = 0;
+	ld->policy = LOOK_POLICY_LOOK;
+	ld->nstep = nstep;
+	ld->deadline = 1;
+	ld->fifo_expire[READ] = read_expire;
+	ld->fifo_expire[WRITE] = write_expire;
+	ld->fifo_batch = fifo_batch;
+	ld->writes_starved = writes_starved;
+	ld->front_merges = 1;
+	ld->nr_front_merges = 0;
+	ld->nr_back_merges = 0;
+	ld->nr_rq_merges = 0;
+	ld->nr_dispatched = 0;
+	ld->nr_reversals = 0;
+	ld->nr_activated = 0;
+	ld->seek_total = 0;
+	memset(ld->seek_hist, 0, sizeof(ld->seek_hist));
+	return ld;
 }
 
 /**
  * look_exit_queue - Frees memory allocated by look_init_queue.
  * @*e: elevator queue
  *
- * This function is unchanged.
+ * The elevator core drains the queue first, so every sort tree and FIFO
+ * must be empty by now.
  */
 static void look_exit_queue(struct elevator_queue *e)
 {
-	struct look_data *nd = e->elevator_data;
+	struct look_data *ld = e->elevator_data;
 
-	BUG_ON(!list_empty(&nd->queue));
-	kfree(nd);
+	BUG_ON(!RB_EMPTY_ROOT(&ld->sort_list[0]));
+	BUG_ON(!RB_EMPTY_ROOT(&ld->sort_list[1]));
+	BUG_ON(!list_empty(&ld->fifo_list[READ]));
+	BUG_ON(!list_empty(&ld->fifo_list[WRITE]));
+	kfree(ld);
 }
 
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+look_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+look_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct look_data *ld = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return look_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(look_nstep_show, ld->nstep, 0);
+SHOW_FUNCTION(look_deadline_show, ld->deadline, 0);
+SHOW_FUNCTION(look_read_expire_show, ld->fifo_expire[READ], 1);
+SHOW_FUNCTION(look_write_expire_show, ld->fifo_expire[WRITE], 1);
+SHOW_FUNCTION(look_writes_starved_show, ld->writes_starved, 0);
+SHOW_FUNCTION(look_fifo_batch_show, ld->fifo_batch, 0);
+SHOW_FUNCTION(look_front_merges_show, ld->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct look_data *ld = e->elevator_data;			\
+	int __data;							\
+	int ret = look_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(look_nstep_store, &ld->nstep, 1, INT_MAX, 0);
+STORE_FUNCTION(look_deadline_store, &ld->deadline, 0, 1, 0);
+STORE_FUNCTION(look_read_expire_store, &ld->fifo_expire[READ], 0, INT_MAX, 1);
+STORE_FUNCTION(look_write_expire_store, &ld->fifo_expire[WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(look_writes_starved_store, &ld->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(look_fifo_batch_store, &ld->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(look_front_merges_store, &ld->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+/**
+ * look_stats_show - Reports the queue counters, one "name value" per line.
+ *
+ * The counters are only ever incremented under the queue lock and
+ * are read here without it, so a line may be a dispatch behind.
+ */
+static ssize_t look_stats_show(struct elevator_queue *e, char *page)
+{
+	struct look_data *ld = e->elevator_data;
+	unsigned long activated = ld->nr_activated;
+	u64 seek_total = ld->seek_total;
+
+	return sprintf(page,
+		       "front_merges %lu\n"
+		       "back_merges %lu\n"
+		       "request_merges %lu\n"
+		       "dispatched %lu\n"
+		       "reversals %lu\n"
+		       "activated %lu\n"
+		       "in_flight %u\n"
+		       "head %llu\n"
+		       "seek_total %llu\n"
+		       "seek_avg %llu\n",
+		       ld->nr_front_merges, ld->nr_back_merges,
+		       ld->nr_rq_merges, ld->nr_dispatched, ld->nr_reversals,
+		       activated, ld->nr_in_flight,
+		       (unsigned long long)ld->head_pos,
+		       (unsigned long long)seek_total,
+		       activated ? (unsigned long long)
+				   div64_u64(seek_total, activated) : 0ULL);
+}
+
+/**
+ * look_seek_hist_show - Reports the seek histogram.
+ *
+ * One line per bucket: the smallest distance in the bucket, in
+ * sectors, and the number of seeks that fell into it.
+ */
+static ssize_t look_seek_hist_show(struct elevator_queue *e, char *page)
+{
+	struct look_data *ld = e->elevator_data;
+	int i, len = 0;
+
+	for (i = 0; i < LOOK_SEEK_BUCKETS; i++)
+		len += sprintf(page + len, "%llu %lu\n",
+			       i ? 1ULL << (3 * (i - 1)) : 0ULL,
+			       ld->seek_hist[i]);
+	return len;
+}
+
+/**
+ * look_policy_show - Lists the policies, with the current one in brackets.
+ */
+static ssize_t look_policy_show(struct elevator_queue *e, char *page)
+{
+	struct look_data *ld = e->elevator_data;
+	int i, len = 0;
+
+	for (i = 0; i < LOOK_POLICY_NR; i++) {
+		if (i == ld->policy)
+			len += sprintf(page + len, "[%s] ", look_policy_names[i]);
+		else
+			len += sprintf(page + len, "%s ", look_policy_names[i]);
+	}
+	len += sprintf(page + len, "\n");
+	return len;
+}
+
+/**
+ * look_policy_store - Switches the sweep policy.
+ *
+ * Requests already waiting for the next sweep stay there, so the
+ * switch is complete once the current sweep has finished.
+ */
+static ssize_t
+look_policy_store(struct elevator_queue *e, const char *page, size_t count)
+{
+	struct look_data *ld = e->elevator_data;
+	int i;
+
+	for (i = 0; i < LOOK_POLICY_NR; i++) {
+		if (sysfs_streq(page, look_policy_names[i])) {
+			ld->policy = i;
+			return count;
+		}
+	}
+
+	return -EINVAL;
+}
+
+#define LOOK_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, look_##name##_show, look_##name##_store)
+
+static struct elv_fs_entry look_attrs[] = {
+	LOOK_ATTR(policy),
+	LOOK_ATTR(nstep),
+	LOOK_ATTR(deadline),
+	LOOK_ATTR(read_expire),
+	LOOK_ATTR(write_expire),
+	LOOK_ATTR(writes_starved),
+	LOOK_ATTR(fifo_batch),
+	LOOK_ATTR(front_merges),
+	__ATTR(stats, S_IRUGO, look_stats_show, NULL),
+	__ATTR(seek_hist, S_IRUGO, look_seek_hist_show, NULL),
+	__ATTR_NULL
+};
+
 static struct elevator_type elevator_look = {
 	.ops = {
+		.elevator_merge_fn		= look_merge,
+		.elevator_merged_fn		= look_merged_request,
 		.elevator_merge_req_fn		= look_merged_requests,
+		.elevator_allow_merge_fn	= look_allow_merge,
 		.elevator_dispatch_fn		= look_dispatch,
 		.elevator_add_req_fn		= look_add_request,
+		.elevator_activate_req_fn	= look_activate_request,
+		.elevator_deactivate_req_fn	= look_deactivate_request,
+		.elevator_completed_req_fn	= look_completed_request,
 		.elevator_queue_empty_fn	= look_queue_empty,
-		.elevator_former_req_fn		= look_former_request,
-		.elevator_latter_req_fn		= look_latter_request,
+		.elevator_former_req_fn		= elv_rb_former_request,
+		.elevator_latter_req_fn		= elv_rb_latter_request,
 		.elevator_init_fn		= look_init_queue,
 		.elevator_exit_fn		= look_exit_queue,
 	},
+
+	.elevator_attrs = look_attrs,
 	.elevator_name = "look",
 	.elevator_owner = THIS_MODULE,
 };
@@ -18,6 +18,7 @@
 #include <linux/radix-tree.h>
 #include <linux/buffer_head.h> /* invalidate_bh_lrus() */
 #include <linux/slab.h>
+#include <linux/log2.h>
 
 #include <asm/uaccess.h>
 
@@ -26,12 +27,26 @@
 #define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
 
 /*
- * Each block ramdisk device has a radix_tree brd_pages of pages that stores
- * the pages containing the block device's contents. A brd page's ->index is
- * its offset in PAGE_SIZE units. This is similar to, but in no way connected
- * with, the kernel's pagecache or buffer cache (which sit above our block
- * device).
+ * Each block ramdisk device stores its contents in chunks of 1 << order
+ * physically contiguous pages (order is 0 unless rd_chunk_order says
+ * otherwise). A chunk's first page has the chunk's offset in chunk-size
+ * units as its ->index. Chunk idx lives in shard idx & (nr_shards - 1),
+ * in that shard's radix tree at idx >> shard_shift, so that writers
+ * allocating different chunks mostly take different locks. This is
+ * similar to, but in no way connected with, the kernel's pagecache or
+ * buffer cache (which sit above our block device).
+ *
+ * When there are no 1 << order free pages in a row, the pages of a
+ * chunk are allocated one at a time instead, and go in the same
+ * shard's singles tree at their offset in pages, which is also their
+ * ->index. A chunk is never in both trees.
  */
+struct brd_shard {
+	spinlock_t		lock;	/* for inserts and deletes */
+	struct radix_tree_root	pages;
+	struct radix_tree_root	singles;
+} ____cacheline_aligned_in_smp;
+
 struct brd_device {
 	int		brd_number;
 	int		brd_refcnt;
@@ -44,19 +59,34 @@ struct brd_device {
 	struct list_head	brd_list;
 
 	/*
-	 * Backing store of pages and lock to protect it. This is the contents
-	 * of the block device.
+	 * Backing store of chunks, the contents of the block device.
 	 */
-	spinlock_t		brd_lock;
-	struct radix_tree_root	brd_pages;
+	unsigned int		brd_chunk_order;
+	unsigned int		brd_shard_shift;
+	struct brd_shard	*brd_shards;
 };
 
+static inline struct brd_shard *brd_shard(struct brd_device *brd,
+					  pgoff_t idx)
+{
+	return &brd->brd_shards[idx & ((1 << brd->brd_shard_shift) - 1)];
+}
+
+/* the page of chunk that holds sector */
+static inline struct page *brd_chunk_page(struct brd_device *brd,
+					  struct page *chunk, sector_t sector)
+{
+	return chunk + ((sector >> PAGE_SECTORS_SHIFT) &
+			((1 << brd->brd_chunk_order) - 1));
+}
+
 /*
  * Look up and return a brd's page for a given sector.
  */
 static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 {
 	pgoff_t idx;
+	struct brd_shard *shard;
 	struct page *page;
 
 	/*
@@ -71,11 +101,104 @@ static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 	 * here, only deletes).
 	 */
 	rcu_read_lock();
-	idx = sector >> PAGE_SECTORS_SHIFT; /* sector to page index */
-	page = radix_tree_lookup(&brd->brd_pages, idx);
+	/* sector to chunk index */
+	idx = sector >> (PAGE_SECTORS_SHIFT + brd->brd_chunk_order);
+	shard = brd_shard(brd, idx);
+	page = radix_tree_lookup(&shard->pages, idx >> brd->brd_shard_shift);
+	if (page) {
+		BUG_ON(page->index != idx);
+		page = brd_chunk_page(brd, page, sector);
+	} else if (brd->brd_chunk_order) {
+		idx = sector >> PAGE_SECTORS_SHIFT;
+		page = radix_tree_lookup(&shard->singles, idx);
+		BUG_ON(page && page->index != idx);
+	}
 	rcu_read_unlock();
 
-	BUG_ON(page && page->index != idx);
+	return page;
+}
+
+/*
+ * Insert chunk, the pages of chunk index idx, unless another writer
+ * got there first. Returns the chunk in the tree, or NULL (having
+ * freed chunk) if some of its pages were already allocated one at a
+ * time or there is no memory for the radix tree.
+ */
+static struct page *brd_insert_chunk(struct brd_device *brd,
+				     struct brd_shard *shard,
+				     struct page *chunk, pgoff_t idx)
+{
+	unsigned int order = brd->brd_chunk_order;
+	struct page *page;
+
+	if (radix_tree_preload(GFP_NOIO)) {
+		__free_pages(chunk, order);
+		return NULL;
+	}
+
+	/* set before lockless readers can see it */
+	chunk->index = idx;
+
+	spin_lock(&shard->lock);
+	if (order && radix_tree_gang_lookup(&shard->singles, (void **)&page,
+					    idx << order, 1) &&
+	    page->index < (idx + 1) << order) {
+		__free_pages(chunk, order);
+		chunk = NULL;
+	} else if (radix_tree_insert(&shard->pages,
+				     idx >> brd->brd_shard_shift, chunk)) {
+		__free_pages(chunk, order);
+		chunk = radix_tree_lookup(&shard->pages,
+					  idx >> brd->brd_shard_shift);
+		BUG_ON(!chunk);
+		BUG_ON(chunk->index != idx);
+	}
+	spin_unlock(&shard->lock);
+
+	radix_tree_preload_end();
+
+	return chunk;
+}
+
+/*
+ * The fallback for a chunk we could not allocate in one piece: give the
+ * page that holds sector a page of its own in the singles tree.
+ */
+static struct page *brd_insert_single(struct brd_device *brd,
+				      struct brd_shard *shard,
+				      sector_t sector, gfp_t gfp_flags)
+{
+	pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+	struct page *page, *chunk;
+
+	page = alloc_page(gfp_flags);
+	if (!page)
+		return NULL;
+
+	if (radix_tree_preload(GFP_NOIO)) {
+		__free_page(page);
+		return NULL;
+	}
+
+	/* set before lockless readers can see it */
+	page->index = idx;
+
+	spin_lock(&shard->lock);
+	chunk = radix_tree_lookup(&shard->pages,
+			(idx >> brd->brd_chunk_order) >> brd->brd_shard_shift);
+	if (chunk) {
+		/* another writer managed to allocate the whole chunk */
+		__free_page(page);
+		page = brd_chunk_page(brd, chunk, sector);
+	} else if (radix_tree_insert(&shard->singles, idx, page)) {
+		__free_page(page);
+		page = radix_tree_lookup(&shard->singles, idx);
+		BUG_ON(!page);
+		BUG_ON(page->index != idx);
+	}
+	spin_unlock(&shard->lock);
+
+	radix_tree_preload_end();
 
 	return page;
 }
@@ -87,7 +210,9 @@ static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
  */
 static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 {
-	pgoff_t idx;
+	unsigned int order = brd->brd_chunk_order;
+	pgoff_t idx = sector >> (PAGE_SECTORS_SHIFT + order);
+	struct brd_shard *shard = brd_shard(brd, idx);
 	struct page *page;
 	gfp_t gfp_flags;
 
@@ -108,37 +233,27 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 #ifndef CONFIG_BLK_DEV_XIP
 	gfp_flags |= __GFP_HIGHMEM;
 #endif
-	page = alloc_page(gfp_flags);
-	if (!page)
-		return NULL;
-
-	if (radix_tree_preload(GFP_NOIO)) {
-		__free_page(page);
-		return NULL;
+	page = alloc_pages(gfp_flags | (order ? __GFP_NOWARN : 0), order);
+	if (page) {
+		page = brd_insert_chunk(brd, shard, page, idx);
+		if (page)
+			return brd_chunk_page(brd, page, sector);
 	}
+	if (!order)
+		return NULL;
 
-	spin_lock(&brd->brd_lock);
-	idx = sector >> PAGE_SECTORS_SHIFT;
-	if (radix_tree_insert(&brd->brd_pages, idx, page)) {
-		__free_page(page);
-		page = radix_tree_lookup(&brd->brd_pages, idx);
-		BUG_ON(!page);
-		BUG_ON(page->index != idx);
-	} else
-		page->index = idx;
-	spin_unlock(&brd->brd_lock);
-
-	radix_tree_preload_end();
-
-	return page;
+	return brd_insert_single(brd, shard, sector, gfp_flags);
 }
 
 /*
- * Free all backing store pages and radix tree. This must only be called when
- * there are no other users of the device.
+ * Free all backing store pages and radix trees. This must only be called
+ * when there are no other users of the device.
+ *
+ * The pages in root are blocks of 1 << order, each at ->index >> shift.
  */
 #define FREE_BATCH 16
-static void brd_free_pages(struct brd_device *brd)
+static void brd_free_tree(struct radix_tree_root *root, unsigned int shift,
+			  unsigned int order)
 {
 	unsigned long pos = 0;
 	struct page *pages[FREE_BATCH];
@@ -147,17 +262,17 @@ static void brd_free_pages(struct brd_device *brd)
 	do {
 		int i;
 
-		nr_pages = radix_tree_gang_lookup(&brd->brd_pages,
+		nr_pages = radix_tree_gang_lookup(root,
 				(void **)pages, pos, FREE_BATCH);
 
 		for (i = 0; i < nr_pages; i++) {
 			void *ret;
 
-			BUG_ON(pages[i]->index < pos);
-			pos = pages[i]->index;
-			ret = radix_tree_delete(&brd->brd_pages, pos);
+			BUG_ON(pages[i]->index >> shift < pos);
+			pos = pages[i]->index >> shift;
+			ret = radix_tree_delete(root, pos);
 			BUG_ON(!ret || ret != pages[i]);
-			__free_page(pages[i]);
+			__free_pages(pages[i], order);
 		}
 
 		pos++;
@@ -170,6 +285,21 @@ static void brd_free_pages(struct brd_device *brd)
 	} while (nr_pages == FREE_BATCH);
 }
 
+static void brd_free_shard(struct brd_device *brd, struct brd_shard *shard)
+{
+	brd_free_tree(&shard->pages, brd->brd_shard_shift,
+		      brd->brd_chunk_order);
+	brd_free_tree(&shard->singles, 0, 0);
+}
+
+static void brd_free_pages(struct brd_device *brd)
+{
+	int i;
+
+	for (i = 0; i < 1 << brd->brd_shard_shift; i++)
+		brd_free_shard(brd, &brd->brd_shards[i]);
+}
+
 /*
  * copy_to_brd_setup must be called before copy_to_brd. It may sleep.
  */
@@ -388,12 +518,16 @@ static const struct block_device_operations brd_fops = {
  */
 static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
+static int rd_chunk_order;
 static int max_part;
 static int part_shift;
 module_param(rd_nr, int, 0);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
+module_param(rd_chunk_order, int, 0);
+MODULE_PARM_DESC(rd_chunk_order,
+		 "Allocate RAM disk memory 2^order pages at a time.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
 MODULE_LICENSE("GPL");
@@ -421,17 +555,29 @@ static struct brd_device *brd_alloc(int i)
 {
 	struct brd_device *brd;
 	struct gendisk *disk;
+	int j;
 
 	brd = kzalloc(sizeof(*brd), GFP_KERNEL);
 	if (!brd)
 		goto out;
 	brd->brd_number		= i;
-	spin_lock_init(&brd->brd_lock);
-	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
+	brd->brd_chunk_order	= rd_chunk_order;
+
+	/* about one shard per CPU */
+	brd->brd_shard_shift = ilog2(roundup_pow_of_two(num_possible_cpus()));
+	brd->brd_shards = kcalloc(1 << brd->brd_shard_shift,
+				  sizeof(struct brd_shard), GFP_KERNEL);
+	if (!brd->brd_shards)
+		goto out_free_dev;
+	for (j = 0; j < 1 << brd->brd_shard_shift; j++) {
+		spin_lock_init(&brd->brd_shards[j].lock);
+		INIT_RADIX_TREE(&brd->brd_shards[j].pages, GFP_ATOMIC);
+		INIT_RADIX_TREE(&brd->brd_shards[j].singles, GFP_ATOMIC);
+	}
 
 	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
 	if (!brd->brd_queue)
-		goto out_free_dev;
+		goto out_free_shards;
 	blk_queue_make_request(brd->brd_queue, brd_make_request);
 	blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG, NULL);
 	blk_queue_max_hw_sectors(brd->brd_queue, 1024);
@@ -453,6 +599,8 @@ static struct brd_device *brd_alloc(int i)
 
 out_free_queue:
 	blk_cleanup_queue(brd->brd_queue);
+out_free_shards:
+	kfree(brd->brd_shards);
 out_free_dev:
 	kfree(brd);
 out:
@@ -464,6 +612,7 @@ static void brd_free(struct brd_device *brd)
 	put_disk(brd->brd_disk);
 	blk_cleanup_queue(brd->brd_queue);
 	brd_free_pages(brd);
+	kfree(brd->brd_shards);
 	kfree(brd);
 }
 
@@ -534,6 +683,9 @@ static int __init brd_init(void)
 	if (rd_nr > 1UL << (MINORBITS - part_shift))
 		return -EINVAL;
 
+	if (rd_chunk_order < 0 || rd_chunk_order >= MAX_ORDER)
+		return -EINVAL;
+
 	if (rd_nr) {
 		nr = rd_nr;
 		range = rd_nr;
@@ -73,6 +73,8 @@
 #include <linux/highmem.h>
 #include <linux/kthread.h>
 #include <linux/splice.h>
+#include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
 
 #include <asm/uaccess.h>
 
@@ -506,6 +508,347 @@ out:
 	return ret;
 }
 
+/*
+ * Direct I/O.
+ *
+ * With LO_FLAGS_DIRECT_IO the blocks behind the loop device are looked
+ * up once with the backing filesystem's ->fiemap, and
+ * loop_make_request() sends each bio straight to the device they live
+ * on.  Nothing goes through the loop thread or the backing file's page
+ * cache, so any number of bios can be in flight and data is cached
+ * once, above the loop device.
+ *
+ * Every block of the backing file must hold its data on disk: no holes,
+ * and no unwritten (preallocated) or delayed allocation extents, whose
+ * blocks the filesystem would read back as zeroes whatever we wrote to
+ * them.  There must be no transfer function either, and while the map
+ * exists S_SWAPFILE keeps the file from being truncated.
+ *
+ * S_SWAPFILE does not stop anyone else from opening the backing file.
+ * Their reads and writes go through its page cache, which direct I/O
+ * neither sees nor updates, so they and the loop device can each miss
+ * the other's changes.
+ */
+struct loop_extent {
+	sector_t		start;	/* first sector on the loop device */
+	sector_t		len;
+	sector_t		disk;	/* first sector on map->bdev */
+};
+
+struct loop_map {
+	struct block_device	*bdev;
+	unsigned int		nr;
+	struct loop_extent	extent[0];
+};
+
+/*
+ * Extents whose blocks do not simply hold the file's data, or that are
+ * shared with other files.
+ */
+#define LOOP_FIEMAP_REFUSE	(FIEMAP_EXTENT_UNKNOWN |		\
+				 FIEMAP_EXTENT_DELALLOC |		\
+				 FIEMAP_EXTENT_ENCODED |		\
+				 FIEMAP_EXTENT_NOT_ALIGNED |		\
+				 FIEMAP_EXTENT_UNWRITTEN |		\
+				 FIEMAP_EXTENT_SHARED)
+#define LOOP_FIEMAP_BATCH	16
+
+/*
+ * Map the part of the backing file behind the loop device with
+ * ->fiemap, merging physically contiguous extents.  Fills in up to max
+ * extents if ext is not NULL.  Returns the number of extents, -EINVAL
+ * if the file has a hole or an extent we can't do direct I/O to, or
+ * another error.
+ */
+static int loop_map_file(struct loop_device *lo, struct inode *inode,
+			 struct loop_extent *ext, unsigned int max)
+{
+	u64 pos = lo->lo_offset;
+	u64 end = pos + ((u64)get_capacity(lo->lo_disk) << 9);
+	struct loop_extent cur = { 0, 0, 0 };
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *fe;
+	mm_segment_t old_fs;
+	unsigned int i, nr = 0;
+	u64 skip, len, phys, last;
+	int ret;
+
+	fe = kmalloc(LOOP_FIEMAP_BATCH * sizeof(*fe), GFP_KERNEL);
+	if (!fe)
+		return -ENOMEM;
+
+	while (pos < end) {
+		cond_resched();
+
+		memset(&fieinfo, 0, sizeof(fieinfo));
+		fieinfo.fi_extents_max = LOOP_FIEMAP_BATCH;
+		fieinfo.fi_extents_start = fe;
+
+		/* fiemap_fill_next_extent() copies out to "user" memory */
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		ret = inode->i_op->fiemap(inode, &fieinfo, pos, end - pos);
+		set_fs(old_fs);
+		if (ret)
+			goto out;
+
+		last = pos;
+		for (i = 0; i < fieinfo.fi_extents_mapped && pos < end; i++) {
+			if (fe[i].fe_logical > pos ||
+			    (fe[i].fe_flags & LOOP_FIEMAP_REFUSE))
+				goto refuse;
+			skip = pos - fe[i].fe_logical;
+			if (skip >= fe[i].fe_length)
+				continue;
+			len = min(fe[i].fe_length - skip, end - pos);
+			phys = fe[i].fe_physical + skip;
+			if ((phys | len) & 511)
+				goto refuse;
+
+			if (nr && cur.disk + cur.len == phys >> 9) {
+				cur.len += len >> 9;
+			} else {
+				if (ext && nr) {
+					if (nr == max) {
+						ret = -EBUSY;
+						goto out;
+					}
+					ext[nr - 1] = cur;
+				}
+				cur.start = (pos - lo->lo_offset) >> 9;
+				cur.len = len >> 9;
+				cur.disk = phys >> 9;
+				nr++;
+			}
+			pos += len;
+		}
+		/* a hole, possibly past the end of the file */
+		if (pos == last)
+			goto refuse;
+	}
+
+	if (ext && nr)
+		ext[nr - 1] = cur;
+	ret = nr;
+	goto out;
+refuse:
+	ret = -EINVAL;
+out:
+	kfree(fe);
+	return ret;
+}
+
+static struct loop_map *loop_build_map(struct loop_device *lo)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+	struct loop_map *map;
+	int nr;
+
+	if (S_ISBLK(inode->i_mode)) {
+		if (lo->lo_offset & 511)
+			return ERR_PTR(-EINVAL);
+		map = vmalloc(sizeof(*map) + sizeof(struct loop_extent));
+		if (!map)
+			return ERR_PTR(-ENOMEM);
+		map->bdev = inode->i_bdev;
+		map->nr = 1;
+		map->extent[0].start = 0;
+		map->extent[0].len = get_capacity(lo->lo_disk);
+		map->extent[0].disk = lo->lo_offset >> 9;
+		return map;
+	}
+
+	/*
+	 * As for swapon, ->bmap says the file's blocks are on s_bdev; we
+	 * need ->fiemap as well to tell which of them hold data.
+	 */
+	if (!file->f_mapping->a_ops->bmap || !inode->i_op->fiemap ||
+	    !inode->i_sb->s_bdev || (lo->lo_offset & 511))
+		return ERR_PTR(-EINVAL);
+
+	nr = loop_map_file(lo, inode, NULL, 0);
+	if (nr == -EINVAL)
+		printk(KERN_ERR "loop%d: backing file has holes or unwritten "
+		       "extents, no direct I/O\n", lo->lo_number);
+	if (nr <= 0)
+		return ERR_PTR(nr ? nr : -EINVAL);
+
+	map = vmalloc(sizeof(*map) + nr * sizeof(struct loop_extent));
+	if (!map)
+		return ERR_PTR(-ENOMEM);
+	map->bdev = inode->i_sb->s_bdev;
+	map->nr = nr;
+	if (loop_map_file(lo, inode, map->extent, nr) != nr) {
+		/* it changed under us */
+		vfree(map);
+		return ERR_PTR(-EBUSY);
+	}
+	return map;
+}
+
+static struct loop_extent *loop_find_extent(struct loop_map *map,
+					    sector_t sector)
+{
+	unsigned int first = 0, last = map->nr, mid;
+	struct loop_extent *ext;
+
+	while (first < last) {
+		mid = (first + last) / 2;
+		ext = &map->extent[mid];
+		if (sector < ext->start)
+			last = mid;
+		else if (sector >= ext->start + ext->len)
+			first = mid + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+static void loop_inflight_put(struct loop_device *lo)
+{
+	if (atomic_dec_and_test(&lo->lo_inflight))
+		wake_up(&lo->lo_inflight_wait);
+}
+
+static void loop_direct_end_io(struct bio *clone, int error)
+{
+	struct bio *bio = clone->bi_private;
+	struct loop_device *lo = bio->bi_bdev->bd_disk->private_data;
+
+	bio_put(clone);
+	bio_endio(bio, error);
+	loop_inflight_put(lo);
+}
+
+/*
+ * Find where bio goes, if there is a map.  The map can be replaced at
+ * any time, so the extent is copied out under RCU; the count taken
+ * keeps loop_drop_map() waiting until the caller is done with bdev.  A
+ * zeroed ext means bio is outside the map.
+ */
+static bool loop_direct_lookup(struct loop_device *lo, struct bio *bio,
+			       struct block_device **bdev,
+			       struct loop_extent *ext)
+{
+	struct loop_extent *e;
+	struct loop_map *map;
+
+	rcu_read_lock();
+	map = rcu_dereference(lo->lo_map);
+	if (map) {
+		*bdev = map->bdev;
+		e = loop_find_extent(map, bio->bi_sector);
+		if (e)
+			*ext = *e;
+		else
+			memset(ext, 0, sizeof(*ext));
+		atomic_inc(&lo->lo_inflight);
+	}
+	rcu_read_unlock();
+
+	return map != NULL;
+}
+
+/*
+ * A bio that spans two extents despite loop_merge_bvec() is split if it
+ * is a single page, like md linear does.
+ */
+static void loop_direct_request(struct loop_device *lo, struct bio *bio,
+				struct block_device *bdev,
+				struct loop_extent *ext)
+{
+	struct bio *clone;
+	sector_t left;
+
+	if (bio->bi_size) {
+		if (unlikely(!ext->len))
+			goto fail;
+
+		left = ext->start + ext->len - bio->bi_sector;
+		if (unlikely(bio_sectors(bio) > left)) {
+			struct bio_pair *bp;
+
+			if (bio->bi_vcnt != 1 || bio->bi_idx != 0)
+				goto fail;
+			bp = bio_split(bio, left);
+			generic_make_request(&bp->bio1);
+			generic_make_request(&bp->bio2);
+			bio_pair_release(bp);
+			return;
+		}
+	}
+
+	clone = bio_clone(bio, GFP_NOIO);
+	if (unlikely(!clone)) {
+		bio_endio(bio, -ENOMEM);
+		return;
+	}
+	clone->bi_bdev = bdev;
+	if (bio->bi_size)
+		clone->bi_sector = ext->disk + bio->bi_sector - ext->start;
+	clone->bi_private = bio;
+	clone->bi_end_io = loop_direct_end_io;
+
+	atomic_inc(&lo->lo_inflight);
+	generic_make_request(clone);
+	return;
+
+fail:
+	printk(KERN_ERR "loop%d: no direct I/O for %u bytes at sector %llu\n",
+	       lo->lo_number, bio->bi_size,
+	       (unsigned long long)bio->bi_sector);
+	bio_io_error(bio);
+}
+
+/*
+ * Keep bios within one extent, and within what the device below takes.
+ */
+static int loop_merge_bvec(struct request_queue *q, struct bvec_merge_data *bvm,
+			   struct bio_vec *biovec)
+{
+	struct loop_device *lo = q->queuedata;
+	sector_t sector = bvm->bi_sector + get_start_sect(bvm->bi_bdev);
+	unsigned long maxsectors = 0, bio_sectors = bvm->bi_size >> 9;
+	struct request_queue *bq;
+	struct loop_extent *ext;
+	struct loop_map *map;
+	int max;
+
+	rcu_read_lock();
+	map = rcu_dereference(lo->lo_map);
+	if (!map) {
+		rcu_read_unlock();
+		return biovec->bv_len;
+	}
+
+	ext = loop_find_extent(map, sector);
+	if (ext)
+		maxsectors = ext->start + ext->len - sector;
+	if (maxsectors < bio_sectors)
+		maxsectors = 0;
+	else
+		maxsectors -= bio_sectors;
+
+	if (maxsectors <= (PAGE_SIZE >> 9) && bio_sectors == 0)
+		max = biovec->bv_len;
+	else if (maxsectors > (1 << (31-9)))
+		max = 1 << 31;
+	else
+		max = maxsectors << 9;
+
+	bq = bdev_get_queue(map->bdev);
+	if (ext && bq->merge_bvec_fn) {
+		bvm->bi_bdev = map->bdev;
+		bvm->bi_sector = ext->disk + sector - ext->start;
+		max = min(max, bq->merge_bvec_fn(bq, bvm, biovec));
+	}
+	rcu_read_unlock();
+
+	return max;
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -526,12 +869,25 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
 	int rw = bio_rw(old_bio);
+	struct block_device *bdev;
+	struct loop_extent ext;
 
 	if (rw == READA)
 		rw = READ;
 
 	BUG_ON(!lo || (rw != READ && rw != WRITE));
 
+	/* the magic bio from loop_switch() must reach the thread */
+	if (old_bio->bi_bdev && loop_direct_lookup(lo, old_bio, &bdev, &ext)) {
+		if (unlikely(rw == WRITE &&
+			     (lo->lo_flags & LO_FLAGS_READ_ONLY)))
+			bio_io_error(old_bio);
+		else
+			loop_direct_request(lo, old_bio, bdev, &ext);
+		loop_inflight_put(lo);
+		return 0;
+	}
+
 	spin_lock_irq(&lo->lo_lock);
 	if (lo->lo_state != Lo_bound)
 		goto out;
@@ -555,8 +911,16 @@ static void loop_unplug(struct request_queue *q)
 {
 	struct loop_device *lo = q->queuedata;
 
+	struct loop_map *map;
+
 	queue_flag_clear_unlocked(QUEUE_FLAG_PLUGGED, q);
 	blk_run_address_space(lo->lo_backing_file->f_mapping);
+
+	rcu_read_lock();
+	map = rcu_dereference(lo->lo_map);
+	if (map)
+		blk_unplug(bdev_get_queue(map->bdev));
+	rcu_read_unlock();
 }
 
 struct switch_request {
@@ -592,6 +956,7 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 static int loop_thread(void *data)
 {
 	struct loop_device *lo = data;
+	struct blk_plug plug;
 	struct bio *bio;
 
 	set_user_nice(current, -20);
@@ -602,14 +967,20 @@ static int loop_thread(void *data)
 				!bio_list_empty(&lo->lo_bio_list) ||
 				kthread_should_stop());
 
-		if (bio_list_empty(&lo->lo_bio_list))
-			continue;
-		spin_lock_irq(&lo->lo_lock);
-		bio = loop_get_bio(lo);
-		spin_unlock_irq(&lo->lo_lock);
-
-		BUG_ON(!bio);
-		loop_handle_bio(lo, bio);
+		/*
+		 * Batch the backing file I/O for all the bios queued so
+		 * far under one plug.
+		 */
+		blk_start_plug(&plug);
+		while (!bio_list_empty(&lo->lo_bio_list)) {
+			spin_lock_irq(&lo->lo_lock);
+			bio = loop_get_bio(lo);
+			spin_unlock_irq(&lo->lo_lock);
+
+			BUG_ON(!bio);
+			loop_handle_bio(lo, bio);
+		}
+		blk_finish_plug(&plug);
 	}
 
 	return 0;
@@ -672,6 +1043,117 @@ out:
 }
 
 
+/*
+ * Take the map down; once this returns no bio is using it.  Called with
+ * lo_ctl_mutex held.
+ */
+static void loop_drop_map(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	struct loop_map *map = lo->lo_map;
+
+	rcu_assign_pointer(lo->lo_map, NULL);
+	/* whoever saw the map has counted his bio by now */
+	synchronize_rcu();
+	wait_event(lo->lo_inflight_wait, !atomic_read(&lo->lo_inflight));
+	vfree(map);
+
+	lo->lo_queue->limits = lo->lo_limits;
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	if (S_ISREG(inode->i_mode)) {
+		mutex_lock(&inode->i_mutex);
+		inode->i_flags &= ~S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+	}
+}
+
+/*
+ * The offset or size changed: map the file again, or leave direct I/O if
+ * that fails.
+ */
+static int loop_update_map(struct loop_device *lo)
+{
+	struct loop_map *map, *old = lo->lo_map;
+
+	if (!(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+
+	map = loop_build_map(lo);
+	if (IS_ERR(map)) {
+		loop_drop_map(lo);
+		return PTR_ERR(map);
+	}
+	lo->lo_queue->limits = lo->lo_limits;
+	disk_stack_limits(lo->lo_disk, map->bdev, map->extent[0].disk);
+	rcu_assign_pointer(lo->lo_map, map);
+	synchronize_rcu();
+	vfree(old);
+	return 0;
+}
+
+static int loop_set_direct_io(struct loop_device *lo, unsigned long arg)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode;
+	struct loop_map *map;
+	int error;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+	if (!arg) {
+		loop_drop_map(lo);
+		return 0;
+	}
+
+	/*
+	 * Nobody else may have I/O on its way through the page cache, and
+	 * transfer functions need the loop thread.
+	 */
+	if (lo->lo_refcnt > 1)
+		return -EBUSY;
+	if (lo->transfer != transfer_none)
+		return -EINVAL;
+
+	inode = file->f_mapping->host;
+	if (S_ISREG(inode->i_mode)) {
+		mutex_lock(&inode->i_mutex);
+		error = IS_SWAPFILE(inode) ? -EBUSY : 0;
+		if (!error)
+			inode->i_flags |= S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+		if (error)
+			return error;
+	}
+
+	/* write back and drop what the thread left in the page cache */
+	loop_flush(lo);
+	error = vfs_fsync(file, file->f_path.dentry, 0);
+	if (!error)
+		error = invalidate_inode_pages2(file->f_mapping);
+	if (!error) {
+		map = loop_build_map(lo);
+		if (IS_ERR(map))
+			error = PTR_ERR(map);
+	}
+	if (error) {
+		if (S_ISREG(inode->i_mode)) {
+			mutex_lock(&inode->i_mutex);
+			inode->i_flags &= ~S_SWAPFILE;
+			mutex_unlock(&inode->i_mutex);
+		}
+		return error;
+	}
+
+	/* narrowed to what the device below takes, until loop_drop_map() */
+	lo->lo_limits = lo->lo_queue->limits;
+	disk_stack_limits(lo->lo_disk, map->bdev, map->extent[0].disk);
+	lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	rcu_assign_pointer(lo->lo_map, map);
+	return 0;
+}
+
 /*
  * loop_change_fd switched the backing store of a loopback device to
  * a new file. This is useful for operating system installers to free up
@@ -691,9 +1173,10 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (lo->lo_state != Lo_bound)
 		goto out;
 
-	/* the loop device has to be read-only */
+	/* the loop device has to be read-only, and not mapped */
 	error = -EINVAL;
-	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
+	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY) ||
+	    (lo->lo_flags & LO_FLAGS_DIRECT_IO))
 		goto out;
 
 	error = -EBADF;
@@ -827,6 +1310,7 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	 * device
 	 */
 	blk_queue_make_request(lo->lo_queue, loop_make_request);
+	blk_queue_merge_bvec(lo->lo_queue, loop_merge_bvec);
 	lo->lo_queue->queuedata = lo;
 	lo->lo_queue->unplug_fn = loop_unplug;
 
@@ -925,6 +1409,9 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	kthread_stop(lo->lo_thread);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_drop_map(lo);
+
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
 
@@ -978,6 +1465,10 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* direct I/O has nowhere to run a transfer function */
+	if (info->lo_encrypt_type &&
+	    ((lo->lo_flags | info->lo_flags) & LO_FLAGS_DIRECT_IO))
+		return -EINVAL;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1004,6 +1495,9 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		lo->lo_sizelimit = info->lo_sizelimit;
 		if (figure_loop_size(lo))
 			return -EFBIG;
+		err = loop_update_map(lo);
+		if (err)
+			return err;
 	}
 
 	memcpy(lo->lo_file_name, info->lo_file_name, LO_NAME_SIZE);
@@ -1029,6 +1523,9 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		lo->lo_key_owner = uid;
 	}	
 
+	/* Only turn direct I/O on: see LOOP_SET_DIRECT_IO in lo_ioctl() */
+	if ((info->lo_flags & ~lo->lo_flags) & LO_FLAGS_DIRECT_IO)
+		return loop_set_direct_io(lo, 1);
 	return 0;
 }
 
@@ -1181,6 +1678,9 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	if (unlikely(lo->lo_state != Lo_bound))
 		goto out;
 	err = figure_loop_size(lo);
+	if (unlikely(err))
+		goto out;
+	err = loop_update_map(lo);
 	if (unlikely(err))
 		goto out;
 	sec = get_capacity(lo->lo_disk);
@@ -1232,6 +1732,21 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		/*
+		 * LOOP_SET_STATUS can turn direct I/O on by setting
+		 * LO_FLAGS_DIRECT_IO, but leaves it on when the flag is
+		 * clear: callers that predate the flag always pass it
+		 * clear.  This is the only way to turn it off.
+		 *
+		 * Direct I/O bypasses the backing file's page cache, so it
+		 * is not coherent with anyone else who has the file open
+		 * and reads or writes it the usual way.
+		 */
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_direct_io(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1386,6 +1901,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1517,6 +2033,7 @@ static struct loop_device *loop_alloc(int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	init_waitqueue_head(&lo->lo_inflight_wait);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -0,0 +1,539 @@
+/*
+ * Null block device: completes every request without moving any data,
+ * so that what is left is the cost of the block layer itself.
+ *
+ * The devices are /dev/nullb0 and up. Each can sit behind any of the
+ * three kinds of queue, and complete its I/O in the submitter's context,
+ * in the block softirq or from a timer, so that each part of the path
+ * can be measured on its own. See Documentation/block/null_blk.txt.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+
+struct nullb_cmd {
+	struct list_head list;
+	struct request *rq;
+	struct bio *bio;
+	int tag;
+	struct nullb_queue *nq;
+};
+
+/*
+ * Command slots for the bio and request based modes; the multi-queue
+ * core hands out its own.
+ */
+struct nullb_queue {
+	struct blk_queue_tag *tags;
+	unsigned int last_tag;
+	wait_queue_head_t wait;
+	struct nullb_cmd *cmds;
+};
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+	spinlock_t lock;		/* queue_lock in request mode */
+
+	struct nullb_queue *queues;
+	unsigned int nr_queues;
+	struct work_struct restart_work;	/* see end_cmd() */
+};
+
+/* commands waiting for the timer, per CPU */
+struct completion_queue {
+	struct list_head list;
+	struct hrtimer timer;
+};
+
+static DEFINE_PER_CPU(struct completion_queue, completion_queues);
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+	NULL_IRQ_TIMER		= 2,
+};
+
+enum {
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+};
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "0: bio based, 1: request based, 2: multi-queue");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "Complete in 0: submitter, 1: softirq, 2: timer");
+
+static unsigned long completion_nsec = 10000;
+module_param(completion_nsec, ulong, S_IRUGO);
+MODULE_PARM_DESC(completion_nsec, "Timer delay in ns when irqmode=2");
+
+static int nr_devices = 1;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size of each device in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Logical block size in bytes");
+
+static int hw_queues;
+module_param(hw_queues, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queues, "Submission queues per device, 0 for one per CPU");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Requests in flight per submission queue");
+
+static struct nullb_queue *nullb_to_queue(struct nullb *nullb)
+{
+	return &nullb->queues[raw_smp_processor_id() % nullb->nr_queues];
+}
+
+static struct nullb_cmd *__alloc_cmd(struct nullb_queue *nq)
+{
+	struct nullb_cmd *cmd;
+	int tag;
+
+	tag = blk_tag_get(nq->tags, nq->last_tag);
+	if (tag < 0)
+		return NULL;
+	nq->last_tag = tag + 1;
+
+	cmd = &nq->cmds[tag];
+	cmd->tag = tag;
+	cmd->nq = nq;
+	return cmd;
+}
+
+static struct nullb_cmd *alloc_cmd(struct nullb_queue *nq, int can_wait)
+{
+	struct nullb_cmd *cmd;
+	DEFINE_WAIT(wait);
+
+	cmd = __alloc_cmd(nq);
+	if (cmd || !can_wait)
+		return cmd;
+
+	for (;;) {
+		prepare_to_wait(&nq->wait, &wait, TASK_UNINTERRUPTIBLE);
+		cmd = __alloc_cmd(nq);
+		if (cmd)
+			break;
+		io_schedule();
+	}
+	finish_wait(&nq->wait, &wait);
+	return cmd;
+}
+
+static void free_cmd(struct nullb_cmd *cmd)
+{
+	struct nullb_queue *nq = cmd->nq;
+
+	blk_tag_put(nq->tags, cmd->tag);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&nq->wait))
+		wake_up(&nq->wait);
+}
+
+static void end_cmd(struct nullb_cmd *cmd)
+{
+	struct request_queue *q;
+	unsigned long flags;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		blk_mq_end_io(cmd->rq, 0);
+		return;
+	case NULL_Q_RQ:
+		q = cmd->rq->q;
+		blk_end_request_all(cmd->rq, 0);
+		free_cmd(cmd);
+
+		/*
+		 * null_rq_prep_fn() stops the queue when it runs out.
+		 * We may be in hard or soft interrupt context here, where
+		 * the request_fn must not run, so restart it from kblockd.
+		 */
+		spin_lock_irqsave(q->queue_lock, flags);
+		if (blk_queue_stopped(q)) {
+			struct nullb *nullb = q->queuedata;
+
+			queue_flag_clear(QUEUE_FLAG_STOPPED, q);
+			kblockd_schedule_work(q, &nullb->restart_work);
+		}
+		spin_unlock_irqrestore(q->queue_lock, flags);
+		return;
+	case NULL_Q_BIO:
+		bio_endio(cmd->bio, 0);
+		free_cmd(cmd);
+		return;
+	}
+}
+
+static void null_restart_queue(struct work_struct *work)
+{
+	struct nullb *nullb = container_of(work, struct nullb, restart_work);
+
+	blk_run_queue(nullb->q);
+}
+
+static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+{
+	struct completion_queue *cq;
+	struct nullb_cmd *cmd, *next;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	cq = container_of(timer, struct completion_queue, timer);
+	local_irq_save(flags);
+	list_splice_init(&cq->list, &list);
+	local_irq_restore(flags);
+
+	list_for_each_entry_safe(cmd, next, &list, list)
+		end_cmd(cmd);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * The timer is pinned, so a command is always completed on the CPU it
+ * was queued from and the list needs no lock.
+ */
+static void null_cmd_end_timer(struct nullb_cmd *cmd)
+{
+	struct completion_queue *cq = &get_cpu_var(completion_queues);
+	unsigned long flags;
+	int was_empty;
+
+	local_irq_save(flags);
+	was_empty = list_empty(&cq->list);
+	list_add_tail(&cmd->list, &cq->list);
+	if (was_empty)
+		hrtimer_start(&cq->timer, ktime_set(0, completion_nsec),
+			      HRTIMER_MODE_REL_PINNED);
+	local_irq_restore(flags);
+	put_cpu_var(completion_queues);
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	if (queue_mode == NULL_Q_MQ)
+		end_cmd(blk_mq_rq_to_pdu(rq));
+	else
+		end_cmd(rq->special);
+}
+
+static void null_handle_cmd(struct nullb_cmd *cmd)
+{
+	switch (irqmode) {
+	case NULL_IRQ_SOFTIRQ:
+		switch (queue_mode) {
+		case NULL_Q_MQ:
+			blk_mq_complete_request(cmd->rq);
+			break;
+		case NULL_Q_RQ:
+			blk_complete_request(cmd->rq);
+			break;
+		case NULL_Q_BIO:
+			/* blk-softirq only knows about requests */
+			end_cmd(cmd);
+			break;
+		}
+		break;
+	case NULL_IRQ_NONE:
+		end_cmd(cmd);
+		break;
+	case NULL_IRQ_TIMER:
+		null_cmd_end_timer(cmd);
+		break;
+	}
+}
+
+static int null_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_cmd *cmd;
+
+	cmd = alloc_cmd(nullb_to_queue(nullb), 1);
+	cmd->bio = bio;
+	null_handle_cmd(cmd);
+	return 0;
+}
+
+static int null_rq_prep_fn(struct request_queue *q, struct request *rq)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_cmd *cmd;
+
+	cmd = alloc_cmd(nullb_to_queue(nullb), 0);
+	if (!cmd) {
+		/* restarted by end_cmd() */
+		blk_stop_queue(q);
+		return BLKPREP_DEFER;
+	}
+
+	cmd->rq = rq;
+	rq->special = cmd;
+	rq->cmd_flags |= REQ_DONTPREP;
+	return BLKPREP_OK;
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL) {
+		struct nullb_cmd *cmd = rq->special;
+
+		spin_unlock_irq(q->queue_lock);
+		null_handle_cmd(cmd);
+		spin_lock_irq(q->queue_lock);
+	}
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	cmd->rq = rq;
+	null_handle_cmd(cmd);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= null_softirq_done_fn,
+};
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static void cleanup_queues(struct nullb *nullb)
+{
+	struct nullb_queue *nq;
+	unsigned int i;
+
+	for (i = 0; i < nullb->nr_queues; i++) {
+		nq = &nullb->queues[i];
+		blk_free_tags(nq->tags);
+		kfree(nq->cmds);
+	}
+	kfree(nullb->queues);
+}
+
+static int setup_queues(struct nullb *nullb)
+{
+	struct nullb_queue *nq;
+	unsigned int i;
+
+	nullb->queues = kcalloc(hw_queues, sizeof(*nq), GFP_KERNEL);
+	if (!nullb->queues)
+		return -ENOMEM;
+
+	for (i = 0; i < hw_queues; i++) {
+		nq = &nullb->queues[i];
+		init_waitqueue_head(&nq->wait);
+		nq->tags = blk_init_tags(hw_queue_depth);
+		nq->cmds = kcalloc(hw_queue_depth, sizeof(*nq->cmds),
+				   GFP_KERNEL);
+		if (!nq->tags || !nq->cmds) {
+			if (nq->tags)
+				blk_free_tags(nq->tags);
+			kfree(nq->cmds);
+			cleanup_queues(nullb);
+			return -ENOMEM;
+		}
+		nullb->nr_queues++;
+	}
+	return 0;
+}
+
+static struct request_queue *null_init_queue(struct nullb *nullb)
+{
+	struct blk_mq_reg reg = {
+		.ops		= &null_mq_ops,
+		.nr_hw_queues	= hw_queues,
+		.queue_depth	= hw_queue_depth,
+		.cmd_size	= sizeof(struct nullb_cmd),
+		.numa_node	= -1,
+	};
+	struct request_queue *q;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		return blk_mq_init_queue(&reg, nullb);
+	case NULL_Q_RQ:
+		q = blk_init_queue(null_request_fn, &nullb->lock);
+		if (q) {
+			blk_queue_prep_rq(q, null_rq_prep_fn);
+			blk_queue_softirq_done(q, null_softirq_done_fn);
+		}
+		return q;
+	case NULL_Q_BIO:
+		q = blk_alloc_queue(GFP_KERNEL);
+		if (q)
+			blk_queue_make_request(q, null_make_request);
+		return q;
+	}
+	return NULL;
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+	INIT_WORK(&nullb->restart_work, null_restart_queue);
+
+	if (queue_mode != NULL_Q_MQ && setup_queues(nullb))
+		goto out_free;
+
+	nullb->q = null_init_queue(nullb);
+	if (!nullb->q)
+		goto out_cleanup_queues;
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_cleanup_queue;
+
+	set_capacity(disk, (sector_t)gb << 21);	/* 2^21 sectors per GB */
+
+	disk->major = null_major;
+	disk->first_minor = index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	sprintf(disk->disk_name, "nullb%d", index);
+	add_disk(disk);
+
+	list_add_tail(&nullb->list, &nullb_list);
+	return 0;
+
+out_cleanup_queue:
+	blk_cleanup_queue(nullb->q);
+out_cleanup_queues:
+	if (queue_mode != NULL_Q_MQ)
+		cleanup_queues(nullb);
+out_free:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del(&nullb->list);
+	del_gendisk(nullb->disk);
+	cancel_work_sync(&nullb->restart_work);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	if (queue_mode != NULL_Q_MQ)
+		cleanup_queues(nullb);
+	kfree(nullb);
+}
+
+static int __init null_init(void)
+{
+	struct nullb *nullb, *next;
+	int i, err;
+
+	if (bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs)) {
+		printk(KERN_WARNING "null_blk: invalid block size %d\n", bs);
+		return -EINVAL;
+	}
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ ||
+	    irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_TIMER) {
+		printk(KERN_WARNING "null_blk: invalid queue_mode %d or "
+		       "irqmode %d\n", queue_mode, irqmode);
+		return -EINVAL;
+	}
+	/* a 32-bit sector_t only goes up to 2TB */
+	if (gb <= 0 || ((sector_t)gb << 21) >> 21 != gb) {
+		printk(KERN_WARNING "null_blk: invalid size %d GB\n", gb);
+		return -EINVAL;
+	}
+	if (hw_queue_depth <= 0 || hw_queue_depth > BLK_MQ_MAX_DEPTH)
+		return -EINVAL;
+	if (nr_devices <= 0 || nr_devices > 1 << MINORBITS)
+		return -EINVAL;
+	if (hw_queues <= 0)
+		hw_queues = num_online_cpus();
+
+	if (irqmode == NULL_IRQ_TIMER) {
+		for_each_possible_cpu(i) {
+			struct completion_queue *cq;
+
+			cq = &per_cpu(completion_queues, i);
+			INIT_LIST_HEAD(&cq->list);
+			hrtimer_init(&cq->timer, CLOCK_MONOTONIC,
+				     HRTIMER_MODE_REL);
+			cq->timer.function = null_cmd_timer_expired;
+		}
+	}
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		err = null_add_dev(i);
+		if (err)
+			goto out;
+	}
+
+	printk(KERN_INFO "null_blk: %d devices, queue_mode %d, irqmode %d, "
+	       "%d queues of %d\n", nr_devices, queue_mode, irqmode,
+	       hw_queues, hw_queue_depth);
+	return 0;
+
+out:
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+	unregister_blkdev(null_major, "nullb");
+	return err;
+}
+
+static void __exit null_exit(void)
+{
+	struct nullb *nullb, *next;
+
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_DESCRIPTION("Null block device for block layer benchmarks");
+MODULE_LICENSE("GPL");
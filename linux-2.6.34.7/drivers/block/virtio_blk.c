@@ -2,6 +2,7 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -11,10 +12,20 @@
 
 static int major, index;
 
+static int use_mq;
+module_param(use_mq, bool, 0444);
+MODULE_PARM_DESC(use_mq, "Use the multi-queue request path "
+		 "(no barriers or SCSI commands)");
+
+#define VIRTBLK_MQ_DEPTH	64
+
 struct virtio_blk
 {
 	spinlock_t lock;
 
+	/* Set up with blk_mq_init_queue(). */
+	bool mq;
+
 	struct virtio_device *vdev;
 	struct virtqueue *vq;
 
@@ -65,6 +76,13 @@ static void blk_done(struct virtqueue *vq)
 			break;
 		}
 
+		if (vblk->mq) {
+			/* finished on the submitting CPU */
+			vbr->req->errors = error;
+			blk_mq_complete_request(vbr->req);
+			continue;
+		}
+
 		if (blk_pc_request(vbr->req)) {
 			vbr->req->resid_len = vbr->in_hdr.residual;
 			vbr->req->sense_len = vbr->in_hdr.sense_len;
@@ -76,20 +94,21 @@ static void blk_done(struct virtqueue *vq)
 		mempool_free(vbr, vblk->pool);
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+	if (vblk->mq)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue);
+	else
+		blk_start_queue(vblk->disk->queue);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
-static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
-		   struct request *req)
+/*
+ * Put req on the virtqueue, described by vbr. Called with vblk->lock
+ * held; false if the ring is full.
+ */
+static bool virtblk_add_req(struct request_queue *q, struct virtio_blk *vblk,
+			    struct request *req, struct virtblk_req *vbr)
 {
 	unsigned long num, out = 0, in = 0;
-	struct virtblk_req *vbr;
-
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
 
 	vbr->req = req;
 	switch (req->cmd_type) {
@@ -151,7 +170,20 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		}
 	}
 
-	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
+	return vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) >= 0;
+}
+
+static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
+		   struct request *req)
+{
+	struct virtblk_req *vbr;
+
+	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
+	if (!vbr)
+		/* When another request finishes we'll try again. */
+		return false;
+
+	if (!virtblk_add_req(q, vblk, req, vbr)) {
 		mempool_free(vbr, vblk->pool);
 		return false;
 	}
@@ -183,6 +215,39 @@ static void do_virtblk_request(struct request_queue *q)
 		vblk->vq->vq_ops->kick(vblk->vq);
 }
 
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
+{
+	struct virtio_blk *vblk = hctx->driver_data;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+	unsigned long flags;
+
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	if (!virtblk_add_req(req->q, vblk, req, vbr)) {
+		/* blk_done() restarts the queue when a request finishes */
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
+	vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static int virtblk_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			     unsigned int index)
+{
+	hctx->driver_data = data;
+	return 0;
+}
+
+static struct blk_mq_ops virtblk_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_hctx	= virtblk_init_hctx,
+};
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -196,9 +261,10 @@ static int virtblk_ioctl(struct block_device *bdev, fmode_t mode,
 	struct virtio_blk *vblk = disk->private_data;
 
 	/*
-	 * Only allow the generic SCSI ioctls if the host can support it.
+	 * Only allow the generic SCSI ioctls if the host can support it,
+	 * and the queue can carry packet commands.
 	 */
-	if (!virtio_has_feature(vblk->vdev, VIRTIO_BLK_F_SCSI))
+	if (!virtio_has_feature(vblk->vdev, VIRTIO_BLK_F_SCSI) || vblk->mq)
 		return -ENOTTY;
 
 	return scsi_cmd_ioctl(disk->queue, disk, mode, cmd,
@@ -296,7 +362,20 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_mempool;
 	}
 
-	q = vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	if (use_mq) {
+		struct blk_mq_reg reg = {
+			.ops		= &virtblk_mq_ops,
+			.nr_hw_queues	= 1,	/* one virtqueue */
+			.queue_depth	= VIRTBLK_MQ_DEPTH,
+			.cmd_size	= sizeof(struct virtblk_req),
+			.numa_node	= -1,
+		};
+
+		vblk->mq = true;
+		q = blk_mq_init_queue(&reg, vblk);
+	} else
+		q = blk_init_queue(do_virtblk_request, &vblk->lock);
+	vblk->disk->queue = q;
 	if (!q) {
 		err = -ENOMEM;
 		goto out_put_disk;
@@ -324,11 +403,14 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	vblk->disk->driverfs_dev = &vdev->dev;
 	index++;
 
-	/* If barriers are supported, tell block layer that queue is ordered */
-	if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
+	/*
+	 * If barriers are supported, tell block layer that queue is ordered.
+	 * The multi-queue path does not do barriers.
+	 */
+	if (!vblk->mq && virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
 		blk_queue_ordered(q, QUEUE_ORDERED_DRAIN_FLUSH,
 				  virtblk_prepare_flush);
-	else if (virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
+	else if (!vblk->mq && virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
 		blk_queue_ordered(q, QUEUE_ORDERED_TAG, NULL);
 
 	/* If disk is read-only in the host, the guest should obey */
@@ -65,6 +65,7 @@
 #define STRIPE_SECTORS		(STRIPE_SIZE>>9)
 #define	IO_THRESHOLD		1
 #define BYPASS_THRESHOLD	1
+#define MAX_STRIPE_WORKERS	256
 #define NR_HASH			(PAGE_SIZE / sizeof(struct hlist_head))
 #define HASH_MASK		(NR_HASH - 1)
 
@@ -192,6 +193,8 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+static void raid5_wakeup_worker(raid5_conf_t *conf);
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -208,6 +211,10 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
 				list_add_tail(&sh->lru, &conf->handle_list);
+				if (conf->worker_cnt) {
+					raid5_wakeup_worker(conf);
+					return;
+				}
 			}
 			md_wakeup_thread(conf->mddev->thread);
 		} else {
@@ -4458,6 +4465,14 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
+		if (conf->worker_cnt) {
+			/* the workers handle the stripes */
+			if (!list_empty(&conf->handle_list) ||
+			    !list_empty(&conf->hold_list))
+				raid5_wakeup_worker(conf);
+			break;
+		}
+
 		sh = __get_priority_stripe(conf);
 
 		if (!sh)
@@ -4481,6 +4496,129 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+/*
+ * Stripe workers.
+ *
+ * By default raid5d handles every stripe itself, and so uses at most one
+ * CPU for parity and the stripe state machine.  With stripe_workers set,
+ * a stripe released for handling wakes one of a pool of threads
+ * instead, spread over the NUMA nodes, and raid5d is left with recovery,
+ * bitmap updates and aligned read retries.  The workers take stripes
+ * from the same lists with __get_priority_stripe(), so each stripe is
+ * still handled by one thread at a time.
+ */
+
+/* Called with device_lock held */
+static void raid5_wakeup_worker(raid5_conf_t *conf)
+{
+	conf->worker_seq++;
+	wake_up(&conf->wait_for_work);
+}
+
+static int raid5_worker_thread(void *data)
+{
+	struct raid5_worker *worker = data;
+	raid5_conf_t *conf = worker->conf;
+	struct stripe_head *sh;
+	unsigned long seq;
+	int handled = 0;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		spin_lock_irq(&conf->device_lock);
+		seq = conf->worker_seq;
+		sh = __get_priority_stripe(conf);
+		/* there is more: let another worker at it */
+		if (sh && !list_empty(&conf->handle_list))
+			raid5_wakeup_worker(conf);
+		spin_unlock_irq(&conf->device_lock);
+
+		if (sh) {
+			handle_stripe(sh);
+			release_stripe(sh);
+			handled++;
+			cond_resched();
+			continue;
+		}
+
+		if (handled) {
+			async_tx_issue_pending_all();
+			unplug_slaves(conf->mddev);
+			handled = 0;
+		}
+
+		prepare_to_wait_exclusive(&conf->wait_for_work, &wait,
+					  TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop() && seq == conf->worker_seq)
+			schedule();
+		finish_wait(&conf->wait_for_work, &wait);
+	}
+	return 0;
+}
+
+static void raid5_stop_workers(raid5_conf_t *conf)
+{
+	struct raid5_worker *workers = conf->workers;
+	int i, cnt = conf->worker_cnt;
+
+	if (!cnt)
+		return;
+
+	/* raid5d handles the stripes again from here on */
+	spin_lock_irq(&conf->device_lock);
+	conf->worker_cnt = 0;
+	conf->workers = NULL;
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < cnt; i++)
+		kthread_stop(workers[i].task);
+	kfree(workers);
+	md_wakeup_thread(conf->mddev->thread);
+}
+
+static int raid5_start_workers(raid5_conf_t *conf, int cnt)
+{
+	struct raid5_worker *workers, *worker;
+	int i, err, node = -1;
+
+	workers = kcalloc(cnt, sizeof(*workers), GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	for (i = 0; i < cnt; i++) {
+		/* round robin over the nodes that have CPUs */
+		do {
+			node = next_online_node(node);
+			if (node == MAX_NUMNODES)
+				node = first_online_node;
+		} while (cpumask_empty(cpumask_of_node(node)));
+
+		worker = &workers[i];
+		worker->conf = conf;
+		worker->node = node;
+		worker->task = kthread_create(raid5_worker_thread, worker,
+					      "%s_raid5w%d",
+					      mdname(conf->mddev), i);
+		if (IS_ERR(worker->task)) {
+			err = PTR_ERR(worker->task);
+			while (--i >= 0)
+				kthread_stop(workers[i].task);
+			kfree(workers);
+			return err;
+		}
+		set_cpus_allowed_ptr(worker->task, cpumask_of_node(node));
+	}
+	for (i = 0; i < cnt; i++)
+		wake_up_process(workers[i].task);
+
+	spin_lock_irq(&conf->device_lock);
+	conf->workers = workers;
+	conf->worker_cnt = cnt;
+	raid5_wakeup_worker(conf);
+	spin_unlock_irq(&conf->device_lock);
+	return 0;
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -4576,10 +4714,54 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_stripe_workers(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_cnt);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_stripe_workers(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	unsigned long new;
+	int err;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > MAX_STRIPE_WORKERS)
+		return -EINVAL;
+	if (new == conf->worker_cnt)
+		return len;
+
+	raid5_stop_workers(conf);
+	if (new) {
+		err = raid5_start_workers(conf, new);
+		if (err)
+			return err;
+	}
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_stripe_workers = __ATTR(stripe_workers, S_IRUGO | S_IWUSR,
+			      raid5_show_stripe_workers,
+			      raid5_store_stripe_workers);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_stripe_workers.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4757,6 +4939,7 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	spin_lock_init(&conf->device_lock);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
+	init_waitqueue_head(&conf->wait_for_work);
 	INIT_LIST_HEAD(&conf->handle_list);
 	INIT_LIST_HEAD(&conf->hold_list);
 	INIT_LIST_HEAD(&conf->delayed_list);
@@ -5131,6 +5314,7 @@ static int stop(mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	raid5_stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	mddev->queue->backing_dev_info.congested_fn = NULL;
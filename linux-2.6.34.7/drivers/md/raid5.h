@@ -343,6 +343,13 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/* A thread that handles stripes for raid5d, see stripe_workers */
+struct raid5_worker {
+	struct task_struct		*task;
+	struct raid5_private_data	*conf;
+	int				node;
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -432,6 +439,15 @@ struct raid5_private_data {
 	 * the new thread here until we fully activate the array.
 	 */
 	struct mdk_thread_s	*thread;
+
+	/*
+	 * Stripe handling threads, if any.  worker_seq changes, under
+	 * device_lock, whenever there may be work for them.
+	 */
+	struct raid5_worker	*workers;
+	int			worker_cnt;
+	unsigned long		worker_seq;
+	wait_queue_head_t	wait_for_work;
 };
 
 typedef struct raid5_private_data raid5_conf_t;
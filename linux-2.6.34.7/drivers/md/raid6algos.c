@@ -21,6 +21,7 @@
 #ifndef __KERNEL__
 #include <sys/mman.h>
 #include <stdio.h>
+#include <string.h>
 #else
 #if !RAID6_USE_EMPTY_ZERO_PAGE
 /* In .bss so it's zeroed */
@@ -32,6 +33,12 @@ EXPORT_SYMBOL(raid6_empty_zero_page);
 struct raid6_calls raid6_call;
 EXPORT_SYMBOL_GPL(raid6_call);
 
+void (*raid6_2data_recov)(int, size_t, int, int, void **);
+EXPORT_SYMBOL_GPL(raid6_2data_recov);
+
+void (*raid6_datap_recov)(int, size_t, int, void **);
+EXPORT_SYMBOL_GPL(raid6_datap_recov);
+
 const struct raid6_calls * const raid6_algos[] = {
 	&raid6_intx1,
 	&raid6_intx2,
@@ -63,6 +70,15 @@ const struct raid6_calls * const raid6_algos[] = {
 	NULL
 };
 
+const struct raid6_recov_calls * const raid6_recov_algos[] = {
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(__arch_um__) && \
+    defined(CONFIG_AS_SSSE3)
+	&raid6_recov_ssse3,
+#endif
+	&raid6_recov_intx1,
+	NULL
+};
+
 #ifdef __KERNEL__
 #define RAID6_TIME_JIFFIES_LG2	4
 #else
@@ -71,6 +87,66 @@ const struct raid6_calls * const raid6_algos[] = {
 #define time_before(x, y) ((x) < (y))
 #endif
 
+/*
+ * Time the recovery of two data blocks out of four disks, so that the
+ * syndrome calculation it starts with does not drown out the rest.
+ * The contents of the blocks don't matter.
+ */
+static const struct raid6_recov_calls *raid6_choose_recov(char *syndromes)
+{
+	const struct raid6_recov_calls * const * algo;
+	const struct raid6_recov_calls * best;
+	char *data;
+	void *dptrs[4];
+	unsigned long perf, bestperf;
+	unsigned long j0, j1;
+
+	data = (void *) __get_free_pages(GFP_KERNEL, 1);
+	if ( !data )
+		return &raid6_recov_intx1;
+
+	memset(data, 0x5a, 2*PAGE_SIZE);
+	dptrs[0] = data;
+	dptrs[1] = data + PAGE_SIZE;
+	dptrs[2] = syndromes;
+	dptrs[3] = syndromes + PAGE_SIZE;
+
+	bestperf = 0;  best = NULL;
+
+	for ( algo = raid6_recov_algos ; *algo ; algo++ ) {
+		if ( !(*algo)->valid || (*algo)->valid() ) {
+			perf = 0;
+
+			preempt_disable();
+			j0 = jiffies;
+			while ( (j1 = jiffies) == j0 )
+				cpu_relax();
+			while (time_before(jiffies,
+					    j1 + (1<<RAID6_TIME_JIFFIES_LG2))) {
+				(*algo)->data2(4, PAGE_SIZE, 0, 1, dptrs);
+				perf++;
+			}
+			preempt_enable();
+
+			if ( !best || perf > bestperf ) {
+				best = *algo;
+				bestperf = perf;
+			}
+			/* Two blocks recovered per call */
+			printk("raid6: %-8s %5ld MB/s recovery\n",
+			       (*algo)->name,
+			       (perf*HZ*(2*PAGE_SIZE >> 10)) >>
+			       (10+RAID6_TIME_JIFFIES_LG2));
+		}
+	}
+
+	printk("raid6: using %s recovery\n", best->name);
+
+	free_pages((unsigned long)data, 1);
+
+	return best;
+}
+
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
 
@@ -78,6 +154,7 @@ int __init raid6_select_algo(void)
 {
 	const struct raid6_calls * const * algo;
 	const struct raid6_calls * best;
+	const struct raid6_recov_calls *recov;
 	char *syndromes;
 	void *dptrs[(65536/PAGE_SIZE)+2];
 	int i, disks;
@@ -135,6 +212,11 @@ int __init raid6_select_algo(void)
 		       best->name,
 		       (bestperf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
 		raid6_call = *best;
+
+		/* Recovery runs the syndrome code, so this goes second */
+		recov = raid6_choose_recov(syndromes);
+		raid6_2data_recov = recov->data2;
+		raid6_datap_recov = recov->datap;
 	} else
 		printk("raid6: Yikes!  No algorithm found!\n");
 
@@ -0,0 +1,313 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recov_ssse3.c
+ *
+ * SSSE3 implementation of RAID-6 dual failure recovery.
+ *
+ * A GF(2^8) product c*x is c*(x & 0x0f) ^ c*(x & 0xf0), so with the two
+ * 16-entry halves of raid6_vgfmul[c] in xmm registers, pshufb looks up
+ * the low and the high nibbles of 16 bytes at once.  bytes must be a
+ * multiple of 32 on x86-64 and of 16 on i386.
+ */
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(__arch_um__) && \
+    defined(CONFIG_AS_SSSE3)
+
+#include <linux/raid/pq.h>
+#include "raid6x86.h"
+
+static const u8 raid6_x0f[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+};
+
+static int raid6_have_ssse3(void)
+{
+	/* Not really boot_cpu but "all_cpus" */
+	return boot_cpu_has(X86_FEATURE_XMM2) &&
+		boot_cpu_has(X86_FEATURE_SSSE3);
+}
+
+static void raid6_2data_recov_ssse3(int disks, size_t bytes, int faila,
+				    int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	const u8 *pbmul;	/* P multiplier table for B data */
+	const u8 *qmul;		/* Q multiplier table (for both) */
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	pbmul = raid6_vgfmul[raid6_gfexi[failb-faila]];
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila] ^
+					 raid6_gfexp[failb]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_x0f[0]));
+
+#ifdef __x86_64__
+	/* Keep the tables in registers, 32 bytes per pass */
+	asm volatile("movdqa %0,%%xmm6" : : "m" (qmul[0]));
+	asm volatile("movdqa %0,%%xmm14" : : "m" (qmul[16]));
+	asm volatile("movdqa %0,%%xmm15" : : "m" (pbmul[0]));
+	asm volatile("movdqa %0,%%xmm5" : : "m" (pbmul[16]));
+
+	while (bytes) {
+		asm volatile("movdqa %0,%%xmm1" : : "m" (q[0]));
+		asm volatile("movdqa %0,%%xmm9" : : "m" (q[16]));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (p[0]));
+		asm volatile("movdqa %0,%%xmm8" : : "m" (p[16]));
+		asm volatile("pxor %0,%%xmm1" : : "m" (dq[0]));
+		asm volatile("pxor %0,%%xmm9" : : "m" (dq[16]));
+		asm volatile("pxor %0,%%xmm0" : : "m" (dp[0]));
+		asm volatile("pxor %0,%%xmm8" : : "m" (dp[16]));
+
+		/* xmm0/8 = px, xmm1/9 = q ^ dq; qx = qmul[q ^ dq] */
+		asm volatile("movdqa %xmm1,%xmm2");
+		asm volatile("movdqa %xmm9,%xmm10");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("psrlw $4,%xmm9");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm10");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pand %xmm7,%xmm9");
+		asm volatile("movdqa %xmm6,%xmm3");
+		asm volatile("movdqa %xmm6,%xmm11");
+		asm volatile("movdqa %xmm14,%xmm4");
+		asm volatile("movdqa %xmm14,%xmm12");
+		asm volatile("pshufb %xmm2,%xmm3");
+		asm volatile("pshufb %xmm10,%xmm11");
+		asm volatile("pshufb %xmm1,%xmm4");
+		asm volatile("pshufb %xmm9,%xmm12");
+		asm volatile("pxor %xmm3,%xmm4");
+		asm volatile("pxor %xmm11,%xmm12");
+
+		/* xmm4/12 = qx; db = pbmul[px] ^ qx */
+		asm volatile("movdqa %xmm0,%xmm2");
+		asm volatile("movdqa %xmm8,%xmm10");
+		asm volatile("movdqa %xmm0,%xmm1");
+		asm volatile("movdqa %xmm8,%xmm9");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("psrlw $4,%xmm9");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm10");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pand %xmm7,%xmm9");
+		asm volatile("movdqa %xmm15,%xmm3");
+		asm volatile("movdqa %xmm15,%xmm11");
+		asm volatile("movdqa %xmm5,%xmm13");
+		asm volatile("pshufb %xmm2,%xmm3");
+		asm volatile("pshufb %xmm10,%xmm11");
+		asm volatile("pshufb %xmm9,%xmm13");
+		asm volatile("movdqa %xmm5,%xmm9");
+		asm volatile("pshufb %xmm1,%xmm9");
+		asm volatile("pxor %xmm3,%xmm4");
+		asm volatile("pxor %xmm11,%xmm12");
+		asm volatile("pxor %xmm9,%xmm4");
+		asm volatile("pxor %xmm13,%xmm12");
+
+		/* xmm4/12 = db, the reconstructed B */
+		asm volatile("movdqa %%xmm4,%0" : "=m" (dq[0]));
+		asm volatile("movdqa %%xmm12,%0" : "=m" (dq[16]));
+
+		/* Reconstructed A */
+		asm volatile("pxor %xmm4,%xmm0");
+		asm volatile("pxor %xmm12,%xmm8");
+		asm volatile("movdqa %%xmm0,%0" : "=m" (dp[0]));
+		asm volatile("movdqa %%xmm8,%0" : "=m" (dp[16]));
+
+		bytes -= 32;
+		p += 32;
+		q += 32;
+		dp += 32;
+		dq += 32;
+	}
+#else
+	while (bytes) {
+		asm volatile("movdqa %0,%%xmm1" : : "m" (*q));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (*p));
+		asm volatile("pxor %0,%%xmm1" : : "m" (*dq));
+		asm volatile("pxor %0,%%xmm0" : : "m" (*dp));
+
+		/* xmm0 = px, xmm1 = q ^ dq; qx = qmul[q ^ dq] */
+		asm volatile("movdqa %xmm1,%xmm2");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("movdqa %0,%%xmm3" : : "m" (qmul[0]));
+		asm volatile("movdqa %0,%%xmm4" : : "m" (qmul[16]));
+		asm volatile("pshufb %xmm2,%xmm3");
+		asm volatile("pshufb %xmm1,%xmm4");
+		asm volatile("pxor %xmm3,%xmm4");
+
+		/* xmm4 = qx; db = pbmul[px] ^ qx */
+		asm volatile("movdqa %xmm0,%xmm2");
+		asm volatile("movdqa %xmm0,%xmm1");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("movdqa %0,%%xmm3" : : "m" (pbmul[0]));
+		asm volatile("movdqa %0,%%xmm5" : : "m" (pbmul[16]));
+		asm volatile("pshufb %xmm2,%xmm3");
+		asm volatile("pshufb %xmm1,%xmm5");
+		asm volatile("pxor %xmm3,%xmm4");
+		asm volatile("pxor %xmm5,%xmm4");
+
+		/* xmm4 = db, the reconstructed B */
+		asm volatile("movdqa %%xmm4,%0" : "=m" (*dq));
+
+		/* Reconstructed A */
+		asm volatile("pxor %xmm4,%xmm0");
+		asm volatile("movdqa %%xmm0,%0" : "=m" (*dp));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dp += 16;
+		dq += 16;
+	}
+#endif
+
+	kernel_fpu_end();
+}
+
+static void raid6_datap_recov_ssse3(int disks, size_t bytes, int faila,
+				    void **ptrs)
+{
+	u8 *p, *q, *dq;
+	const u8 *qmul;		/* Q multiplier table */
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_x0f[0]));
+	asm volatile("movdqa %0,%%xmm6" : : "m" (qmul[0]));
+	asm volatile("movdqa %0,%%xmm5" : : "m" (qmul[16]));
+
+	while (bytes) {
+#ifdef __x86_64__
+		asm volatile("movdqa %0,%%xmm1" : : "m" (q[0]));
+		asm volatile("movdqa %0,%%xmm9" : : "m" (q[16]));
+		asm volatile("pxor %0,%%xmm1" : : "m" (dq[0]));
+		asm volatile("pxor %0,%%xmm9" : : "m" (dq[16]));
+
+		/* dq = qmul[q ^ dq] */
+		asm volatile("movdqa %xmm1,%xmm2");
+		asm volatile("movdqa %xmm9,%xmm10");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("psrlw $4,%xmm9");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm10");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pand %xmm7,%xmm9");
+		asm volatile("movdqa %xmm6,%xmm3");
+		asm volatile("movdqa %xmm6,%xmm11");
+		asm volatile("movdqa %xmm5,%xmm4");
+		asm volatile("movdqa %xmm5,%xmm12");
+		asm volatile("pshufb %xmm2,%xmm3");
+		asm volatile("pshufb %xmm10,%xmm11");
+		asm volatile("pshufb %xmm1,%xmm4");
+		asm volatile("pshufb %xmm9,%xmm12");
+		asm volatile("pxor %xmm3,%xmm4");
+		asm volatile("pxor %xmm11,%xmm12");
+		asm volatile("movdqa %%xmm4,%0" : "=m" (dq[0]));
+		asm volatile("movdqa %%xmm12,%0" : "=m" (dq[16]));
+
+		/* p ^= dq */
+		asm volatile("pxor %0,%%xmm4" : : "m" (p[0]));
+		asm volatile("pxor %0,%%xmm12" : : "m" (p[16]));
+		asm volatile("movdqa %%xmm4,%0" : "=m" (p[0]));
+		asm volatile("movdqa %%xmm12,%0" : "=m" (p[16]));
+
+		bytes -= 32;
+		p += 32;
+		q += 32;
+		dq += 32;
+#else
+		asm volatile("movdqa %0,%%xmm1" : : "m" (*q));
+		asm volatile("pxor %0,%%xmm1" : : "m" (*dq));
+
+		/* dq = qmul[q ^ dq] */
+		asm volatile("movdqa %xmm1,%xmm2");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("movdqa %xmm6,%xmm3");
+		asm volatile("movdqa %xmm5,%xmm4");
+		asm volatile("pshufb %xmm2,%xmm3");
+		asm volatile("pshufb %xmm1,%xmm4");
+		asm volatile("pxor %xmm3,%xmm4");
+		asm volatile("movdqa %%xmm4,%0" : "=m" (*dq));
+
+		/* p ^= dq */
+		asm volatile("pxor %0,%%xmm4" : : "m" (*p));
+		asm volatile("movdqa %%xmm4,%0" : "=m" (*p));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dq += 16;
+#endif
+	}
+
+	kernel_fpu_end();
+}
+
+const struct raid6_recov_calls raid6_recov_ssse3 = {
+	raid6_2data_recov_ssse3,
+	raid6_datap_recov_ssse3,
+	raid6_have_ssse3,
+#ifdef __x86_64__
+	"ssse3x2",
+#else
+	"ssse3x1",
+#endif
+};
+
+#endif
@@ -43,6 +43,9 @@
 #include <linux/bit_spinlock.h>
 
 static int fsync_buffers_list(spinlock_t *lock, struct list_head *list);
+static int alloc_buffer_heads(gfp_t gfp_flags, struct buffer_head **bhs,
+			      int nr);
+static void free_buffer_heads(struct buffer_head **bhs, int nr);
 
 #define BH_ENTRY(list) list_entry((list), struct buffer_head, b_assoc_buffers)
 
@@ -894,17 +897,19 @@ int remove_inode_buffers(struct inode *inode)
 struct buffer_head *alloc_page_buffers(struct page *page, unsigned long size,
 		int retry)
 {
+	struct buffer_head *bhs[MAX_BUF_PER_PAGE];
 	struct buffer_head *bh, *head;
 	long offset;
+	int i;
 
 try_again:
+	if (!alloc_buffer_heads(GFP_NOFS, bhs, PAGE_SIZE / size))
+		goto no_grow;
+
 	head = NULL;
 	offset = PAGE_SIZE;
-	while ((offset -= size) >= 0) {
-		bh = alloc_buffer_head(GFP_NOFS);
-		if (!bh)
-			goto no_grow;
-
+	for (i = 0; (offset -= size) >= 0; i++) {
+		bh = bhs[i];
 		bh->b_bdev = NULL;
 		bh->b_this_page = head;
 		bh->b_blocknr = -1;
@@ -921,23 +926,13 @@ try_again:
 		init_buffer(bh, NULL, NULL);
 	}
 	return head;
-/*
- * In case anything failed, we just free everything we got.
- */
-no_grow:
-	if (head) {
-		do {
-			bh = head;
-			head = head->b_this_page;
-			free_buffer_head(bh);
-		} while (head);
-	}
 
+no_grow:
 	/*
 	 * Return failure for non-async IO requests.  Async IO requests
 	 * are not allowed to fail, so we have to wait until buffer heads
 	 * become available.  But we don't want tasks sleeping with 
-	 * partially complete buffers, so all were released above.
+	 * partially complete buffers, so none are held here.
 	 */
 	if (!retry)
 		return NULL;
@@ -3180,13 +3175,15 @@ int try_to_free_buffers(struct page *page)
 	spin_unlock(&mapping->private_lock);
 out:
 	if (buffers_to_free) {
+		struct buffer_head *bhs[MAX_BUF_PER_PAGE];
 		struct buffer_head *bh = buffers_to_free;
+		int nr = 0;
 
 		do {
-			struct buffer_head *next = bh->b_this_page;
-			free_buffer_head(bh);
-			bh = next;
+			bhs[nr++] = bh;
+			bh = bh->b_this_page;
 		} while (bh != buffers_to_free);
+		free_buffer_heads(bhs, nr);
 	}
 	return ret;
 }
@@ -3286,6 +3283,38 @@ void free_buffer_head(struct buffer_head *bh)
 }
 EXPORT_SYMBOL(free_buffer_head);
 
+/*
+ * Allocate nr buffer heads, as alloc_buffer_head does, with one call to
+ * the slab allocator. Returns nr, or 0 having allocated none.
+ */
+static int alloc_buffer_heads(gfp_t gfp_flags, struct buffer_head **bhs,
+			      int nr)
+{
+	int i;
+
+	if (!kmem_cache_alloc_bulk(bh_cachep, gfp_flags | __GFP_ZERO, nr,
+				   (void **)bhs))
+		return 0;
+	for (i = 0; i < nr; i++)
+		INIT_LIST_HEAD(&bhs[i]->b_assoc_buffers);
+	get_cpu_var(bh_accounting).nr += nr;
+	recalc_bh_state();
+	put_cpu_var(bh_accounting);
+	return nr;
+}
+
+static void free_buffer_heads(struct buffer_head **bhs, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		BUG_ON(!list_empty(&bhs[i]->b_assoc_buffers));
+	kmem_cache_free_bulk(bh_cachep, nr, (void **)bhs);
+	get_cpu_var(bh_accounting).nr -= nr;
+	recalc_bh_state();
+	put_cpu_var(bh_accounting);
+}
+
 static void buffer_exit_cpu(int cpu)
 {
 	int i;
@@ -3359,7 +3388,7 @@ void __init buffer_init(void)
 	bh_cachep = kmem_cache_create("buffer_head",
 			sizeof(struct buffer_head), 0,
 				(SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|
-				SLAB_MEM_SPREAD),
+				SLAB_MEM_SPREAD|SLAB_SLOT_PAGES),
 				NULL);
 
 	/*
@@ -939,6 +939,7 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 {
 	unsigned long user_addr; 
 	unsigned long flags;
+	struct blk_plug plug;
 	int seg;
 	ssize_t ret = 0;
 	ssize_t ret2;
@@ -975,6 +976,8 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 				- user_addr/PAGE_SIZE);
 	}
 
+	blk_start_plug(&plug);
+
 	for (seg = 0; seg < nr_segs; seg++) {
 		user_addr = (unsigned long)iov[seg].iov_base;
 		dio->size += bytes = iov[seg].iov_len;
@@ -1031,6 +1034,8 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 	if (dio->bio)
 		dio_bio_submit(dio);
 
+	blk_finish_plug(&plug);
+
 	/*
 	 * It is possible that, we return short IO due to end of file.
 	 * In that case, we need to release all the pages we got hold on.
@@ -1569,7 +1569,7 @@ void __init inode_init(void)
 					 sizeof(struct inode),
 					 0,
 					 (SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|
-					 SLAB_MEM_SPREAD),
+					 SLAB_MEM_SPREAD|SLAB_SLOT_PAGES),
 					 init_once);
 	register_shrinker(&icache_shrinker);
 
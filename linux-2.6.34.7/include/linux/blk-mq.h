@@ -0,0 +1,125 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+/*
+ * Multi-queue block devices.
+ *
+ * A queue set up with blk_mq_init_queue() has no elevator, no request_fn
+ * and no use for the queue_lock. Each CPU adds its requests to a software
+ * queue of its own, and each software queue feeds one of the hardware
+ * queues the driver asked for, chosen by ->map_queue. Requests are
+ * preallocated per hardware queue, one per tag, and the driver gets them
+ * one at a time through ->queue_rq. Completions run on the CPU the
+ * request was submitted from.
+ *
+ * Barriers and packet commands are not supported.
+ */
+
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;		/* protects dispatch */
+	struct list_head	dispatch;	/* bounced by the driver */
+	unsigned long		state;		/* BLK_MQ_S_* */
+	struct work_struct	run_work;
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+	int			numa_node;
+
+	/* the software queues that feed this one, and which have work */
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;
+
+	/* tag_index[tag] is the request preallocated for each tag */
+	struct blk_queue_tag	*tags;
+	wait_queue_head_t	wait;		/* for a free tag */
+
+	unsigned long		queued;
+	unsigned long		run;
+	unsigned long		dispatched;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *, int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Start a request. Called with preemption disabled, and maybe
+	 * with interrupts disabled too, so it must not sleep.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/* Map a CPU to a hardware queue, usually blk_mq_map_queue */
+	map_queue_fn		*map_queue;
+
+	/*
+	 * Finish a request completed by blk_mq_complete_request(), on the
+	 * CPU it was submitted from. Defaults to ending it with
+	 * rq->errors.
+	 */
+	softirq_done_fn		*complete;
+
+	/* Set up and tear down the driver's data for a hardware queue */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* driver data per request */
+	int			numa_node;
+};
+
+/* ->queue_rq return values */
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* started */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* no room, retry later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* fail the request */
+};
+
+/* hardware queue state bits */
+enum {
+	BLK_MQ_S_STOPPED	= 0,
+};
+
+#define BLK_MQ_MAX_DEPTH	2048
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, int);
+
+void blk_mq_insert_request(struct request *, bool);
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, bool);
+void blk_mq_run_queues(struct request_queue *, bool);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+void blk_mq_start_stopped_hw_queues(struct request_queue *);
+
+void blk_mq_complete_request(struct request *);
+void blk_mq_end_io(struct request *, int);
+
+/*
+ * The driver's per-request data, cmd_size bytes right behind the
+ * request.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return rq + 1;
+}
+
+static inline struct request *blk_mq_tag_to_rq(struct blk_mq_hw_ctx *hctx,
+					       unsigned int tag)
+{
+	return hctx->tags->tag_index[tag];
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#endif
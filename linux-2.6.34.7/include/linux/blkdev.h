@@ -28,6 +28,9 @@ struct request_queue;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 struct request;
 struct sg_io_hdr;
 
@@ -160,6 +163,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;	/* multi-queue software queue */
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -350,6 +354,14 @@ struct request_queue
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	/*
+	 * Multi-queue mode, see blk-mq.h
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx __percpu *queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
 	/*
 	 * Dispatch queue sorting
 	 */
@@ -986,6 +998,8 @@ extern int blk_queue_resize_tags(struct request_queue *, int);
 extern void blk_queue_invalidate_tags(struct request_queue *);
 extern struct blk_queue_tag *blk_init_tags(int);
 extern void blk_free_tags(struct blk_queue_tag *);
+extern int blk_tag_get(struct blk_queue_tag *, unsigned int);
+extern void blk_tag_put(struct blk_queue_tag *, int);
 
 static inline struct request *blk_map_queue_find_tag(struct blk_queue_tag *bqt,
 						int tag)
@@ -1292,6 +1306,57 @@ struct block_device_operations {
 
 extern int __blkdev_driver_ioctl(struct block_device *, fmode_t, unsigned int,
 				 unsigned long);
+
+/*
+ * A task submitting a batch of I/O can hold its requests back on a plug
+ * of its own instead of plugging the queue:
+ *
+ *	struct blk_plug plug;
+ *
+ *	blk_start_plug(&plug);
+ *	... submit_bio() ...
+ *	blk_finish_plug(&plug);
+ *
+ * Bios are merged into the plugged requests without taking the queue
+ * lock, and the requests are handed to each queue's elevator under one
+ * lock acquisition when the plug is finished, when it grows past
+ * BLK_MAX_PLUG_REQUESTS, or when the task sleeps.
+ */
+struct blk_plug {
+	unsigned long magic;
+	struct list_head list;		/* requests, oldest first */
+	unsigned int count;
+	unsigned int should_sort;	/* list spans more than one queue */
+};
+#define BLK_MAX_PLUG_REQUESTS	16
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *, bool);
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, false);
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, true);
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	return plug && !list_empty(&plug->list);
+}
+
 #else /* CONFIG_BLOCK */
 /*
  * stubs for when the block layer is configured out
@@ -1303,6 +1368,30 @@ static inline long nr_blockdev_pages(void)
 	return 0;
 }
 
+struct blk_plug {
+};
+
+static inline void blk_start_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_finish_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	return false;
+}
+
 #endif /* CONFIG_BLOCK */
 
 #endif
@@ -1004,6 +1004,7 @@ partition_sched_domains(int ndoms_new, cpumask_var_t doms_new[],
 
 
 struct io_context;			/* See blkdev.h */
+struct blk_plug;			/* See blkdev.h */
 
 
 #ifdef ARCH_HAS_PREFETCH_SWITCH_STACK
@@ -1408,6 +1409,9 @@ struct task_struct {
 /* stacked block device info */
 	struct bio_list *bio_list;
 
+/* requests held back by blk_start_plug() */
+	struct blk_plug *plug;
+
 /* VM state */
 	struct reclaim_state *reclaim_state;
 
@@ -0,0 +1,78 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM look
+
+#if !defined(_TRACE_LOOK_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOOK_H
+
+#include <linux/blkdev.h>
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(look_rq,
+
+	TP_PROTO(struct request *rq, unsigned int dir, sector_t head,
+		 unsigned int depth),
+
+	TP_ARGS(rq, dir, head, depth),
+
+	TP_STRUCT__entry(
+		__field( dev_t,		dev		)
+		__field( sector_t,	sector		)
+		__field( unsigned int,	nr_sector	)
+		__field( int,		rw		)
+		__field( unsigned int,	dir		)
+		__field( sector_t,	head		)
+		__field( unsigned int,	depth		)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= rq->rq_disk ? disk_devt(rq->rq_disk) : 0;
+		__entry->sector		= blk_rq_pos(rq);
+		__entry->nr_sector	= blk_rq_sectors(rq);
+		__entry->rw		= rq_data_dir(rq);
+		__entry->dir		= dir;
+		__entry->head		= head;
+		__entry->depth		= depth;
+	),
+
+	TP_printk("%d,%d %s %llu + %u head %llu %s depth %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->rw == WRITE ? "W" : "R",
+		  (unsigned long long)__entry->sector, __entry->nr_sector,
+		  (unsigned long long)__entry->head,
+		  __entry->dir ? "up" : "down", __entry->depth)
+);
+
+/**
+ * look_add_request - request queued in the LOOK scheduler
+ * @rq: the request
+ * @dir: direction the head is moving, 1 for up
+ * @head: current head position
+ * @depth: number of requests queued, including @rq
+ */
+DEFINE_EVENT(look_rq, look_add_request,
+
+	TP_PROTO(struct request *rq, unsigned int dir, sector_t head,
+		 unsigned int depth),
+
+	TP_ARGS(rq, dir, head, depth)
+);
+
+/**
+ * look_dispatch - request chosen for dispatch by the LOOK scheduler
+ * @rq: the request
+ * @dir: direction the head is moving after any reversal, 1 for up
+ * @head: head position before the request is serviced
+ * @depth: number of requests queued, including @rq
+ */
+DEFINE_EVENT(look_rq, look_dispatch,
+
+	TP_PROTO(struct request *rq, unsigned int dir, sector_t head,
+		 unsigned int depth),
+
+	TP_ARGS(rq, dir, head, depth)
+);
+
+#endif /* _TRACE_LOOK_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -3695,6 +3695,19 @@ pick_next_task(struct rq *rq)
 	}
 }
 
+/*
+ * A task about to sleep must not keep the requests it has plugged: they
+ * may be what it is waiting for. Submit them before blocking. Preemption
+ * leaves the task runnable, so its plug is left alone then.
+ */
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	if (blk_needs_flush_plug(tsk))
+		blk_schedule_flush_plug(tsk);
+}
+
 /*
  * schedule() is the main scheduler function.
  */
@@ -3705,6 +3718,7 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -102,6 +102,12 @@ extern int sysctl_nr_trim_pages;
 #ifdef CONFIG_BLOCK
 extern int blk_iopoll_enabled;
 #endif
+#ifdef CONFIG_SLOB
+extern int slob_fit_candidates, slob_fit_waste;
+#ifdef CONFIG_NUMA
+extern int slob_node_spill;
+#endif
+#endif
 
 /* Constants used for minimum and  maximum */
 #ifdef CONFIG_DETECT_SOFTLOCKUP
@@ -1271,6 +1277,35 @@ static struct ctl_table vm_table[] = {
 		.extra2		= &one,
 	},
 #endif
+#ifdef CONFIG_SLOB
+	{
+		.procname	= "slob_fit_candidates",
+		.data		= &slob_fit_candidates,
+		.maxlen		= sizeof(slob_fit_candidates),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "slob_fit_waste",
+		.data		= &slob_fit_waste,
+		.maxlen		= sizeof(slob_fit_waste),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
+#ifdef CONFIG_NUMA
+	{
+		.procname	= "slob_node_spill",
+		.data		= &slob_node_spill,
+		.maxlen		= sizeof(slob_node_spill),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
+#endif
 
 /*
  * NOTE: do not add new entries to this table unless you have read
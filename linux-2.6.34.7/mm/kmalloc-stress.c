@@ -0,0 +1,205 @@
+/*
+ * mm/kmalloc-stress.c
+ *
+ * Stress test for the kmalloc allocator: keeps a working set of randomly
+ * sized objects live while freeing and replacing random members of it,
+ * then reports the kmalloc and kfree latency distributions and how many
+ * pages the working set cost. A large working set of small objects
+ * (e.g. max_size=64) churns pages packed with many free fragments.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The test runs when the module is loaded and frees everything before
+ * it returns, e.g.
+ *
+ *	modprobe kmalloc-stress nr_objects=50000 nr_ops=2000000
+ *	dmesg | tail
+ *	rmmod kmalloc-stress
+ *
+ * Footprint is measured as the drop in free pages between the start of
+ * the test and the end of the churn, so it is only meaningful on an
+ * otherwise idle machine.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/math64.h>
+#include <asm/timex.h>
+
+static unsigned int nr_objects = 20000;
+module_param(nr_objects, uint, 0444);
+MODULE_PARM_DESC(nr_objects, "number of objects kept live");
+
+static unsigned long nr_ops = 1000000;
+module_param(nr_ops, ulong, 0444);
+MODULE_PARM_DESC(nr_ops, "number of free-and-replace operations");
+
+static unsigned int min_size = 8;
+module_param(min_size, uint, 0444);
+MODULE_PARM_DESC(min_size, "smallest object size in bytes");
+
+static unsigned int max_size = 1024;
+module_param(max_size, uint, 0444);
+MODULE_PARM_DESC(max_size, "largest object size in bytes");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "random seed, so runs can be repeated");
+
+/* power-of-two histogram of allocation latencies, in cycles */
+#define LAT_BUCKETS	32
+
+struct stress_obj {
+	void *p;
+	unsigned int size;
+};
+
+static u32 stress_rand(u32 *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 1;
+}
+
+/*
+ * Returns the lowest latency, in cycles, at or below which the given
+ * fraction (per thousand) of allocations completed.
+ */
+static unsigned long lat_percentile(unsigned long *hist, unsigned long nr,
+				    unsigned int per_mille)
+{
+	unsigned long want = div_u64((u64)nr * per_mille + 999, 1000), seen = 0;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= want)
+			return 1UL << i;
+	}
+	return ~0UL;
+}
+
+static void stress_report(const char *what, unsigned long *hist,
+			  unsigned long nr, u64 total)
+{
+	printk(KERN_INFO "kmalloc-stress: %s latency cycles mean %llu "
+	       "p50 <%lu p90 <%lu p99 <%lu p99.9 <%lu\n", what,
+	       div64_u64(total, nr),
+	       lat_percentile(hist, nr, 500),
+	       lat_percentile(hist, nr, 900),
+	       lat_percentile(hist, nr, 990),
+	       lat_percentile(hist, nr, 999));
+}
+
+static void stress_free(struct stress_obj *obj, unsigned long *hist,
+			u64 *total)
+{
+	cycles_t start, cycles;
+
+	start = get_cycles();
+	kfree(obj->p);
+	cycles = get_cycles() - start;
+
+	obj->p = NULL;
+	*total += cycles;
+	hist[min_t(int, fls_long(cycles), LAT_BUCKETS - 1)]++;
+}
+
+static void *stress_alloc(struct stress_obj *obj, u32 *rnd,
+			  unsigned long *hist, u64 *total)
+{
+	unsigned int size = min_size;
+	cycles_t start, cycles;
+
+	if (max_size > min_size)
+		size += stress_rand(rnd) % (max_size - min_size + 1);
+
+	start = get_cycles();
+	obj->p = kmalloc(size, GFP_KERNEL);
+	cycles = get_cycles() - start;
+
+	obj->size = size;
+	*total += cycles;
+	hist[min_t(int, fls_long(cycles), LAT_BUCKETS - 1)]++;
+	return obj->p;
+}
+
+static int __init kmalloc_stress_init(void)
+{
+	struct stress_obj *objs;
+	unsigned long *hist, *free_hist, nr_allocs = 0, i;
+	long free_before, used_pages;
+	u64 live_bytes = 0, total = 0, free_total = 0;
+	u32 rnd = seed;
+	int ret = 0;
+
+	if (!nr_objects || min_size > max_size)
+		return -EINVAL;
+
+	objs = vmalloc(nr_objects * sizeof(*objs));
+	hist = kzalloc(2 * LAT_BUCKETS * sizeof(*hist), GFP_KERNEL);
+	if (!objs || !hist) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(objs, 0, nr_objects * sizeof(*objs));
+	free_hist = hist + LAT_BUCKETS;
+
+	free_before = global_page_state(NR_FREE_PAGES);
+
+	for (i = 0; i < nr_objects; i++, nr_allocs++)
+		if (!stress_alloc(&objs[i], &rnd, hist, &total))
+			goto nomem;
+
+	for (i = 0; i < nr_ops; i++, nr_allocs++) {
+		struct stress_obj *obj = &objs[stress_rand(&rnd) % nr_objects];
+
+		stress_free(obj, free_hist, &free_total);
+		if (!stress_alloc(obj, &rnd, hist, &total))
+			goto nomem;
+		if (!(i & 1023))
+			cond_resched();
+	}
+
+	used_pages = max_t(long, free_before -
+			   (long)global_page_state(NR_FREE_PAGES), 0);
+	for (i = 0; i < nr_objects; i++)
+		live_bytes += objs[i].size;
+
+	printk(KERN_INFO "kmalloc-stress: %u objects of %u-%u bytes, "
+	       "%lu allocations\n", nr_objects, min_size, max_size, nr_allocs);
+	stress_report("kmalloc", hist, nr_allocs, total);
+	if (nr_ops)
+		stress_report("kfree", free_hist, nr_ops, free_total);
+	printk(KERN_INFO "kmalloc-stress: %llu KB live in %ld KB of pages\n",
+	       live_bytes >> 10, used_pages << (PAGE_SHIFT - 10));
+	goto out;
+
+nomem:
+	printk(KERN_ERR "kmalloc-stress: out of memory after %lu "
+	       "allocations\n", nr_allocs);
+	ret = -ENOMEM;
+out:
+	if (objs)
+		for (i = 0; i < nr_objects; i++)
+			kfree(objs[i].p);
+	vfree(objs);
+	kfree(hist);
+	return ret;
+}
+
+static void __exit kmalloc_stress_exit(void)
+{
+}
+
+module_init(kmalloc_stress_init);
+module_exit(kmalloc_stress_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("kmalloc latency and footprint stress test");
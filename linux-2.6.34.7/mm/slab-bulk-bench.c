@@ -0,0 +1,157 @@
+/*
+ * mm/slab-bulk-bench.c
+ *
+ * Benchmark for kmem_cache_alloc_bulk() and kmem_cache_free_bulk(): for
+ * batches of 1 up to max_batch objects, allocates and frees a batch from
+ * a cache of its own over and over, first with one kmem_cache_alloc()
+ * and kmem_cache_free() per object and then with a single bulk call,
+ * and reports the mean cycles per object of each.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The benchmark runs when the module is loaded, e.g.
+ *
+ *	modprobe slab-bulk-bench size=256 loops=10000
+ *	dmesg | tail
+ *	rmmod slab-bulk-bench
+ *
+ * slot_pages=1 creates the cache with SLAB_SLOT_PAGES.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
+#include <asm/timex.h>
+
+static unsigned int size = 256;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "object size in bytes");
+
+static unsigned int loops = 10000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "batches allocated and freed per batch size");
+
+static unsigned int max_batch = 256;
+module_param(max_batch, uint, 0444);
+MODULE_PARM_DESC(max_batch, "largest batch, in objects");
+
+static bool slot_pages;
+module_param(slot_pages, bool, 0444);
+MODULE_PARM_DESC(slot_pages, "create the cache with SLAB_SLOT_PAGES");
+
+struct bench_cycles {
+	u64 alloc, free;
+};
+
+/* allocate and free nr objects one at a time */
+static int bench_single(struct kmem_cache *c, void **objs, unsigned int nr,
+			struct bench_cycles *cycles)
+{
+	cycles_t start, mid;
+	unsigned int i;
+	int ret;
+
+	start = get_cycles();
+	for (i = 0; i < nr; i++) {
+		objs[i] = kmem_cache_alloc(c, GFP_KERNEL);
+		if (!objs[i])
+			break;
+	}
+	mid = get_cycles();
+	ret = i < nr ? -ENOMEM : 0;
+	nr = i;
+	for (i = 0; i < nr; i++)
+		kmem_cache_free(c, objs[i]);
+
+	cycles->alloc += mid - start;
+	cycles->free += get_cycles() - mid;
+	return ret;
+}
+
+/* allocate and free nr objects with one call each */
+static int bench_bulk(struct kmem_cache *c, void **objs, unsigned int nr,
+		      struct bench_cycles *cycles)
+{
+	cycles_t start, mid;
+
+	start = get_cycles();
+	if (!kmem_cache_alloc_bulk(c, GFP_KERNEL, nr, objs))
+		return -ENOMEM;
+	mid = get_cycles();
+	kmem_cache_free_bulk(c, nr, objs);
+
+	cycles->alloc += mid - start;
+	cycles->free += get_cycles() - mid;
+	return 0;
+}
+
+static int bench_batch(struct kmem_cache *c, void **objs, unsigned int nr)
+{
+	struct bench_cycles single = { 0, 0 }, bulk = { 0, 0 };
+	u64 objects = (u64)loops * nr;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < loops && !ret; i++) {
+		ret = bench_single(c, objs, nr, &single);
+		if (!ret)
+			ret = bench_bulk(c, objs, nr, &bulk);
+		if (!(i & 255))
+			cond_resched();
+	}
+	if (ret)
+		return ret;
+
+	printk(KERN_INFO "slab-bulk-bench: batch %4u  alloc %5llu %5llu  "
+	       "free %5llu %5llu\n", nr,
+	       div64_u64(single.alloc, objects), div64_u64(bulk.alloc, objects),
+	       div64_u64(single.free, objects), div64_u64(bulk.free, objects));
+	return 0;
+}
+
+static int __init slab_bulk_bench_init(void)
+{
+	struct kmem_cache *c;
+	unsigned int nr;
+	void **objs;
+	int ret = 0;
+
+	if (!size || !loops || !max_batch)
+		return -EINVAL;
+
+	objs = kmalloc(max_batch * sizeof(*objs), GFP_KERNEL);
+	if (!objs)
+		return -ENOMEM;
+	c = kmem_cache_create("slab_bulk_bench", size, 0,
+			      slot_pages ? SLAB_SLOT_PAGES : 0, NULL);
+	if (!c) {
+		kfree(objs);
+		return -ENOMEM;
+	}
+
+	printk(KERN_INFO "slab-bulk-bench: %u byte objects, %u loops, "
+	       "cycles per object one at a time and in bulk\n", size, loops);
+	for (nr = 1; nr <= max_batch && !ret; nr *= 2)
+		ret = bench_batch(c, objs, nr);
+	if (ret)
+		printk(KERN_ERR "slab-bulk-bench: out of memory\n");
+
+	kmem_cache_destroy(c);
+	kfree(objs);
+	return ret;
+}
+
+static void __exit slab_bulk_bench_exit(void)
+{
+}
+
+module_init(slab_bulk_bench_init);
+module_exit(slab_bulk_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("kmem_cache bulk allocation benchmark");
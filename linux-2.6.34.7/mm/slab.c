@@ -180,13 +180,15 @@
 			 SLAB_STORE_USER | \
 			 SLAB_RECLAIM_ACCOUNT | SLAB_PANIC | \
 			 SLAB_DESTROY_BY_RCU | SLAB_MEM_SPREAD | \
-			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK)
+			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK | \
+			 SLAB_SLOT_PAGES)
 #else
 # define CREATE_MASK	(SLAB_HWCACHE_ALIGN | \
 			 SLAB_CACHE_DMA | \
 			 SLAB_RECLAIM_ACCOUNT | SLAB_PANIC | \
 			 SLAB_DESTROY_BY_RCU | SLAB_MEM_SPREAD | \
-			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK)
+			 SLAB_DEBUG_OBJECTS | SLAB_NOLEAKTRACE | SLAB_NOTRACK | \
+			 SLAB_SLOT_PAGES)
 #endif
 
 /*
@@ -3134,6 +3136,79 @@ static inline void *____cache_alloc(struct kmem_cache *cachep, gfp_t flags)
 	return objp;
 }
 
+/*
+ * Take up to nr objects for kmem_cache_alloc_bulk(): first from this
+ * CPU's array cache, then from the node's shared array and slabs with
+ * its list_lock taken just once, rather than refilling the array cache
+ * a batch at a time. Returns how many it took; growing the cache is
+ * left to the caller.
+ */
+static int ____cache_alloc_bulk(struct kmem_cache *cachep, void **p, int nr)
+{
+	struct array_cache *ac = cpu_cache_get(cachep);
+	int node = numa_node_id();
+	struct kmem_list3 *l3 = cachep->nodelists[node];
+	struct array_cache *shared;
+	int i = 0;
+
+	check_irq_off();
+
+	while (i < nr && ac->avail) {
+		STATS_INC_ALLOCHIT(cachep);
+		p[i++] = ac->entry[--ac->avail];
+		kmemleak_erase(&ac->entry[ac->avail]);
+	}
+	ac->touched = 1;
+	if (i == nr || !l3)
+		return i;
+
+	spin_lock(&l3->list_lock);
+	shared = l3->shared;
+	if (shared && shared->avail) {
+		shared->touched = 1;
+		while (i < nr && shared->avail) {
+			p[i++] = shared->entry[--shared->avail];
+			kmemleak_erase(&shared->entry[shared->avail]);
+		}
+	}
+
+	while (i < nr) {
+		struct list_head *entry;
+		struct slab *slabp;
+
+		entry = l3->slabs_partial.next;
+		if (entry == &l3->slabs_partial) {
+			l3->free_touched = 1;
+			entry = l3->slabs_free.next;
+			if (entry == &l3->slabs_free)
+				break;
+		}
+
+		slabp = list_entry(entry, struct slab, list);
+		check_slabp(cachep, slabp);
+		check_spinlock_acquired(cachep);
+
+		while (slabp->inuse < cachep->num && i < nr) {
+			STATS_INC_ALLOCED(cachep);
+			STATS_INC_ACTIVE(cachep);
+			STATS_SET_HIGH(cachep);
+
+			p[i++] = slab_get_obj(cachep, slabp, node);
+			l3->free_objects--;
+		}
+		check_slabp(cachep, slabp);
+
+		/* move slabp to correct slabp list: */
+		list_del(&slabp->list);
+		if (slabp->free == BUFCTL_END)
+			list_add(&slabp->list, &l3->slabs_full);
+		else
+			list_add(&slabp->list, &l3->slabs_partial);
+	}
+	spin_unlock(&l3->list_lock);
+	return i;
+}
+
 #ifdef CONFIG_NUMA
 /*
  * Try allocating on another node if PF_SPREAD_SLAB|PF_MEMPOLICY.
@@ -3755,6 +3830,88 @@ void kmem_cache_free(struct kmem_cache *cachep, void *objp)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/**
+ * kmem_cache_alloc_bulk - Allocate several objects
+ * @cachep: The cache to allocate from.
+ * @flags: See kmalloc().
+ * @nr: The number of objects to allocate.
+ * @p: The array to store them in.
+ *
+ * Allocate @nr objects from this cache with interrupts disabled once,
+ * and the node's list_lock taken once rather than per batch of objects.
+ * Returns @nr, or 0 if not all of them could be allocated, in which case
+ * none were.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *cachep, gfp_t flags, size_t nr,
+			  void **p)
+{
+	unsigned long save_flags;
+	size_t i = 0, j;
+
+	flags &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(flags);
+
+	if (slab_should_failslab(cachep, flags))
+		return 0;
+
+	cache_alloc_debugcheck_before(cachep, flags);
+	local_irq_save(save_flags);
+	if (!(current->flags & (PF_SPREAD_SLAB | PF_MEMPOLICY)))
+		i = ____cache_alloc_bulk(cachep, p, nr);
+	for (; i < nr; i++) {
+		p[i] = __do_cache_alloc(cachep, flags);
+		if (!p[i])
+			break;
+	}
+	local_irq_restore(save_flags);
+
+	for (j = 0; j < i; j++) {
+		p[j] = cache_alloc_debugcheck_after(cachep, flags, p[j],
+						    __builtin_return_address(0));
+		kmemleak_alloc_recursive(p[j], obj_size(cachep), 1,
+					 cachep->flags, flags);
+		kmemcheck_slab_alloc(cachep, flags, p[j], obj_size(cachep));
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[j], 0, obj_size(cachep));
+		trace_kmem_cache_alloc(_RET_IP_, p[j], obj_size(cachep),
+				       cachep->buffer_size, flags);
+	}
+
+	if (unlikely(i < nr)) {
+		kmem_cache_free_bulk(cachep, i, p);
+		return 0;
+	}
+	return nr;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/**
+ * kmem_cache_free_bulk - Deallocate several objects
+ * @cachep: The cache the allocations were from.
+ * @nr: The number of objects to free.
+ * @p: The previously allocated objects.
+ *
+ * Free @nr objects which were previously allocated from this cache,
+ * with interrupts disabled once for all of them.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *cachep, size_t nr, void **p)
+{
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	for (i = 0; i < nr; i++) {
+		debug_check_no_locks_freed(p[i], obj_size(cachep));
+		if (!(cachep->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(p[i], obj_size(cachep));
+		__cache_free(cachep, p[i]);
+		trace_kmem_cache_free(_RET_IP_, p[i]);
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /**
  * kfree - free previously allocated memory
  * @objp: pointer returned by kmalloc.
@@ -1,11 +1,7 @@
 /* CS 411 Group 2
  * Matt Thomas, Matt Martinson, Ian Crawford, Sarah Clisby
- * In this program, we added a new method called find_best_fit_block,
- * this essentially does what the method's name suggests, it searches
- * for the best fit block in a given page, and saves it to a struct 
- * called best_block_slob. We also changed slob_alloc so that it 
- * would loop through the blocks in which we got rid of small, medium,
- * and large, and made them into one big list. 
+ * Best fit allocation for SLOB; the design is described under
+ * "How SLOB works" below.
  */
 
 /*
@@ -22,21 +18,46 @@
  * allocator is as little as 2 bytes, however typically most architectures
  * will require 4 bytes on 32-bit and 8 bytes on 64-bit.
  *
- * The slob heap is a set of linked list of pages from alloc_pages(),
- * and within each page, there is a singly-linked list of free blocks
- * (slob_t). The heap is grown on demand. To reduce fragmentation,
- * heap pages are segregated into three lists, with objects less than
- * 256 bytes, objects less than 1024 bytes, and all other objects.
+ * The slob heap is a set of pages from alloc_pages(), and within each
+ * page, there is a singly-linked list of free blocks (slob_t) in address
+ * order. The heap is grown on demand. The end of each heap page holds a
+ * bitmap with a bit per unit, set for free units, from which the free
+ * blocks either side of any address can be found with a few word scans
+ * instead of a walk of the free list.
  *
- * Allocation from heap involves first searching for a page with
- * sufficient free blocks (using a next-fit-like approach) followed by
- * a first-fit scan of the page. Deallocation inserts objects back
- * into the free list in address order, so this is effectively an
- * address-ordered first fit.
+ * Free blocks are also indexed by size: every free block of at least
+ * SLOB_MIN_UNITS is on one of SLOB_CLASSES lists, one per
+ * unit count for small blocks and sixteen per power of two above that,
+ * and a bitmap records which lists are non-empty. Allocation looks up the
+ * first size class that can hold the request and takes the best fit
+ * from the first class that has one, so it never walks pages that
+ * cannot satisfy it. Deallocation inserts objects back into their
+ * page's free list in address order, coalescing with free neighbours,
+ * so this is effectively a best fit over address-ordered pages.
+ *
+ * No block is allocated smaller than SLOB_MIN_UNITS, which is the size
+ * of the smallest kmalloc block on 64-bit. Free blocks smaller than that
+ * (alignment padding, the tail of a split) cannot serve any allocation,
+ * so they are left out of the index. They are still on their page's
+ * free list, and they coalesce with a neighbour when it is freed.
+ *
+ * Caches created with SLAB_SLOT_PAGES whose objects pack well into a
+ * page get pages of their own instead, cut into equal slots and kept on
+ * per-node lists of the cache's partially used pages. A free slot is
+ * always the head of its page's list of free slots, so allocating and
+ * freeing those objects takes constant time, and their churn does not
+ * fragment the heap that everything else shares. Slot pages belong to
+ * their node's heap and are protected by its lock.
+ *
+ * On SMP, each CPU keeps small magazines of recently freed objects in
+ * front of the heap, so most allocations and frees of small objects
+ * never take a heap lock. See "Per-CPU magazines" below.
  *
  * Above this is an implementation of kmalloc/kfree. Blocks returned
- * from kmalloc are prepended with a 4-byte header with the kmalloc size.
- * If kmalloc is asked for objects of PAGE_SIZE or larger, it calls
+ * from kmalloc are prepended with a 4-byte header with the kmalloc size,
+ * and rounded up to the kmalloc alignment so that they never leave free
+ * fragments at addresses the next kmalloc cannot use.
+ * If kmalloc is asked for objects too big for a heap page, it calls
  * alloc_pages() directly, allocating compound pages so the page order
  * does not have to be separately tracked, and also stores the exact
  * allocation size in page->private so that it can be used to accurately
@@ -60,11 +81,12 @@
  * instead. The common case (or when the node id isn't explicitly provided)
  * will default to the current node, as per numa_node_id().
  *
- * Node aware pages are still inserted in to the global freelist, and
- * these are scanned for by matching against the node id encoded in the
- * page flags. As a result, block allocations that can be satisfied from
- * the freelist will only be done so on pages residing on the same node,
- * in order to prevent random node placement.
+ * Each node has a heap of its own: its partially free pages, their free
+ * block index and a lock. A block allocation only searches the heap of
+ * the node it is for, and a block is freed back to the heap of the node
+ * its page is on, so nodes neither see each other's pages nor contend
+ * for a lock. When its node has no room, an allocation may spill into
+ * other nodes' heaps, see slob_node_spill.
  */
 
 #include <linux/kernel.h>
@@ -78,6 +100,12 @@
 #include <linux/list.h>
 #include <linux/kmemtrace.h>
 #include <linux/kmemleak.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/mutex.h>
+#include <linux/smp.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <asm/atomic.h>
 
 /*
@@ -99,11 +127,6 @@ struct slob_block {
 };
 typedef struct slob_block slob_t;
 
-/* Keeps track of the best-fit block */
-struct best_block_slob;
-
-
-
 /*
  * We use struct page fields to manage some slob allocation aspects,
  * however to avoid the horrible mess in include/linux/mm_types.h, we'll
@@ -114,9 +137,18 @@ struct slob_page {
 		struct {
 			unsigned long flags;	/* mandatory */
 			atomic_t _count;	/* mandatory */
-			slobidx_t units;	/* free units left in page */
-			unsigned long pad[2];
-			slob_t *free;		/* first free slob_t in page */
+			union {
+				slobidx_t units; /* free units left in page */
+				slobidx_t inuse; /* slots in use */
+			};
+			union {
+				unsigned long pad[2];
+				struct kmem_cache *cache; /* of a slot page */
+			};
+			union {
+				slob_t *free;	/* first free slob_t in page */
+				void *slot;	/* first free slot */
+			};
 			struct list_head list;	/* linked list of free pages */
 		};
 		struct page page;
@@ -127,12 +159,25 @@ static inline void struct_slob_page_wrong_size(void)
 
 /* Keeps track of the best-fit block */
 struct best_block_slob {
-	int object_size;	/* Size of thing we're allocating */
-	slobidx_t block_size;	/* Size of block */
-	slob_t *prev;		/* Previous block */
-	slob_t *cur;		/* Current block (the best one) */
-	slob_t *next;		/* Next block */
-	struct slob_page *page;		/* Page with best fit */
+	int object_size;	/* Size of thing we're allocating, in units */
+	slobidx_t block_size;	/* Size of the best block so far */
+	int waste;		/* Units it would leave over */
+	slob_t *cur;		/* The best block so far */
+};
+
+/*
+ * Indexed free blocks carry a slob_link after their size and next
+ * fields, linking them into the list for their size class. To fit in
+ * a 16-byte block on 64-bit, a link holds the blocks before and after
+ * it as __pa() / SLOB_UNIT + 1 (0 for none) in SLOB_ADDR_WORDS 16-bit
+ * words rather than as pointers. 48 bits cover 512TB of physical
+ * memory.
+ */
+#define SLOB_ADDR_WORDS	(BITS_PER_LONG > 32 ? 3 : 2)
+
+struct slob_link {
+	u16 next[SLOB_ADDR_WORDS];	/* next free block in this class */
+	u16 prev[SLOB_ADDR_WORDS];	/* previous one, 0 if first */
 };
 
 /*
@@ -142,27 +187,74 @@ static inline void free_slob_page(struct slob_page *sp)
 {
 	reset_page_mapcount(&sp->page);
 	sp->page.mapping = NULL;
+	sp->cache = NULL;
 }
 
 /*
- * All partially free slob pages go on these lists.
+ * Size classes for the free block index: one per unit count below
+ * SLOB_CLASS_EXACT, then sixteen per power of two up to a whole page,
+ * so a class never spans more than a sixteenth of its block size and
+ * few of the blocks in the first class searched are too small.
+ */
+#define SLOB_CLASS_EXACT	32
+#define SLOB_CLASSES		(SLOB_CLASS_EXACT + 16 * (PAGE_SHIFT - 5))
+
+/*
+ * The slob heap of one node. The lock protects everything in it and
+ * the free lists of its pages.
  */
-#define SLOB_BREAK1 256
-#define SLOB_BREAK2 1024
-static LIST_HEAD(free_slob_small);
-static LIST_HEAD(free_slob_medium);
-static LIST_HEAD(free_slob_large);
+struct slob_heap {
+	spinlock_t lock;
+	struct list_head free_pages;	/* partially free pages */
+	unsigned long pages;		/* pages in the heap */
+	unsigned long slot_pages;	/* slot pages of its caches */
+	slob_t *index[SLOB_CLASSES];	/* free blocks by size class */
+	DECLARE_BITMAP(index_map, SLOB_CLASSES);	/* non-empty classes */
+} ____cacheline_aligned_in_smp;
+
+static struct slob_heap slob_heaps[MAX_NUMNODES];
+
+#define SLOB_FIT_CANDIDATES	32
+#define SLOB_FIT_WASTE		8
 
 /*
- * The number of pages currently allocated.
+ * How hard find_best_fit_block looks: it looks at no more than
+ * slob_fit_candidates blocks in a size class (0 for no limit) and
+ * settles for any block that would leave at most slob_fit_waste bytes
+ * over. Set with slob_fit=<candidates>[,<waste>] or the vm.slob_fit_*
+ * sysctls.
  */
+int slob_fit_candidates = SLOB_FIT_CANDIDATES;
+int slob_fit_waste = SLOB_FIT_WASTE;
 
-static unsigned int pages_alloc = 0;
+static int __init setup_slob_fit(char *str)
+{
+	if (get_option(&str, &slob_fit_candidates) == 2)
+		get_option(&str, &slob_fit_waste);
+	return 1;
+}
 
+__setup("slob_fit=", setup_slob_fit);
 
-/* Function prototypes for system calls */
-/*unsigned int sys_get_slob_amt_claimed();
-unsigned int sys_get_slob_amt_free();*/
+/*
+ * Event counters for /proc/slobinfo, kept per CPU so that counting
+ * does not add a shared cache line to every allocation.
+ */
+enum slob_stat_item {
+	SLOB_ALLOC,		/* objects allocated */
+	SLOB_FREE,		/* objects freed */
+	SLOB_PAGE_ALLOC,	/* pages taken from the page allocator */
+	SLOB_PAGE_FREE,		/* pages given back to it */
+	SLOB_SPILL,		/* blocks allocated from another node's heap */
+	NR_SLOB_STATS
+};
+
+static DEFINE_PER_CPU(unsigned long, slob_stats[NR_SLOB_STATS]);
+
+static inline void slob_stat(enum slob_stat_item item, unsigned long nr)
+{
+	this_cpu_add(slob_stats[item], nr);
+}
 
 /*
  * is_slob_page: True for all slob pages (false for bigblock pages)
@@ -188,7 +280,15 @@ static inline struct slob_page *slob_page(const void *addr)
 }
 
 /*
- * slob_page_free: true for pages on free_slob_pages list.
+ * The heap a slob page belongs to.
+ */
+static inline struct slob_heap *slob_heap(const void *addr)
+{
+	return &slob_heaps[page_to_nid(virt_to_page(addr))];
+}
+
+/*
+ * slob_page_free: true for pages on their heap's free_pages list.
  */
 static inline int slob_page_free(struct slob_page *sp)
 {
@@ -209,9 +309,21 @@ static inline void clear_slob_page_free(struct slob_page *sp)
 
 #define SLOB_UNIT sizeof(slob_t)
 #define SLOB_UNITS(size) (((size) + SLOB_UNIT - 1)/SLOB_UNIT)
-#define UNSLOB_UNITS(size) (SLOB_UNIT*((size) - SLOB_UNIT + 1))
 #define SLOB_ALIGN L1_CACHE_BYTES
 
+/* Smallest heap block: its size and next fields, and a slob_link */
+#define SLOB_MIN_UNITS	(2 + SLOB_UNITS(sizeof(struct slob_link)))
+
+/*
+ * The free unit bitmap takes SLOB_MAP_LONGS longs at the end of each
+ * heap page, leaving SLOB_PAGE_UNITS units for blocks. Anything bigger
+ * than SLOB_MAX_SIZE goes straight to the page allocator.
+ */
+#define SLOB_MAP_LONGS	BITS_TO_LONGS(SLOB_UNITS(PAGE_SIZE))
+#define SLOB_PAGE_UNITS	(SLOB_UNITS(PAGE_SIZE) - \
+			 SLOB_MAP_LONGS * sizeof(long) / SLOB_UNIT)
+#define SLOB_MAX_SIZE	(SLOB_PAGE_UNITS * SLOB_UNIT)
+
 /*
  * struct slob_rcu is inserted at the tail of allocated slob blocks, which
  * were created with a SLAB_DESTROY_BY_RCU slab. slob_rcu is used to free
@@ -222,11 +334,6 @@ struct slob_rcu {
 	int size;
 };
 
-/*
- * slob_lock protects all slob allocator structures.
- */
-static DEFINE_SPINLOCK(slob_lock);
-
 /*
  * Encode the given size and next info into a free slob block s.
  */
@@ -275,6 +382,20 @@ static int slob_last(slob_t *s)
 	return !((unsigned long)slob_next(s) & ~PAGE_MASK);
 }
 
+/*
+ * Return the free unit bitmap of the page s is in, and the bit for s.
+ */
+static inline unsigned long *slob_map(slob_t *s)
+{
+	return (unsigned long *)(((unsigned long)s & PAGE_MASK) +
+				 SLOB_MAX_SIZE);
+}
+
+static inline int slob_offset(slob_t *s)
+{
+	return ((unsigned long)s & ~PAGE_MASK) / SLOB_UNIT;
+}
+
 static void *slob_new_pages(gfp_t gfp, int order, int node)
 {
 	void *page;
@@ -288,7 +409,7 @@ static void *slob_new_pages(gfp_t gfp, int order, int node)
 
 	if (!page)
 		return NULL;
-	pages_alloc++;
+	slob_stat(SLOB_PAGE_ALLOC, 1 << order);
 	return page_address(page);
 }
 
@@ -296,257 +417,555 @@ static void slob_free_pages(void *b, int order)
 {
 	if (current->reclaim_state)
 		current->reclaim_state->reclaimed_slab += 1 << order;
+	slob_stat(SLOB_PAGE_FREE, 1 << order);
 	free_pages((unsigned long)b, order);
 }
 
 /*
- * Finds best fit block in a given slob_page sp.
- * Checks found block against block in
- * best_block_slob structure, replacing if better.
+ * Return the size class of a free block of the given size.
  */
-static void find_best_fit_block(struct slob_page *sp, struct best_block_slob *best, size_t size, int align)
+static inline int slob_class(slobidx_t units)
 {
-	slob_t *prev, *cur, *aligned = NULL;
-        int delta = 0, units = SLOB_UNITS(size);
-	int i = 0;
+	int shift;
 
-        for (prev = NULL, cur = sp->free; ; prev = cur, cur = slob_next(cur)) {
-        slobidx_t avail = slob_units(cur);
-
-                if (align) {
-                        aligned = (slob_t *)ALIGN((unsigned long)cur, align);
-                        delta = aligned - cur;
-                }
-
-                if (avail >= units + delta) { /* room enough? */
-                        slob_t *next;
-
-                        next = slob_next(cur);
-                        if (avail == units + delta ) { /* exact fit? unlink. */
-				best->prev = prev;
-				best->cur = cur;
-				best->next = next;
-				best->object_size = units;
-				best->block_size = avail;
-				best->page = sp;
-                        }
-			else { /* fragment */
-				if ((avail - ( units + delta ) ) < (best->block_size - best->object_size)) {
-					best->prev = prev;
-                                	best->cur = cur;
-                                	best->next = next;
-                                	best->object_size = units;
-                                        best->block_size = avail;
-					best->page = sp;
-				}
-                        }
-                }
-                if ( slob_last(cur) ) {
-                        break;
-		}
-        }
+	if (units < SLOB_CLASS_EXACT)
+		return units;
+	shift = fls(units) - 5;
+	return SLOB_CLASS_EXACT + (shift - 1) * 16 + ((units >> shift) & 15);
 }
 
 /*
- * Allocate a slob block within a given slob_page sp.
- * We ended up not changing this method at all, nor
- * using it.
+ * Units of heap block that hold size bytes.
  */
+static inline int slob_block_units(size_t size)
+{
+	return max_t(int, SLOB_UNITS(size), SLOB_MIN_UNITS);
+}
 
-static void *slob_page_alloc(struct slob_page *sp, size_t size, int align)
+static inline struct slob_link *slob_link(slob_t *s)
 {
-	slob_t *prev, *cur, *aligned = NULL;
-	int delta = 0, units = SLOB_UNITS(size);
+	return (struct slob_link *)(s + 2);
+}
 
-	for (prev = NULL, cur = sp->free; ; prev = cur, cur = slob_next(cur)) {
-	slobidx_t avail = slob_units(cur);
+static slob_t *slob_link_get(const u16 *w)
+{
+	unsigned long addr = 0;
+	int i;
+
+	for (i = SLOB_ADDR_WORDS - 1; i >= 0; i--)
+		addr = addr << 16 | w[i];
+	if (!addr)
+		return NULL;
+	return __va((addr - 1) * SLOB_UNIT);
+}
 
+static void slob_link_set(u16 *w, slob_t *s)
+{
+	unsigned long addr = s ? __pa(s) / SLOB_UNIT + 1 : 0;
+	int i;
+
+	for (i = 0; i < SLOB_ADDR_WORDS; i++, addr >>= 16)
+		w[i] = addr;
+}
+
+/*
+ * Returns true if a free block of the given size is in the index.
+ */
+static inline int slob_indexed(slobidx_t units)
+{
+	return units >= SLOB_MIN_UNITS;
+}
+
+/*
+ * Add a free block to the index. Must be called with the size the
+ * block has when it is taken out again.
+ */
+static void slob_index_add(struct slob_heap *h, slob_t *s, slobidx_t units)
+{
+	struct slob_link *link = slob_link(s);
+	slob_t *head;
+	int class;
+
+	if (!slob_indexed(units))
+		return;
+
+	class = slob_class(units);
+	head = h->index[class];
+	slob_link_set(link->next, head);
+	slob_link_set(link->prev, NULL);
+	if (head)
+		slob_link_set(slob_link(head)->prev, s);
+	h->index[class] = s;
+	__set_bit(class, h->index_map);
+}
+
+static void slob_index_del(struct slob_heap *h, slob_t *s, slobidx_t units)
+{
+	struct slob_link *link = slob_link(s);
+	slob_t *prev, *next;
+	int class;
+
+	if (!slob_indexed(units))
+		return;
+
+	class = slob_class(units);
+	prev = slob_link_get(link->prev);
+	next = slob_link_get(link->next);
+	if (prev)
+		slob_link_set(slob_link(prev)->next, next);
+	else
+		h->index[class] = next;
+	if (next)
+		slob_link_set(slob_link(next)->prev, prev);
+
+	if (!h->index[class])
+		__clear_bit(class, h->index_map);
+}
+
+/*
+ * Take all free blocks of a page out of the index.
+ */
+static void slob_index_del_page(struct slob_heap *h, struct slob_page *sp)
+{
+	slob_t *cur;
+
+	for (cur = sp->free; ; cur = slob_next(cur)) {
+		slob_index_del(h, cur, slob_units(cur));
+		if (slob_last(cur))
+			break;
+	}
+}
+
+/*
+ * Finds the best fit block in one size class of the index.
+ * Checks each block against the block in the best_block_slob
+ * structure, replacing it if better. Stops at an exact fit, or
+ * once the fit is good enough by the slob_fit_* tunables.
+ */
+static void find_best_fit_block(slob_t *list, struct best_block_slob *best,
+				int align)
+{
+	slob_t *cur, *aligned;
+	int delta = 0, waste, candidates = 0;
+	int good_enough = slob_fit_waste / SLOB_UNIT;
+
+	for (cur = list; cur; cur = slob_link_get(slob_link(cur)->next)) {
 		if (align) {
 			aligned = (slob_t *)ALIGN((unsigned long)cur, align);
 			delta = aligned - cur;
 		}
-		if (avail >= units + delta) { /* room enough? */
-			slob_t *next;
-
-			if (delta) { /* need to fragment head to align? */
-				next = slob_next(cur);
-				set_slob(aligned, avail - delta, next);
-				set_slob(cur, delta, aligned);
-				prev = cur;
-				cur = aligned;
-				avail = slob_units(cur);
-			}
-
-			next = slob_next(cur);
-			if (avail == units) { /* exact fit? unlink. */
-				if (prev)
-					set_slob(prev, slob_units(prev), next);
-				else
-					sp->free = next;
-			} else { /* fragment */
-				if (prev)
-					set_slob(prev, slob_units(prev), cur + units);
-				else
-					sp->free = cur + units;
-				set_slob(cur + units, avail - units, next);
-			}
 
-			sp->units -= units;
-			if (!sp->units)
-				clear_slob_page_free(sp);
-			return cur;
+		waste = slob_units(cur) - best->object_size - delta;
+		if (waste >= 0 && waste < best->waste) {
+			best->cur = cur;
+			best->block_size = slob_units(cur);
+			best->waste = waste;
+			if (waste <= good_enough) /* includes exact fits */
+				break;
 		}
-		if (slob_last(cur))
+		if (++candidates == slob_fit_candidates)
+			break;
+	}
+}
+
+/*
+ * Return the last free block before s in its page, which is what comes
+ * before s in the address ordered free list if s is free, or NULL if
+ * there is none. Free blocks never touch, so a run of set bits in the
+ * page's bitmap is exactly one free block.
+ */
+static slob_t *slob_prev(slob_t *s)
+{
+	slob_t *base = (slob_t *)((unsigned long)s & PAGE_MASK);
+	unsigned long *map = slob_map(s), word;
+	int bit = slob_offset(s), i = bit / BITS_PER_LONG;
+
+	/* Find the last free unit before s... */
+	word = map[i] & ((1UL << (bit % BITS_PER_LONG)) - 1);
+	while (!word) {
+		if (!i)
 			return NULL;
+		word = map[--i];
+	}
+	bit = i * BITS_PER_LONG + __fls(word);
+
+	/* ...then the first unit of its run */
+	word = ~map[i] & ((2UL << (bit % BITS_PER_LONG)) - 1);
+	while (!word) {
+		if (!i)
+			return base;
+		word = ~map[--i];
 	}
-	
+	return base + i * BITS_PER_LONG + __fls(word) + 1;
 }
 
 /*
- * slob_alloc: entry point into the slob allocator.
- *
- * Changed to loop through all pages, looking for pages with enough room
- * for allocation.
+ * Allocate units from the free block cur in page sp, which must be big
+ * enough for them once aligned. Whatever is left of the block on either
+ * side stays free and goes back into the index.
  */
-static void *slob_alloc(size_t size, gfp_t gfp, int align, int node)
+static void *slob_block_alloc(struct slob_heap *h, struct slob_page *sp,
+			      slob_t *cur, int units, int align)
 {
-	struct slob_page *sp;
-	slob_t *prev;
-	slob_t *next;
-	slob_t *aligned;
-	struct list_head *slob_list;
-	slob_t *b = NULL, *cur = NULL;
-	unsigned long flags;
-	struct best_block_slob best;
-	slobidx_t avail;
+	slob_t *prev = slob_prev(cur), *next, *aligned = NULL;
+	slobidx_t avail = slob_units(cur);
 	int delta = 0;
-	
-	slob_list = &free_slob_small;
-	
-	best.block_size = PAGE_SIZE + 1;
-	best.object_size = SLOB_UNITS(size);
-	best.prev = NULL;
+
+	slob_index_del(h, cur, avail);
+
+	if (align) {
+		aligned = (slob_t *)ALIGN((unsigned long)cur, align);
+		delta = aligned - cur;
+	}
+	if (delta) { /* need to fragment head to align? */
+		next = slob_next(cur);
+		set_slob(aligned, avail - delta, next);
+		set_slob(cur, delta, aligned);
+		slob_index_add(h, cur, delta);
+		prev = cur;
+		cur = aligned;
+		avail = slob_units(cur);
+	}
+
+	next = slob_next(cur);
+	if (avail == units) { /* exact fit? unlink. */
+		if (prev)
+			set_slob(prev, slob_units(prev), next);
+		else
+			sp->free = next;
+	} else { /* fragment */
+		if (prev)
+			set_slob(prev, slob_units(prev), cur + units);
+		else
+			sp->free = cur + units;
+		set_slob(cur + units, avail - units, next);
+		slob_index_add(h, cur + units, avail - units);
+	}
+
+	bitmap_clear(slob_map(cur), slob_offset(cur), units);
+	sp->units -= units;
+	if (!sp->units)
+		clear_slob_page_free(sp);
+	return cur;
+}
+
+/*
+ * Allocate units from the best fitting block in heap h's free block
+ * index, or return NULL if nothing in it fits. Called with h->lock held.
+ */
+static slob_t *slob_index_alloc(struct slob_heap *h, int units, int align)
+{
+	struct best_block_slob best;
+	int class;
+
+	best.object_size = units;
+	best.block_size = 0;
+	best.waste = INT_MAX;
 	best.cur = NULL;
-	best.next = NULL;
-	best.page = NULL;
 
-	spin_lock_irqsave(&slob_lock, flags);
-	/* Iterate through each partially free page, try to find room */
-	list_for_each_entry(sp, slob_list, list) {
-#ifdef CONFIG_NUMA
-		/*
-		 * If there's a node specification, search for a partial
-		 * page with a matching node id in the freelist.
-		 */
-		
-		if (node != -1 && page_to_nid(&sp->page) != node)
-			continue;
+	/*
+	 * Blocks in a higher class are all bigger than those in a lower
+	 * one, so the first class with any fit has the best one.
+	 */
+	for (class = find_next_bit(h->index_map, SLOB_CLASSES,
+				   slob_class(units));
+	     class < SLOB_CLASSES;
+	     class = find_next_bit(h->index_map, SLOB_CLASSES, class + 1)) {
+		find_best_fit_block(h->index[class], &best, align);
+		if (best.cur)
+			break;
+	}
+
+	if (!best.cur)
+		return NULL;
+	return slob_block_alloc(h, slob_page(best.cur), best.cur, units, align);
+}
+
+struct kmem_cache {
+	unsigned int size, align;
+	unsigned long flags;
+	const char *name;
+	void (*ctor)(void *);
+#ifdef CONFIG_SMP
+	struct slob_magazine *mags;	/* per-CPU, NULL if not cached */
+	int mag_limit;			/* objects per magazine */
+	struct list_head list;		/* on slob_caches if mags */
 #endif
-		/* Enough room on this page? */
-		if (sp->units < SLOB_UNITS(size))
-			continue;
+	int slot_size;			/* bytes per slot, 0 if no slots */
+	struct list_head partial[0];	/* per node, with SLAB_SLOT_PAGES */
+};
 
-		/* Attempt to alloc */
-		find_best_fit_block(sp, &best, size, align);
-	}
+/*
+ * Slot pages.
+ *
+ * A SLAB_SLOT_PAGES cache gets slot pages if its objects, rounded up to
+ * their alignment, leave at most SLOB_SLOT_WASTE bytes of a page over;
+ * otherwise it allocates from the heap like any other. A free slot
+ * holds a pointer to the next free slot of its page.
+ */
+#define SLOB_SLOT_WASTE		(PAGE_SIZE / 8)
 
-	/* Best fit found */
-	if (best.cur != NULL) {
-		cur = best.cur;
-		prev = best.prev;
-		sp = best.page;
-		avail = best.block_size;
+static inline int slob_slots(struct kmem_cache *c)
+{
+	return c && c->slot_size;
+}
 
-		if(align) {
-			aligned = (slob_t *) ALIGN ((unsigned long)cur, align);
-			delta = aligned - cur;
-		}
+/*
+ * c's list of partially used slot pages in heap h.
+ */
+static inline struct list_head *slob_slot_partial(struct kmem_cache *c,
+						  struct slob_heap *h)
+{
+	return &c->partial[h - slob_heaps];
+}
 
-		if (delta) { /* need to fragment head to align? */
-			next = slob_next(cur);
-			set_slob(aligned, avail - delta, next);
-			set_slob(cur, delta, aligned);
-			prev = cur;
-			cur = aligned;
-			avail = slob_units(cur);
-		}
+/*
+ * Cut a page fresh from slob_new_pages into free slots for c.
+ */
+static void slob_slot_page_init(struct kmem_cache *c, void *b)
+{
+	struct slob_page *sp = slob_page(b);
+	void *last = b + (PAGE_SIZE / c->slot_size - 1) * c->slot_size;
+	void *s;
+
+	for (s = b; s < last; s += c->slot_size)
+		*(void **)s = s + c->slot_size;
+	*(void **)last = NULL;
+
+	sp->cache = c;
+	sp->inuse = 0;
+	sp->slot = b;
+	INIT_LIST_HEAD(&sp->list);
+}
 
-		next = slob_next(cur);
-		if (avail == SLOB_UNITS(size)) { /* exact fit? unlink. */
-			if (prev)
-				set_slob(prev, slob_units(prev), next);
-			else
-				sp->free = next;
-		} else { /* fragment */
-			if (prev)
-				set_slob(prev, slob_units(prev), cur + SLOB_UNITS(size));
-			else
-				sp->free = cur + SLOB_UNITS(size);
-			set_slob(cur + SLOB_UNITS(size), avail - SLOB_UNITS(size), next);
-		}
+/*
+ * Take the first free slot of page sp, taking the page off its partial
+ * list when that was the last. Called with its heap's lock held.
+ */
+static void *slob_slot_alloc(struct slob_page *sp)
+{
+	void *b = sp->slot;
+
+	sp->slot = *(void **)b;
+	sp->inuse++;
+	if (!sp->slot)
+		clear_slob_page_free(sp);
+	return b;
+}
+
+/*
+ * Return slot b to its page sp in heap h, as __slob_free does blocks.
+ */
+static void slob_slot_free(struct slob_heap *h, struct slob_page *sp,
+			   void *b, struct list_head *empty)
+{
+	*(void **)b = sp->slot;
+	sp->slot = b;
 
-		sp->units -= SLOB_UNITS(size);
-		if (!sp->units)
+	if (!--sp->inuse) {
+		if (slob_page_free(sp))
 			clear_slob_page_free(sp);
+		list_add(&sp->list, empty);
+		h->slot_pages--;
+		return;
+	}
+	if (!slob_page_free(sp))
+		set_slob_page_free(sp, slob_slot_partial(sp->cache, h));
+}
+
+/*
+ * Allocate up to nr blocks of units from heap h's free block index, or
+ * slots from its partial slot pages if c has them, returning how many
+ * it had room for. Called with h->lock held.
+ */
+static int __slob_heap_alloc(struct slob_heap *h, struct kmem_cache *c,
+			     int units, int align, void **p, int nr)
+{
+	struct list_head *partial;
+	slob_t *b;
+	int i = 0;
 
-		b = cur;
+	if (slob_slots(c)) {
+		partial = slob_slot_partial(c, h);
+		while (i < nr && !list_empty(partial))
+			p[i++] = slob_slot_alloc(list_first_entry(partial,
+						 struct slob_page, list));
+	} else {
+		while (i < nr && (b = slob_index_alloc(h, units, align)))
+			p[i++] = b;
 	}
+	return i;
+}
+
+static int slob_heap_alloc(struct slob_heap *h, struct kmem_cache *c,
+			   int units, int align, void **p, int nr)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&h->lock, flags);
+	i = __slob_heap_alloc(h, c, units, align, p, nr);
+	spin_unlock_irqrestore(&h->lock, flags);
+	return i;
+}
+
+#ifdef CONFIG_NUMA
+/*
+ * When an allocation's own node has no free block that fits, it gets a
+ * new page on that node, and only if the page allocator fails does it
+ * take free blocks from other nodes' heaps. With slob_node_spill set it
+ * tries the other heaps first instead, trading locality for footprint.
+ * __GFP_THISNODE allocations never spill.
+ */
+int slob_node_spill;
+
+static int slob_spill(int nid, struct kmem_cache *c, int units, int align,
+		      void **p, int nr)
+{
+	int node, i = 0;
+
+	for_each_online_node(node) {
+		if (i == nr)
+			break;
+		if (node != nid)
+			i += slob_heap_alloc(&slob_heaps[node], c, units,
+					     align, p + i, nr - i);
+	}
+	if (i)
+		slob_stat(SLOB_SPILL, i);
+	return i;
+}
+#else
+#define slob_node_spill 0
 
-	spin_unlock_irqrestore(&slob_lock, flags);
+static inline int slob_spill(int nid, struct kmem_cache *c, int units,
+			     int align, void **p, int nr)
+{
+	return 0;
+}
+#endif
 
-	if( best.cur == NULL ) {		
-	/* Not enough space: must allocate a new page */
+/*
+ * Add a page fresh from slob_new_pages to heap h as a single free
+ * block. Called with h->lock held.
+ */
+static void slob_page_add(struct slob_heap *h, slob_t *b)
+{
+	struct slob_page *sp = slob_page(b);
+
+	sp->units = SLOB_PAGE_UNITS;
+	sp->free = b;
+	INIT_LIST_HEAD(&sp->list);
+	set_slob(b, SLOB_PAGE_UNITS, b + SLOB_UNITS(PAGE_SIZE));
+	slob_index_add(h, b, SLOB_PAGE_UNITS);
+	bitmap_zero(slob_map(b), SLOB_UNITS(PAGE_SIZE));
+	bitmap_set(slob_map(b), 0, SLOB_PAGE_UNITS);
+	set_slob_page_free(sp, &h->free_pages);
+	h->pages++;
+}
+
+/*
+ * slob_alloc_bulk: entry point into the slob allocator.
+ *
+ * Allocates nr blocks of the same size into p, taking the lock of the
+ * node's heap once for as many as its free block index can provide and
+ * growing the heap a page at a time for the rest. Objects of a cache
+ * with slot pages come from those instead, c being the cache the blocks
+ * are for or NULL for kmalloc. Returns the number allocated, which is
+ * less than nr only if the page allocator failed and no other node had
+ * room.
+ */
+static int slob_alloc_bulk(struct kmem_cache *c, size_t size, gfp_t gfp,
+			   int align, int node, void **p, int nr)
+{
+	int units = slob_block_units(size), i;
+	int nid = node == -1 ? numa_node_id() : node;
+	int spill = !(gfp & __GFP_THISNODE);
+	struct slob_heap *h;
+	unsigned long flags;
+	slob_t *b;
+
+	i = slob_heap_alloc(&slob_heaps[nid], c, units, align, p, nr);
+	if (i < nr && spill && slob_node_spill)
+		i += slob_spill(nid, c, units, align, p + i, nr - i);
+
+	while (i < nr) {
+		/* Not enough space: must allocate a new page */
 		b = slob_new_pages(gfp & ~__GFP_ZERO, 0, node);
-		if (!b)
-			return NULL;
-		sp = slob_page(b);
-		set_slob_page(sp);
+		if (!b) {
+			if (spill && !slob_node_spill)
+				i += slob_spill(nid, c, units, align,
+						p + i, nr - i);
+			break;
+		}
+		set_slob_page(slob_page(b));
+		if (slob_slots(c))
+			slob_slot_page_init(c, b);
+
+		/* The page allocator may have fallen back to another node */
+		h = slob_heap(b);
+		spin_lock_irqsave(&h->lock, flags);
+		if (slob_slots(c)) {
+			set_slob_page_free(slob_page(b),
+					   slob_slot_partial(c, h));
+			h->slot_pages++;
+		} else {
+			slob_page_add(h, b);
+		}
+		i += __slob_heap_alloc(h, c, units, align, p + i, nr - i);
+		spin_unlock_irqrestore(&h->lock, flags);
+	}
 
-		spin_lock_irqsave(&slob_lock, flags);
-		sp->units = SLOB_UNITS(PAGE_SIZE);
-		sp->free = b;
-		INIT_LIST_HEAD(&sp->list);
-		set_slob(b, SLOB_UNITS(PAGE_SIZE), b + SLOB_UNITS(PAGE_SIZE));
-		set_slob_page_free(sp, slob_list);
-		b = slob_page_alloc(sp, size, align);
-		BUG_ON(!b);
-		spin_unlock_irqrestore(&slob_lock, flags);
+	if (unlikely(gfp & __GFP_ZERO)) {
+		int j;
+
+		for (j = 0; j < i; j++)
+			memset(p[j], 0, size);
 	}
+	return i;
+}
 
-	if (unlikely((gfp & __GFP_ZERO) && b))
-		memset(b, 0, size);
+static void *slob_alloc(struct kmem_cache *c, size_t size, gfp_t gfp,
+			int align, int node)
+{
+	void *b;
+
+	if (!slob_alloc_bulk(c, size, gfp, align, node, &b, 1))
+		return NULL;
 	return b;
 }
 
 /*
- * slob_free: entry point into the slob allocator.
+ * Return a block to heap h, which must be the heap of its page. Called
+ * with h->lock held. If that leaves its page entirely free, the page is
+ * taken off the heap and put on the empty list, for the caller to hand
+ * to slob_release_pages once it has dropped the lock. Blocks on slot
+ * pages go back to their slot.
  */
-static void slob_free(void *block, int size)
+static void __slob_free(struct slob_heap *h, void *block, int size,
+			struct list_head *empty)
 {
 	struct slob_page *sp;
 	slob_t *prev, *next, *b = (slob_t *)block;
 	slobidx_t units;
-	unsigned long flags;
 
-	if (unlikely(ZERO_OR_NULL_PTR(block)))
-		return;
 	BUG_ON(!size);
 
 	sp = slob_page(block);
-	units = SLOB_UNITS(size);
-
-	spin_lock_irqsave(&slob_lock, flags);
+	if (sp->cache) {
+		slob_slot_free(h, sp, block, empty);
+		return;
+	}
+	units = slob_block_units(size);
 
-	if (sp->units + units == SLOB_UNITS(PAGE_SIZE)) {
+	if (sp->units + units == SLOB_PAGE_UNITS) {
 		/* Go directly to page allocator. Do not pass slob allocator */
-		if (slob_page_free(sp))
+		if (slob_page_free(sp)) {
+			slob_index_del_page(h, sp);
 			clear_slob_page_free(sp);
-		spin_unlock_irqrestore(&slob_lock, flags);
-		clear_slob_page(sp);
-		/* Decrement number of pages allocated. */
-		pages_alloc--;
-		free_slob_page(sp);
-		slob_free_pages(b, 0);
+		}
+		list_add(&sp->list, empty);
+		h->pages--;
 		return;
 	}
 
@@ -557,47 +976,79 @@ static void slob_free(void *block, int size)
 		set_slob(b, units,
 			(void *)((unsigned long)(b +
 					SLOB_UNITS(PAGE_SIZE)) & PAGE_MASK));
-		set_slob_page_free(sp, &free_slob_small);
-		goto out;
+		slob_index_add(h, b, units);
+		bitmap_set(slob_map(b), slob_offset(b), units);
+		set_slob_page_free(sp, &h->free_pages);
+		return;
 	}
 
 	/*
-	 * Otherwise the page is already partially free, so find reinsertion
-	 * point.
+	 * Otherwise the page is already partially free. The bitmap gives
+	 * the free block before b, if any, and its list link the one after.
+	 * Free neighbours we coalesce with leave the index and the combined
+	 * block goes back in at its new size.
 	 */
+	prev = slob_prev(b);
+	next = prev ? slob_next(prev) : sp->free;
 	sp->units += units;
+	bitmap_set(slob_map(b), slob_offset(b), units);
 
-	if (b < sp->free) {
-		if (b + units == sp->free) {
-			units += slob_units(sp->free);
-			sp->free = slob_next(sp->free);
-		}
-		set_slob(b, units, sp->free);
-		sp->free = b;
+	/* The list ends beyond the bitmap, so this is never true at its end */
+	if (b + units == next) {
+		slob_index_del(h, next, slob_units(next));
+		units += slob_units(next);
+		next = slob_next(next);
+	}
+
+	if (prev && prev + slob_units(prev) == b) {
+		slob_index_del(h, prev, slob_units(prev));
+		units += slob_units(prev);
+		set_slob(prev, units, next);
+		slob_index_add(h, prev, units);
 	} else {
-		prev = sp->free;
-		next = slob_next(prev);
-		while (b > next) {
-			prev = next;
-			next = slob_next(prev);
-		}
+		set_slob(b, units, next);
+		slob_index_add(h, b, units);
+		if (prev)
+			set_slob(prev, slob_units(prev), b);
+		else
+			sp->free = b;
+	}
+}
 
-		if (!slob_last(prev) && b + units == next) {
-			units += slob_units(next);
-			set_slob(b, units, slob_next(next));
-		} else
-			set_slob(b, units, next);
+/*
+ * Give the pages __slob_free took off the heap back to the page
+ * allocator.
+ */
+static void slob_release_pages(struct list_head *empty)
+{
+	struct slob_page *sp, *tmp;
 
-		if (prev + slob_units(prev) == b) {
-			units = slob_units(b) + slob_units(prev);
-			set_slob(prev, units, slob_next(b));
-		} else
-			set_slob(prev, slob_units(prev), b);
+	list_for_each_entry_safe(sp, tmp, empty, list) {
+		list_del(&sp->list);
+		clear_slob_page(sp);
+		free_slob_page(sp);
+		slob_free_pages(page_address(&sp->page), 0);
 	}
-out:
-	spin_unlock_irqrestore(&slob_lock, flags);
+}
 
-	
+/*
+ * slob_free: entry point into the slob allocator.
+ */
+static void slob_free(void *block, int size)
+{
+	struct slob_heap *h;
+	LIST_HEAD(empty);
+	unsigned long flags;
+
+	if (unlikely(ZERO_OR_NULL_PTR(block)))
+		return;
+
+	h = slob_heap(block);
+	spin_lock_irqsave(&h->lock, flags);
+	__slob_free(h, block, size, &empty);
+	spin_unlock_irqrestore(&h->lock, flags);
+
+	slob_release_pages(&empty);
 }
 
 /*
@@ -612,6 +1063,330 @@ out:
 #define ARCH_SLAB_MINALIGN __alignof__(unsigned long)
 #endif
 
+/*
+ * Size of the heap block behind a kmalloc object of the given size,
+ * which must be at most SLOB_MAX_SIZE - align so that this cannot wrap.
+ */
+static inline size_t slob_kmalloc_block(size_t size, int align)
+{
+	return ALIGN(size + align, align);
+}
+
+/*
+ * Free a batch of blocks of the given size, or of kmalloc blocks with
+ * the size in their header if size is 0, in one pass that only changes
+ * heap locks when the blocks change node.
+ */
+static void slob_free_bulk(void **p, int nr, int size)
+{
+	int align = max(ARCH_KMALLOC_MINALIGN, ARCH_SLAB_MINALIGN);
+	struct slob_heap *h = NULL, *next;
+	LIST_HEAD(empty);
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		next = slob_heap(p[i]);
+		if (next != h) {
+			if (h)
+				spin_unlock_irqrestore(&h->lock, flags);
+			h = next;
+			spin_lock_irqsave(&h->lock, flags);
+		}
+		__slob_free(h, p[i], size ? size :
+			    slob_kmalloc_block(*(unsigned int *)p[i], align),
+			    &empty);
+	}
+	if (h)
+		spin_unlock_irqrestore(&h->lock, flags);
+
+	slob_release_pages(&empty);
+}
+
+#ifdef CONFIG_SMP
+/*
+ * Per-CPU magazines.
+ *
+ * A magazine is a small stack of recently freed objects of one size.
+ * Each CPU has one per kmem_cache and one per kmalloc size class up to
+ * SLOB_MAG_MAX bytes, and allocations of that size on that CPU take
+ * from it without touching a heap lock. Only refilling an empty magazine
+ * and draining a full one take the lock, for half a magazine at a time.
+ *
+ * Objects in magazines are lost to the rest of the heap, so to keep
+ * SLOB's footprint a magazine holds at most SLOB_MAG_SIZE objects and
+ * SLOB_MAG_BYTES bytes, caches whose objects would not fit two to a
+ * magazine have none, and a CPU's magazines are drained when it goes
+ * offline.
+ *
+ * kmalloc blocks are classed by their size, header included, in steps
+ * of SLOB_MAG_STEP bytes. A block freed into a class is at least as big
+ * as the class and keeps its original header, so it can serve any
+ * request that rounds up to the class, and ksize() still reports what
+ * it can really hold. Blocks allocated to refill a class are made
+ * exactly the class size.
+ */
+#define SLOB_MAG_SIZE		8
+#define SLOB_MAG_BYTES		1024
+#define SLOB_MAG_STEP		16
+#define SLOB_MAG_CLASSES	16
+#define SLOB_MAG_MAX		(SLOB_MAG_STEP * SLOB_MAG_CLASSES)
+
+struct slob_magazine {
+	unsigned int nr;		/* objects in objs */
+	void *objs[SLOB_MAG_SIZE];
+};
+
+static DEFINE_PER_CPU(struct slob_magazine,
+		      slob_kmalloc_mags[SLOB_MAG_CLASSES]);
+#endif
+
+#ifdef CONFIG_SMP
+/*
+ * Caches with magazines, so they can be drained when a CPU goes away.
+ */
+static LIST_HEAD(slob_caches);
+static DEFINE_MUTEX(slob_cache_mutex);
+
+/*
+ * How many objects of the given size a magazine may hold, 0 if too few
+ * to be worth it.
+ */
+static inline int slob_mag_limit(size_t size)
+{
+	int bytes = SLOB_UNITS(size) * SLOB_UNIT;
+	int limit;
+
+	if (!bytes)
+		return 0;
+	limit = min(SLOB_MAG_SIZE, SLOB_MAG_BYTES / bytes);
+	return limit >= 2 ? limit : 0;
+}
+
+/*
+ * Take a block from this CPU's magazine in mags, refilling the magazine
+ * from the heap, or from cache c's slot pages, if it is empty. Blocks
+ * are size bytes and the first header bytes are a kmalloc header, which
+ * is set on refill and left alone by __GFP_ZERO.
+ */
+static void *slob_mag_alloc(struct kmem_cache *c, struct slob_magazine *mags,
+			    int limit, size_t size, gfp_t gfp, int align,
+			    int header)
+{
+	struct slob_magazine *mag;
+	void *objs[SLOB_MAG_SIZE];
+	unsigned long flags;
+	int i, nr;
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(mags);
+	if (likely(mag->nr)) {
+		objs[0] = mag->objs[--mag->nr];
+		local_irq_restore(flags);
+		goto out;
+	}
+	local_irq_restore(flags);
+
+	nr = slob_alloc_bulk(c, size, gfp & ~__GFP_ZERO, align, -1, objs,
+			     (limit + 1) / 2);
+	if (!nr)
+		return NULL;
+	if (header)
+		for (i = 0; i < nr; i++)
+			*(unsigned int *)objs[i] = size - header;
+
+	/* Keep the first for the caller; we may have moved CPU meanwhile */
+	local_irq_save(flags);
+	mag = this_cpu_ptr(mags);
+	while (nr > 1 && mag->nr < limit)
+		mag->objs[mag->nr++] = objs[--nr];
+	local_irq_restore(flags);
+	if (nr > 1)
+		slob_free_bulk(objs + 1, nr - 1, size);
+out:
+	if (unlikely(gfp & __GFP_ZERO))
+		memset(objs[0] + header, 0, size - header);
+	return objs[0];
+}
+
+/*
+ * Put a block into this CPU's magazine in mags, first draining the
+ * older half of the magazine to the heap if it is full. size is as for
+ * slob_free_bulk.
+ */
+static void slob_mag_free(struct slob_magazine *mags, int limit, void *b,
+			  int size)
+{
+	struct slob_magazine *mag;
+	void *objs[SLOB_MAG_SIZE];
+	unsigned long flags;
+	int nr = 0;
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(mags);
+	if (unlikely(mag->nr >= limit)) {
+		nr = limit / 2;
+		memcpy(objs, mag->objs, nr * sizeof(void *));
+		mag->nr -= nr;
+		memmove(mag->objs, mag->objs + nr, mag->nr * sizeof(void *));
+	}
+	mag->objs[mag->nr++] = b;
+	local_irq_restore(flags);
+
+	if (nr)
+		slob_free_bulk(objs, nr, size);
+}
+
+/*
+ * Empty a magazine that nobody else can be using into the heap.
+ */
+static void slob_mag_drain(struct slob_magazine *mag, int size)
+{
+	slob_free_bulk(mag->objs, mag->nr, size);
+	mag->nr = 0;
+}
+
+static unsigned int *slob_kmalloc_mag_alloc(size_t size, gfp_t gfp,
+					    int align, int node)
+{
+	int class = DIV_ROUND_UP(slob_kmalloc_block(size, align),
+				 SLOB_MAG_STEP) - 1;
+	int bytes = (class + 1) * SLOB_MAG_STEP;
+
+	if (node != -1 || class >= SLOB_MAG_CLASSES)
+		return NULL;
+	return slob_mag_alloc(NULL, &slob_kmalloc_mags[class],
+			      slob_mag_limit(bytes), bytes, gfp, align, align);
+}
+
+/*
+ * Returns true if the kmalloc block m went into a magazine.
+ */
+static int slob_kmalloc_mag_free(unsigned int *m, int align)
+{
+	int class = slob_kmalloc_block(*m, align) / SLOB_MAG_STEP - 1;
+
+	if (class < 0 || class >= SLOB_MAG_CLASSES)
+		return 0;
+	slob_mag_free(&slob_kmalloc_mags[class],
+		      slob_mag_limit((class + 1) * SLOB_MAG_STEP), m, 0);
+	return 1;
+}
+
+static void slob_cache_mag_init(struct kmem_cache *c)
+{
+	c->mags = NULL;
+	c->mag_limit = slob_mag_limit(c->size);
+	if (!c->mag_limit || (c->flags & SLAB_DESTROY_BY_RCU))
+		return;
+
+	c->mags = alloc_percpu(struct slob_magazine);
+	if (c->mags) {
+		mutex_lock(&slob_cache_mutex);
+		list_add(&c->list, &slob_caches);
+		mutex_unlock(&slob_cache_mutex);
+	}
+}
+
+static void slob_cache_mag_destroy(struct kmem_cache *c)
+{
+	int cpu;
+
+	if (!c->mags)
+		return;
+
+	mutex_lock(&slob_cache_mutex);
+	list_del(&c->list);
+	mutex_unlock(&slob_cache_mutex);
+
+	for_each_possible_cpu(cpu)
+		slob_mag_drain(per_cpu_ptr(c->mags, cpu), c->size);
+	free_percpu(c->mags);
+}
+
+static inline void *slob_cache_mag_alloc(struct kmem_cache *c, gfp_t gfp,
+					 int node)
+{
+	if (!c->mags || node != -1)
+		return NULL;
+	return slob_mag_alloc(c, c->mags, c->mag_limit, c->size, gfp,
+			      c->align, 0);
+}
+
+/*
+ * Returns true if b went into one of c's magazines.
+ */
+static inline int slob_cache_mag_free(struct kmem_cache *c, void *b)
+{
+	if (!c->mags)
+		return 0;
+	slob_mag_free(c->mags, c->mag_limit, b, c->size);
+	return 1;
+}
+
+static void slob_cache_mag_flush(void *arg)
+{
+	struct kmem_cache *c = arg;
+
+	slob_mag_drain(this_cpu_ptr(c->mags), c->size);
+}
+
+static void slob_cache_mag_shrink(struct kmem_cache *c)
+{
+	if (c->mags)
+		on_each_cpu(slob_cache_mag_flush, c, 1);
+}
+
+static int __cpuinit slob_cpu_callback(struct notifier_block *nfb,
+				       unsigned long action, void *hcpu)
+{
+	int cpu = (long)hcpu;
+	struct kmem_cache *c;
+	int i;
+
+	switch (action) {
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		for (i = 0; i < SLOB_MAG_CLASSES; i++)
+			slob_mag_drain(&per_cpu(slob_kmalloc_mags, cpu)[i], 0);
+
+		mutex_lock(&slob_cache_mutex);
+		list_for_each_entry(c, &slob_caches, list)
+			slob_mag_drain(per_cpu_ptr(c->mags, cpu), c->size);
+		mutex_unlock(&slob_cache_mutex);
+		break;
+	}
+	return NOTIFY_OK;
+}
+#else
+static inline unsigned int *slob_kmalloc_mag_alloc(size_t size, gfp_t gfp,
+						   int align, int node)
+{
+	return NULL;
+}
+
+static inline int slob_kmalloc_mag_free(unsigned int *m, int align)
+{
+	return 0;
+}
+
+static inline void slob_cache_mag_init(struct kmem_cache *c) {}
+static inline void slob_cache_mag_destroy(struct kmem_cache *c) {}
+
+static inline void *slob_cache_mag_alloc(struct kmem_cache *c, gfp_t gfp,
+					 int node)
+{
+	return NULL;
+}
+
+static inline int slob_cache_mag_free(struct kmem_cache *c, void *b)
+{
+	return 0;
+}
+
+static inline void slob_cache_mag_shrink(struct kmem_cache *c) {}
+#endif /* CONFIG_SMP */
+
 void *__kmalloc_node(size_t size, gfp_t gfp, int node)
 {
 	unsigned int *m;
@@ -620,19 +1395,23 @@ void *__kmalloc_node(size_t size, gfp_t gfp, int node)
 
 	lockdep_trace_alloc(gfp);
 
-	if (size < PAGE_SIZE - align) {
+	if (size <= SLOB_MAX_SIZE - align &&
+	    slob_kmalloc_block(size, align) <= SLOB_MAX_SIZE) {
 		if (!size)
 			return ZERO_SIZE_PTR;
 
-		m = slob_alloc(size + align, gfp, align, node);
-
-		if (!m)
-			return NULL;
-		*m = size;
+		m = slob_kmalloc_mag_alloc(size, gfp, align, node);
+		if (!m) {
+			m = slob_alloc(NULL, slob_kmalloc_block(size, align),
+				       gfp, align, node);
+			if (!m)
+				return NULL;
+			*m = size;
+		}
 		ret = (void *)m + align;
 
-		trace_kmalloc_node(_RET_IP_, ret,
-				   size, size + align, gfp, node);
+		trace_kmalloc_node(_RET_IP_, ret, size,
+				   slob_kmalloc_block(size, align), gfp, node);
 	} else {
 		unsigned int order = get_order(size);
 
@@ -647,6 +1426,8 @@ void *__kmalloc_node(size_t size, gfp_t gfp, int node)
 				   size, PAGE_SIZE << order, gfp, node);
 	}
 
+	if (ret)
+		slob_stat(SLOB_ALLOC, 1);
 	kmemleak_alloc(ret, size, 1, gfp);
 	return ret;
 }
@@ -661,14 +1442,18 @@ void kfree(const void *block)
 	if (unlikely(ZERO_OR_NULL_PTR(block)))
 		return;
 	kmemleak_free(block);
+	slob_stat(SLOB_FREE, 1);
 
 	sp = slob_page(block);
 	if (is_slob_page(sp)) {
 		int align = max(ARCH_KMALLOC_MINALIGN, ARCH_SLAB_MINALIGN);
 		unsigned int *m = (unsigned int *)(block - align);
-		slob_free(m, *m + align);
-	} else
+		if (!slob_kmalloc_mag_free(m, align))
+			slob_free(m, slob_kmalloc_block(*m, align));
+	} else {
+		slob_stat(SLOB_PAGE_FREE, 1 << compound_order(&sp->page));
 		put_page(&sp->page);
+	}
 }
 EXPORT_SYMBOL(kfree);
 
@@ -685,26 +1470,45 @@ size_t ksize(const void *block)
 	if (is_slob_page(sp)) {
 		int align = max(ARCH_KMALLOC_MINALIGN, ARCH_SLAB_MINALIGN);
 		unsigned int *m = (unsigned int *)(block - align);
-		return SLOB_UNITS(*m) * SLOB_UNIT;
+		return slob_kmalloc_block(*m, align) - align;
 	} else
 		return sp->page.private;
 }
 EXPORT_SYMBOL(ksize);
 
-struct kmem_cache {
-	unsigned int size, align;
-	unsigned long flags;
-	const char *name;
-	void (*ctor)(void *);
-};
+/*
+ * Size of the struct kmem_cache of a cache created with these flags.
+ */
+static inline size_t slob_cache_bytes(unsigned long flags)
+{
+	size_t bytes = sizeof(struct kmem_cache);
+
+	if (flags & SLAB_SLOT_PAGES)
+		bytes += nr_node_ids * sizeof(struct list_head);
+	return bytes;
+}
+
+static void slob_cache_slot_init(struct kmem_cache *c)
+{
+	int size = ALIGN(max_t(size_t, c->size, sizeof(void *)), c->align);
+	int node;
+
+	c->slot_size = 0;
+	if (!(c->flags & SLAB_SLOT_PAGES) || size > SLOB_MAX_SIZE ||
+	    PAGE_SIZE % size > SLOB_SLOT_WASTE)
+		return;
+
+	for (node = 0; node < nr_node_ids; node++)
+		INIT_LIST_HEAD(&c->partial[node]);
+	c->slot_size = size;
+}
 
 struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 	size_t align, unsigned long flags, void (*ctor)(void *))
 {
-	struct kmem_cache *c;/* Decrement number of pages allocated. */
-	//pages_alloc--; //CHINGAS
+	struct kmem_cache *c;
 
-	c = slob_alloc(sizeof(struct kmem_cache),
+	c = slob_alloc(NULL, slob_cache_bytes(flags),
 		GFP_KERNEL, ARCH_KMALLOC_MINALIGN, -1);
 
 	if (c) {
@@ -722,10 +1526,12 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 			c->align = ARCH_SLAB_MINALIGN;
 		if (c->align < align)
 			c->align = align;
+		slob_cache_slot_init(c);
+		slob_cache_mag_init(c);
 	} else if (flags & SLAB_PANIC)
 		panic("Cannot create slab cache %s\n", name);
 
-	kmemleak_alloc(c, sizeof(struct kmem_cache), 1, GFP_KERNEL);
+	kmemleak_alloc(c, slob_cache_bytes(flags), 1, GFP_KERNEL);
 	return c;
 }
 EXPORT_SYMBOL(kmem_cache_create);
@@ -735,7 +1541,8 @@ void kmem_cache_destroy(struct kmem_cache *c)
 	kmemleak_free(c);
 	if (c->flags & SLAB_DESTROY_BY_RCU)
 		rcu_barrier();
-	slob_free(c, sizeof(struct kmem_cache));
+	slob_cache_mag_destroy(c);
+	slob_free(c, slob_cache_bytes(c->flags));
 }
 EXPORT_SYMBOL(kmem_cache_destroy);
 
@@ -743,10 +1550,14 @@ void *kmem_cache_alloc_node(struct kmem_cache *c, gfp_t flags, int node)
 {
 	void *b;
 
-	if (c->size < PAGE_SIZE) {
-		b = slob_alloc(c->size, flags, c->align, node);
+	if (c->size <= SLOB_MAX_SIZE) {
+		b = slob_cache_mag_alloc(c, flags, node);
+		if (!b)
+			b = slob_alloc(c, c->size, flags, c->align, node);
 		trace_kmem_cache_alloc_node(_RET_IP_, b, c->size,
-					    SLOB_UNITS(c->size) * SLOB_UNIT,
+					    c->slot_size ? c->slot_size :
+					    slob_block_units(c->size) *
+					    SLOB_UNIT,
 					    flags, node);
 	} else {
 		b = slob_new_pages(flags, get_order(c->size), node);
@@ -755,6 +1566,8 @@ void *kmem_cache_alloc_node(struct kmem_cache *c, gfp_t flags, int node)
 					    flags, node);
 	}
 
+	if (b)
+		slob_stat(SLOB_ALLOC, 1);
 	if (c->ctor)
 		c->ctor(b);
 
@@ -765,7 +1578,7 @@ EXPORT_SYMBOL(kmem_cache_alloc_node);
 
 static void __kmem_cache_free(void *b, int size)
 {
-	if (size < PAGE_SIZE)
+	if (size <= SLOB_MAX_SIZE)
 		slob_free(b, size);
 	else
 		slob_free_pages(b, get_order(size));
@@ -782,13 +1595,14 @@ static void kmem_rcu_free(struct rcu_head *head)
 void kmem_cache_free(struct kmem_cache *c, void *b)
 {
 	kmemleak_free_recursive(b, c->flags);
+	slob_stat(SLOB_FREE, 1);
 	if (unlikely(c->flags & SLAB_DESTROY_BY_RCU)) {
 		struct slob_rcu *slob_rcu;
 		slob_rcu = b + (c->size - sizeof(struct slob_rcu));
 		INIT_RCU_HEAD(&slob_rcu->head);
 		slob_rcu->size = c->size;
 		call_rcu(&slob_rcu->head, kmem_rcu_free);
-	} else {
+	} else if (!slob_cache_mag_free(c, b)) {
 		__kmem_cache_free(b, c->size);
 	}
 
@@ -796,6 +1610,72 @@ void kmem_cache_free(struct kmem_cache *c, void *b)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Allocate nr objects from c into p, taking each heap lock once for as
+ * many objects as the heap or c's slot pages can give. Returns nr, or 0
+ * if it could not allocate them all, in which case it allocated none.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *c, gfp_t flags, size_t nr,
+			  void **p)
+{
+	size_t i;
+
+	if (c->size > SLOB_MAX_SIZE) {
+		for (i = 0; i < nr; i++) {
+			p[i] = kmem_cache_alloc_node(c, flags, -1);
+			if (!p[i]) {
+				kmem_cache_free_bulk(c, i, p);
+				return 0;
+			}
+		}
+		return nr;
+	}
+
+	i = slob_alloc_bulk(c, c->size, flags, c->align, -1, p, nr);
+	if (i < nr) {
+		slob_free_bulk(p, i, c->size);
+		return 0;
+	}
+
+	slob_stat(SLOB_ALLOC, nr);
+	for (i = 0; i < nr; i++) {
+		if (c->ctor)
+			c->ctor(p[i]);
+		trace_kmem_cache_alloc_node(_RET_IP_, p[i], c->size,
+					    c->slot_size ? c->slot_size :
+					    slob_block_units(c->size) *
+					    SLOB_UNIT,
+					    flags, -1);
+		kmemleak_alloc_recursive(p[i], c->size, 1, c->flags, flags);
+	}
+	return nr;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/*
+ * Free nr objects of c, taking each heap lock once for a run of objects
+ * on its node.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *c, size_t nr, void **p)
+{
+	size_t i;
+
+	if (unlikely(c->size > SLOB_MAX_SIZE ||
+		     (c->flags & SLAB_DESTROY_BY_RCU))) {
+		for (i = 0; i < nr; i++)
+			kmem_cache_free(c, p[i]);
+		return;
+	}
+
+	for (i = 0; i < nr; i++) {
+		kmemleak_free_recursive(p[i], c->flags);
+		trace_kmem_cache_free(_RET_IP_, p[i]);
+	}
+	slob_stat(SLOB_FREE, nr);
+	slob_free_bulk(p, nr, c->size);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 unsigned int kmem_cache_size(struct kmem_cache *c)
 {
 	return c->size;
@@ -810,6 +1690,7 @@ EXPORT_SYMBOL(kmem_cache_name);
 
 int kmem_cache_shrink(struct kmem_cache *d)
 {
+	slob_cache_mag_shrink(d);
 	return 0;
 }
 EXPORT_SYMBOL(kmem_cache_shrink);
@@ -828,6 +1709,15 @@ int slab_is_available(void)
 
 void __init kmem_cache_init(void)
 {
+	int node;
+
+	for (node = 0; node < MAX_NUMNODES; node++) {
+		spin_lock_init(&slob_heaps[node].lock);
+		INIT_LIST_HEAD(&slob_heaps[node].free_pages);
+	}
+#ifdef CONFIG_SMP
+	hotcpu_notifier(slob_cpu_callback, 0);
+#endif
 	slob_ready = 1;
 }
 
@@ -836,35 +1726,161 @@ void __init kmem_cache_init_late(void)
 	/* Nothing to do */
 }
 
-unsigned int sys_get_slob_amt_claimed()
-{
-        printk( KERN_ALERT "Amount pages_alloc: %u\n", pages_alloc );
-	printk( KERN_ALERT "PAGE_SIZE in int: %lu\n", PAGE_SIZE );
-	return (pages_alloc * (unsigned int)PAGE_SIZE);
-	
-}
+#ifdef CONFIG_PROC_FS
+#define SLOB_HIST_MIN	(fls(SLOB_UNIT) - 1)
 
-unsigned int sys_get_slob_amt_free()
+/*
+ * What /proc/slobinfo shows of the heaps, each node's taken under its
+ * heap lock.
+ */
+struct slob_info {
+	unsigned long heap_pages;
+	unsigned long slot_pages;
+	unsigned long free_bytes;
+	unsigned long free_blocks;
+	unsigned long largest_free;
+	unsigned long hist[PAGE_SHIFT + 1];	/* free blocks by log2 size */
+	struct {
+		unsigned long heap_pages;
+		unsigned long free_bytes;
+	} node[MAX_NUMNODES];
+};
+
+static void slob_info_snapshot(struct slob_info *info)
 {
-	struct list_head *slob_list;
+	struct slob_heap *h;
 	struct slob_page *sp;
+	unsigned long flags, bytes, free;
+	slob_t *cur;
+	int node;
+
+	memset(info, 0, sizeof(*info));
+
+	for_each_online_node(node) {
+		h = &slob_heaps[node];
+		free = 0;
+		spin_lock_irqsave(&h->lock, flags);
+		info->node[node].heap_pages = h->pages;
+		info->slot_pages += h->slot_pages;
+		list_for_each_entry(sp, &h->free_pages, list) {
+			for (cur = sp->free; ; cur = slob_next(cur)) {
+				bytes = slob_units(cur) * SLOB_UNIT;
+				free += bytes;
+				info->free_blocks++;
+				info->hist[fls(bytes) - 1]++;
+				if (bytes > info->largest_free)
+					info->largest_free = bytes;
+				if (slob_last(cur))
+					break;
+			}
+		}
+		spin_unlock_irqrestore(&h->lock, flags);
 
-	unsigned int free_bytes = 0;
-
-	slob_list = &free_slob_small;
-	list_for_each_entry( sp, slob_list, list ){
-		free_bytes += UNSLOB_UNITS( sp->units );
-	}
-	 
-	slob_list = &free_slob_medium;
-	list_for_each_entry( sp, slob_list, list ){
-		free_bytes += UNSLOB_UNITS( sp->units );
+		info->node[node].free_bytes = free;
+		info->heap_pages += h->pages;
+		info->free_bytes += free;
 	}
+}
 
-	slob_list = &free_slob_large;
-	list_for_each_entry( sp, slob_list, list ){
-		free_bytes += UNSLOB_UNITS( sp->units );
+#ifdef CONFIG_SMP
+/*
+ * Objects sitting in magazines, read without stopping their CPUs so
+ * only a rough count.
+ */
+static unsigned long slob_mag_count(void)
+{
+	struct kmem_cache *c;
+	unsigned long nr = 0;
+	int cpu, i;
+
+	mutex_lock(&slob_cache_mutex);
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < SLOB_MAG_CLASSES; i++)
+			nr += per_cpu(slob_kmalloc_mags, cpu)[i].nr;
+		list_for_each_entry(c, &slob_caches, list)
+			nr += per_cpu_ptr(c->mags, cpu)->nr;
 	}
+	mutex_unlock(&slob_cache_mutex);
+	return nr;
+}
+#else
+static inline unsigned long slob_mag_count(void)
+{
+	return 0;
+}
+#endif
+
+static int slobinfo_show(struct seq_file *m, void *arg)
+{
+	unsigned long stats[NR_SLOB_STATS] = { 0 };
+	struct slob_info *info;
+	unsigned long frag = 0;
+	int cpu, i;
+
+	info = kmalloc(sizeof(*info), GFP_KERNEL);
+	if (!info)
+		return -ENOMEM;
+	slob_info_snapshot(info);
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < NR_SLOB_STATS; i++)
+			stats[i] += per_cpu(slob_stats, cpu)[i];
 
-	return free_bytes; 
+	/*
+	 * External fragmentation in thousandths: 0 when all free space is
+	 * one block, approaching 1000 as it splinters into small ones.
+	 */
+	if (info->free_bytes)
+		frag = 1000 - info->largest_free * 1000 / info->free_bytes;
+
+	seq_puts(m, "slobinfo - version: 1.2\n");
+	seq_printf(m, "pages_claimed  %lu\n",
+		   stats[SLOB_PAGE_ALLOC] - stats[SLOB_PAGE_FREE]);
+	seq_printf(m, "heap_pages     %lu\n", info->heap_pages);
+	seq_printf(m, "slot_pages     %lu\n", info->slot_pages);
+	seq_printf(m, "free_bytes     %lu\n", info->free_bytes);
+	seq_printf(m, "free_blocks    %lu\n", info->free_blocks);
+	seq_printf(m, "largest_free   %lu\n", info->largest_free);
+	seq_printf(m, "frag_index     %lu\n", frag);
+	seq_printf(m, "cached_objects %lu\n", slob_mag_count());
+	seq_printf(m, "allocs         %lu\n", stats[SLOB_ALLOC]);
+	seq_printf(m, "frees          %lu\n", stats[SLOB_FREE]);
+	seq_printf(m, "pages_alloc    %lu\n", stats[SLOB_PAGE_ALLOC]);
+	seq_printf(m, "pages_free     %lu\n", stats[SLOB_PAGE_FREE]);
+
+	seq_puts(m, "block_bytes   ");
+	for (i = SLOB_HIST_MIN; i <= PAGE_SHIFT; i++)
+		seq_printf(m, " %6lu", 1UL << i);
+	seq_puts(m, "\nfree_blocks   ");
+	for (i = SLOB_HIST_MIN; i <= PAGE_SHIFT; i++)
+		seq_printf(m, " %6lu", info->hist[i]);
+	seq_putc(m, '\n');
+#ifdef CONFIG_NUMA
+	seq_printf(m, "spilled        %lu\n", stats[SLOB_SPILL]);
+	for_each_online_node(i)
+		seq_printf(m, "node%-4d       heap_pages %lu free_bytes %lu\n",
+			   i, info->node[i].heap_pages,
+			   info->node[i].free_bytes);
+#endif
+	kfree(info);
+	return 0;
+}
+
+static int slobinfo_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, slobinfo_show, NULL);
+}
+
+static const struct file_operations proc_slobinfo_operations = {
+	.open		= slobinfo_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init slob_proc_init(void)
+{
+	proc_create("slobinfo", S_IRUGO, NULL, &proc_slobinfo_operations);
+	return 0;
 }
+module_init(slob_proc_init);
+#endif /* CONFIG_PROC_FS */
@@ -1883,6 +1883,93 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Allocate nr objects with interrupts disabled once for all of them.
+ * They come off the cpu slab's lockless freelist, and each time that
+ * runs dry __slab_alloc() takes over the whole freelist of another slab
+ * under a single slab_lock. Returns nr, or 0 having allocated none.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t gfpflags, size_t nr,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	size_t i, j;
+
+	gfpflags &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(gfpflags);
+	might_sleep_if(gfpflags & __GFP_WAIT);
+
+	if (should_failslab(s->objsize, gfpflags, s->flags))
+		return 0;
+
+	local_irq_save(flags);
+	for (i = 0; i < nr; i++) {
+		c = __this_cpu_ptr(s->cpu_slab);
+		p[i] = c->freelist;
+		if (unlikely(!p[i])) {
+			p[i] = __slab_alloc(s, gfpflags, -1, _RET_IP_, c);
+			if (unlikely(!p[i]))
+				break;
+		} else {
+			c->freelist = get_freepointer(s, p[i]);
+			stat(s, ALLOC_FASTPATH);
+		}
+	}
+	local_irq_restore(flags);
+
+	for (j = 0; j < i; j++) {
+		if (unlikely(gfpflags & __GFP_ZERO))
+			memset(p[j], 0, s->objsize);
+		kmemcheck_slab_alloc(s, gfpflags, p[j], s->objsize);
+		kmemleak_alloc_recursive(p[j], s->objsize, 1, s->flags,
+					 gfpflags);
+		trace_kmem_cache_alloc(_RET_IP_, p[j], s->objsize, s->size,
+				       gfpflags);
+	}
+
+	if (unlikely(i < nr)) {
+		kmem_cache_free_bulk(s, i, p);
+		return 0;
+	}
+	return nr;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/*
+ * Free nr objects with interrupts disabled once for all of them.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t nr, void **p)
+{
+	struct kmem_cache_cpu *c;
+	struct page *page;
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	c = __this_cpu_ptr(s->cpu_slab);
+	for (i = 0; i < nr; i++) {
+		void **object = p[i];
+
+		page = virt_to_head_page(object);
+		kmemleak_free_recursive(object, s->flags);
+		kmemcheck_slab_free(s, object, s->objsize);
+		debug_check_no_locks_freed(object, s->objsize);
+		if (!(s->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(object, s->objsize);
+		if (likely(page == c->page && c->node >= 0)) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+		} else
+			__slab_free(s, page, object, _RET_IP_);
+		trace_kmem_cache_free(_RET_IP_, object);
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /* Figure out on which slab page the object resides */
 static struct page *get_object_page(const void *x)
 {
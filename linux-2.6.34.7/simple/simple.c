@@ -1,18 +1,41 @@
-#include <unistd.h>
 #include <stdio.h>
-//#include <arch/x86/include/asm/unistd_32.h>
-//#include <unistd_32.h>
-
+#include <string.h>
+#include <unistd.h>
 
+/*
+ * Prints how much memory the SLOB allocator has claimed and how much of
+ * it is free, from /proc/slobinfo. With -v, prints the whole file.
+ */
 int main( int argc, char ** argv ) {
 
-  unsigned int free, claimed;
+  FILE *f;
+  char line[256], key[32];
+  unsigned long val, claimed = 0, free = 0, frag = 0;
+  int verbose = argc > 1 && !strcmp( argv[1], "-v" );
+
+  f = fopen( "/proc/slobinfo", "r" );
+  if ( !f ) {
+    perror( "/proc/slobinfo" );
+    return 1;
+  }
 
-  claimed = syscall( /*__NR_sys_get_slob_amt_claimed*/ 338 );
-  free = syscall( /*__NR_sys_get_slob_amt_free*/ 339 );
+  while ( fgets( line, sizeof( line ), f ) ) {
+    if ( verbose )
+      fputs( line, stdout );
+    if ( sscanf( line, "%31s %lu", key, &val ) != 2 )
+      continue;
+    if ( !strcmp( key, "pages_claimed" ) )
+      claimed = val * getpagesize();
+    else if ( !strcmp( key, "free_bytes" ) )
+      free = val;
+    else if ( !strcmp( key, "frag_index" ) )
+      frag = val;
+  }
+  fclose( f );
 
-  printf( "Claimed memory: %u\n", claimed );
-  printf( "Free memory: %u\n", free );
+  printf( "Claimed memory: %lu\n", claimed );
+  printf( "Free memory: %lu\n", free );
+  printf( "Fragmentation: %lu.%lu%%\n", frag / 10, frag % 10 );
 
   return 0;
 
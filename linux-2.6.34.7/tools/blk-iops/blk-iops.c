@@ -0,0 +1,225 @@
+/*
+ * blk-iops: random I/O rate of a block device against submitting CPUs.
+ *
+ * For 1, 2, 4 ... up to the number of online CPUs, starts that many
+ * threads, each pinned to a CPU of its own, that read (or with -w,
+ * write) random aligned blocks of the device with O_DIRECT for a fixed
+ * time. The total IOPS of each run shows how far submission scales
+ * across CPUs, which for a device that is faster than the block layer
+ * (null_blk, brd, virtio_blk on a RAM-backed host) is the block layer
+ * itself. With large blocks, the MB/s column shows the throughput of a
+ * stacked driver such as dm-crypt instead; see dm-crypt-bench.sh.
+ *
+ * -w overwrites the device.
+ *
+ * Usage: blk-iops [-w] [-b blocksize] [-t seconds] [-c maxcpus] device
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+static const char *device;
+static unsigned int block_size = 4096;
+static unsigned int seconds = 5;
+static unsigned long long nr_blocks;
+static int write_mode;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	int fd;
+	unsigned long long ios;
+	int err;
+};
+
+/* xorshift, one state per thread so the workers share nothing */
+static inline unsigned long long next_rand(unsigned long long *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long seed = 0x9e3779b97f4a7c15ULL * (w->cpu + 1);
+	cpu_set_t set;
+	void *buf;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	if (posix_memalign(&buf, 4096, block_size)) {
+		w->err = ENOMEM;
+		return NULL;
+	}
+	memset(buf, w->cpu, block_size);
+
+	while (!stop) {
+		off_t off = (next_rand(&seed) % nr_blocks) * block_size;
+		ssize_t ret;
+
+		if (write_mode)
+			ret = pwrite(w->fd, buf, block_size, off);
+		else
+			ret = pread(w->fd, buf, block_size, off);
+		if (ret != block_size) {
+			w->err = errno ? errno : EIO;
+			break;
+		}
+		w->ios++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int run(unsigned int nr_threads, const int *cpus)
+{
+	struct worker *workers = calloc(nr_threads, sizeof(*workers));
+	unsigned long long ios = 0;
+	struct timespec start, end;
+	double secs;
+	unsigned int i;
+	int err = 0;
+
+	if (!workers)
+		return ENOMEM;
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].cpu = cpus[i];
+		workers[i].fd = open(device, O_DIRECT |
+				     (write_mode ? O_WRONLY : O_RDONLY));
+		if (workers[i].fd < 0) {
+			err = errno;
+			nr_threads = i;
+			goto out;
+		}
+	}
+
+	stop = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&workers[i].thread, NULL, worker_fn,
+			       &workers[i]);
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ios += workers[i].ios;
+		if (workers[i].err)
+			err = workers[i].err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (!err)
+		printf("%4u  %12.0f  %10.0f  %10.1f\n", nr_threads, ios / secs,
+		       ios / secs / nr_threads,
+		       ios * (double)block_size / secs / (1 << 20));
+out:
+	for (i = 0; i < nr_threads; i++)
+		close(workers[i].fd);
+	free(workers);
+	return err;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: blk-iops [-w] [-b blocksize] [-t seconds] "
+		"[-c maxcpus] device\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long bytes;
+	unsigned int max_cpus = 0, nr, nr_cpus = 0;
+	struct stat st;
+	cpu_set_t set;
+	int *cpus;
+	int c, fd, err;
+
+	while ((c = getopt(argc, argv, "wb:t:c:")) != -1) {
+		switch (c) {
+		case 'w':
+			write_mode = 1;
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			max_cpus = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || !block_size || (block_size & 511) ||
+	    !seconds)
+		usage();
+	device = argv[optind];
+
+	/* a regular file works too, for comparison with loop */
+	fd = open(device, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(device);
+		return 1;
+	}
+	bytes = st.st_size;
+	if (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &bytes)) {
+		perror(device);
+		return 1;
+	}
+	close(fd);
+	nr_blocks = bytes / block_size;
+	if (!nr_blocks) {
+		fprintf(stderr, "%s: smaller than one block\n", device);
+		return 1;
+	}
+
+	/* the CPUs we are allowed to run on, in order */
+	sched_getaffinity(0, sizeof(set), &set);
+	cpus = malloc(CPU_SETSIZE * sizeof(*cpus));
+	if (!cpus)
+		return 1;
+	for (c = 0; c < CPU_SETSIZE; c++)
+		if (CPU_ISSET(c, &set))
+			cpus[nr_cpus++] = c;
+	if (max_cpus && max_cpus < nr_cpus)
+		nr_cpus = max_cpus;
+
+	printf("%s: %u byte random %s, %us per run\n", device, block_size,
+	       write_mode ? "writes" : "reads", seconds);
+	printf("cpus          iops     per cpu        MB/s\n");
+	for (nr = 1; ; nr *= 2) {
+		if (nr > nr_cpus)
+			nr = nr_cpus;
+		err = run(nr, cpus);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", device, strerror(err));
+			return 1;
+		}
+		if (nr == nr_cpus)
+			break;
+	}
+	free(cpus);
+	return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Throughput of dm-crypt on a ramdisk, with the single kcryptd thread
+# and with the "parallel" table feature, for 1, 2, 4 ... CPUs.
+#
+# Usage: dm-crypt-bench.sh [brd size in MB] [block size] [cipher]
+#
+# Needs root, dmsetup, and brd and dm-crypt as modules or built in. The
+# brd module is reloaded, so nothing else may be using /dev/ram0.
+
+size_mb=${1:-1024}
+bs=${2:-65536}
+cipher=${3:-aes-cbc-essiv:sha256}
+key=0123456789abcdef0123456789abcdef
+dir=$(dirname "$0")
+
+set -e
+
+rmmod brd 2>/dev/null || true
+modprobe brd rd_nr=1 rd_size=$((size_mb * 1024))
+modprobe dm-crypt 2>/dev/null || true
+
+sectors=$(blockdev --getsize /dev/ram0)
+
+# fill the ramdisk so that reads do not hit unallocated pages
+dd if=/dev/zero of=/dev/ram0 bs=1M count=$size_mb oflag=direct 2>/dev/null
+
+for features in "" " 1 parallel"; do
+	dmsetup create cryptbench --table \
+		"0 $sectors crypt $cipher $key 0 /dev/ram0 0$features"
+	echo "== crypt $cipher${features:+ (parallel)}"
+	"$dir/blk-iops" -w -b $bs /dev/mapper/cryptbench
+	"$dir/blk-iops" -b $bs /dev/mapper/cryptbench
+	dmsetup remove cryptbench
+done
+
+rmmod brd
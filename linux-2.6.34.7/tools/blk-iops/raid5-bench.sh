@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Write throughput of a RAID5 array of ramdisks against the number of
+# stripe worker threads (stripe_workers in md sysfs).
+#
+# Usage: raid5-bench.sh [disks] [disk size in MB] [block size]
+#
+# Needs root, mdadm, and brd and raid456 as modules or built in. The
+# brd module is reloaded, so nothing else may be using /dev/ram*, and
+# /dev/md/raid5bench must not exist.
+
+disks=${1:-4}
+size_mb=${2:-512}
+bs=${3:-1048576}
+dir=$(dirname "$0")
+md=/dev/md/raid5bench
+
+set -e
+
+rmmod brd 2>/dev/null || true
+modprobe brd rd_nr=$disks rd_size=$((size_mb * 1024))
+modprobe raid456 2>/dev/null || true
+
+members=
+i=0
+while [ $i -lt $disks ]; do
+	members="$members /dev/ram$i"
+	i=$((i + 1))
+done
+
+mdadm --create $md --run --level=5 --raid-devices=$disks \
+	--assume-clean $members >/dev/null 2>&1
+sysfs=/sys/block/$(basename $(readlink -f $md))/md
+
+ncpus=$(grep -c ^processor /proc/cpuinfo)
+workers=0
+while :; do
+	echo $workers > $sysfs/stripe_workers
+	echo "== stripe_workers $workers"
+	"$dir/blk-iops" -w -b $bs $md
+	[ $workers -ge $ncpus ] && break
+	workers=$((workers ? workers * 2 : 1))
+done
+
+mdadm --stop $md >/dev/null
+rmmod brd
@@ -0,0 +1,12 @@
+/* tracepoints compile away in the harness */
+#include "../../../shim.h"
+
+static inline void trace_look_add_request(struct request *rq, unsigned int dir,
+					  sector_t head, unsigned int depth)
+{
+}
+
+static inline void trace_look_dispatch(struct request *rq, unsigned int dir,
+				       sector_t head, unsigned int depth)
+{
+}
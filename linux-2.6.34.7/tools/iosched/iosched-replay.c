@@ -0,0 +1,579 @@
+/*
+ * iosched-replay: replay a block trace through the I/O schedulers.
+ *
+ * Reads a trace in blkparse's default text format and feeds every
+ * queued bio (Q events) to a scheduler at the time it was queued. Bios
+ * are merged into queued requests the way __make_request() does, and
+ * requests the scheduler dispatches are serviced by a simple model of
+ * a single-actuator disk. Everything runs in simulated time, so a trace
+ * of minutes replays in well under a second and the results do not
+ * depend on the machine, apart from the CPU cost of the scheduler,
+ * which is measured for real.
+ *
+ * For each scheduler it reports:
+ *
+ *   MB/s, IOPS      bytes and requests completed over the replay
+ *   seek            total head movement of the disk model, in sectors
+ *   mean, p99, max  time from a bio being queued to its request
+ *                   completing, in ms
+ *   disp            CPU time spent asking the scheduler for each
+ *                   dispatched request, in ns
+ *
+ * Usage: iosched-replay [-e elevator]... [-o [elevator.]attr=value]...
+ *                       [-q depth] [-b MB/s] [-t full_seek_ms]
+ *                       [-r rpm] [-c sectors] [-v] trace|-
+ *        iosched-replay -g bios [-s seed] [-i interarrival_us]
+ *
+ * Without -e, look, deadline and noop are compared. -o sets a scheduler
+ * tunable before the replay, as if written to
+ * /sys/block/<dev>/queue/iosched/<attr>; without a prefix it is set for
+ * every scheduler being run. -q is the number of requests the device
+ * accepts at once; they are still serviced one at a time, in the order
+ * they were started. -v adds per-direction latencies and merge counts.
+ *
+ * -g writes a synthetic trace to stdout instead: four sequential
+ * readers and four random writers, with exponentially distributed
+ * arrivals. Real traces come from
+ *
+ *   blktrace -d /dev/sdX -o - | blkparse -i - > trace.txt
+ *
+ * and should cover a single device; events for any other device in the
+ * trace are skipped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "shim.h"
+
+struct replay_bio {
+	struct bio bio;
+	u64 queued;		/* ns since the start of the trace */
+	u64 latency;
+};
+
+struct replay_rq {
+	struct request rq;
+	u64 done;		/* when the disk model finishes it */
+};
+
+/*
+ * Seek time grows with the square root of the distance, from one track
+ * to a full stroke; any seek also waits half a rotation on average.
+ */
+struct disk {
+	sector_t capacity;
+	u64 track_ns;
+	u64 full_seek_ns;
+	u64 half_rot_ns;
+	u64 bytes_per_sec;
+	unsigned int depth;
+
+	sector_t pos;
+	u64 busy_until;
+};
+
+struct result {
+	u64 end;
+	u64 bytes;
+	unsigned long nr_rqs;
+	unsigned long nr_freed;
+	u64 seek;
+	u64 fetch_ns;
+	unsigned long nr_fetched;
+};
+
+static struct disk disk = {
+	.track_ns	= 500000,
+	.full_seek_ns	= 8000000,
+	.half_rot_ns	= 30000000000ULL / 7200,
+	.bytes_per_sec	= 100000000,
+	.depth		= 1,
+};
+
+static struct replay_bio *bios;
+static unsigned long nr_bios;
+
+#define MAX_ELEVATORS	8
+#define MAX_ATTRS	16
+static const char *elevators[MAX_ELEVATORS];
+static int nr_elevators;
+static char *attrs[MAX_ATTRS];
+static int nr_attrs;
+static int verbose;
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void set_jiffies(u64 ns)
+{
+	jiffies = ns / (1000000000 / HZ);
+}
+
+static int bio_cmp(const void *a, const void *b)
+{
+	const struct replay_bio *x = a, *y = b;
+
+	if (x->queued != y->queued)
+		return x->queued < y->queued ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Load the Q events of the first device in a blkparse trace. Lines that
+ * are not events (the per-CPU summaries at the end, for instance) and
+ * bios without a data direction or size, such as flushes and discards,
+ * are skipped.
+ */
+static int load_trace(FILE *f)
+{
+	unsigned int major, minor, dev_major = 0, dev_minor = 0, nr_sect;
+	unsigned long size = 0, skipped = 0;
+	char line[512], action[8], rwbs[8];
+	unsigned long long sector, max_end = 0;
+	double t;
+	int have_dev = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct replay_bio *b;
+
+		if (sscanf(line, " %u,%u %*u %*u %lf %*u %7s %7s %llu + %u",
+			   &major, &minor, &t, action, rwbs, &sector,
+			   &nr_sect) != 7)
+			continue;
+		if (strcmp(action, "Q"))
+			continue;
+		if (!have_dev) {
+			dev_major = major;
+			dev_minor = minor;
+			have_dev = 1;
+		}
+		if (major != dev_major || minor != dev_minor) {
+			skipped++;
+			continue;
+		}
+		if (!nr_sect || strchr(rwbs, 'D') ||
+		    (!strchr(rwbs, 'R') && !strchr(rwbs, 'W')))
+			continue;
+
+		if (nr_bios == size) {
+			size = size ? size * 2 : 4096;
+			bios = realloc(bios, size * sizeof(*bios));
+			if (!bios) {
+				perror("realloc");
+				return -1;
+			}
+		}
+		b = &bios[nr_bios++];
+		memset(b, 0, sizeof(*b));
+		b->bio.bi_sector = sector;
+		b->bio.bi_size = nr_sect << 9;
+		b->bio.bi_rw = strchr(rwbs, 'W') ? WRITE : READ;
+		if (strchr(rwbs, 'S'))
+			b->bio.bi_rw |= REQ_RW_SYNC;
+		b->queued = t > 0 ? (u64)(t * 1e9) : 0;
+		max_end = max(max_end, sector + nr_sect);
+	}
+
+	if (skipped)
+		fprintf(stderr, "skipped %lu events for devices other than "
+			"%u,%u\n", skipped, dev_major, dev_minor);
+	if (!nr_bios) {
+		fprintf(stderr, "no queued bios in trace\n");
+		return -1;
+	}
+
+	/* blkparse sorts events, but only loosely across CPUs */
+	qsort(bios, nr_bios, sizeof(*bios), bio_cmp);
+
+	if (!disk.capacity)
+		disk.capacity = max_end;
+	return 0;
+}
+
+/* time the disk model needs for @rq once it gets to it */
+static u64 disk_service(struct disk *d, struct request *rq,
+			struct result *res)
+{
+	sector_t pos = blk_rq_pos(rq);
+	sector_t dist = pos > d->pos ? pos - d->pos : d->pos - pos;
+	u64 t = (u64)blk_rq_bytes(rq) * 1000000000 / d->bytes_per_sec;
+
+	if (dist) {
+		t += d->track_ns + d->half_rot_ns;
+		t += (d->full_seek_ns - d->track_ns) *
+		     sqrt(min((double)dist / d->capacity, 1.0));
+	}
+
+	res->seek += dist;
+	d->pos = rq_end_sector(rq);
+	return t;
+}
+
+static struct request *alloc_rq(struct replay_bio *b)
+{
+	struct replay_rq *r = calloc(1, sizeof(*r));
+
+	if (!r) {
+		perror("calloc");
+		exit(1);
+	}
+	r->rq.cmd_flags = b->bio.bi_rw;
+	r->rq.__sector = b->bio.bi_sector;
+	r->rq.__data_len = b->bio.bi_size;
+	r->rq.bio = r->rq.biotail = &b->bio;
+	return &r->rq;
+}
+
+static void submit_bio(struct request_queue *q, struct replay_bio *b,
+		       struct result *res)
+{
+	struct request *freed;
+
+	if (!shim_merge_bio(q, &b->bio, &freed)) {
+		shim_add_request(q, alloc_rq(b));
+		return;
+	}
+	if (freed) {
+		free(container_of(freed, struct replay_rq, rq));
+		res->nr_freed++;
+	}
+}
+
+static void complete_rq(struct request_queue *q, struct request *rq,
+			u64 now, struct result *res)
+{
+	struct bio *bio;
+
+	for (bio = rq->bio; bio; bio = bio->bi_next) {
+		struct replay_bio *b = container_of(bio, struct replay_bio,
+						    bio);
+
+		b->latency = now - b->queued;
+	}
+
+	res->bytes += blk_rq_bytes(rq);
+	res->nr_rqs++;
+	shim_complete_request(q, rq);
+	free(container_of(rq, struct replay_rq, rq));
+}
+
+static int set_attrs(struct request_queue *q, const char *elevator)
+{
+	int i, len = strlen(elevator);
+
+	for (i = 0; i < nr_attrs; i++) {
+		char *name = attrs[i], *val = strchr(attrs[i], '=');
+		char *dot = strchr(attrs[i], '.');
+		int ret;
+
+		if (dot && dot < val) {
+			if (dot - name != len || strncmp(name, elevator, len))
+				continue;
+			name = dot + 1;
+		}
+
+		*val = '\0';
+		ret = shim_attr_store(q, name, val + 1);
+		*val = '=';
+		if (ret < 0) {
+			fprintf(stderr, "%s: cannot set %s\n", elevator,
+				attrs[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int replay(const char *elevator, struct result *res)
+{
+	struct request_queue *q = shim_queue_create(elevator);
+	struct list_head in_flight;
+	struct request *rq;
+	unsigned long next = 0;
+	u64 now = 0, start;
+
+	if (!q) {
+		fprintf(stderr, "no elevator \"%s\"\n", elevator);
+		return -1;
+	}
+	if (set_attrs(q, elevator)) {
+		shim_queue_destroy(q);
+		return -1;
+	}
+
+	memset(res, 0, sizeof(*res));
+	INIT_LIST_HEAD(&in_flight);
+	disk.pos = 0;
+	disk.busy_until = 0;
+	jiffies = 0;
+
+	for (;;) {
+		u64 arrival = ~0ULL, completion = ~0ULL;
+
+		/* keep the device as busy as it lets us */
+		while (q->in_flight < disk.depth) {
+			set_jiffies(now);
+			start = now_ns();
+			rq = shim_fetch_request(q);
+			res->fetch_ns += now_ns() - start;
+			if (!rq)
+				break;
+			res->nr_fetched++;
+
+			disk.busy_until = max(now, disk.busy_until) +
+					  disk_service(&disk, rq, res);
+			container_of(rq, struct replay_rq, rq)->done =
+				disk.busy_until;
+			list_add_tail(&rq->queuelist, &in_flight);
+		}
+
+		if (next < nr_bios)
+			arrival = bios[next].queued;
+		if (!list_empty(&in_flight)) {
+			rq = list_entry_rq(in_flight.next);
+			completion = container_of(rq, struct replay_rq,
+						  rq)->done;
+		}
+		if (arrival == ~0ULL && completion == ~0ULL)
+			break;
+
+		if (arrival <= completion) {
+			now = max(now, arrival);
+			set_jiffies(now);
+			submit_bio(q, &bios[next++], res);
+		} else {
+			now = completion;
+			set_jiffies(now);
+			list_del_init(&rq->queuelist);
+			complete_rq(q, rq, now, res);
+		}
+	}
+
+	if (q->nr_sorted) {
+		fprintf(stderr, "%s: %u requests left in the scheduler\n",
+			elevator, q->nr_sorted);
+		return -1;
+	}
+
+	res->end = now;
+	shim_queue_destroy(q);
+	return 0;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	const u64 *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+/* latencies of the bios with direction @dir, or all of them if @dir < 0 */
+static void print_latency(const char *label, int dir)
+{
+	u64 *lat = malloc(nr_bios * sizeof(*lat)), sum = 0;
+	unsigned long i, n = 0;
+
+	if (!lat) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < nr_bios; i++) {
+		if (dir >= 0 && bio_data_dir(&bios[i].bio) != dir)
+			continue;
+		lat[n++] = bios[i].latency;
+		sum += bios[i].latency;
+	}
+
+	if (n) {
+		qsort(lat, n, sizeof(*lat), u64_cmp);
+		printf(" %s%9.2f %9.2f %9.2f", label, sum / 1e6 / n,
+		       lat[(n * 99 + 99) / 100 - 1] / 1e6, lat[n - 1] / 1e6);
+	} else {
+		printf(" %s%9s %9s %9s", label, "-", "-", "-");
+	}
+	free(lat);
+}
+
+static void print_result(const char *elevator, struct result *res)
+{
+	double secs = res->end > bios[0].queued ?
+		      (res->end - bios[0].queued) / 1e9 : 1e-9;
+
+	printf("%-10s %8.2f %8.0f %14llu", elevator, res->bytes / 1e6 / secs,
+	       res->nr_rqs / secs, res->seek);
+	print_latency("", -1);
+	printf(" %8.0f\n", res->nr_fetched ?
+	       (double)res->fetch_ns / res->nr_fetched : 0.0);
+
+	if (!verbose)
+		return;
+
+	printf("%-10s %8s %8s %14s", "", "", "", "read");
+	print_latency("", READ);
+	printf("\n%-10s %8s %8s %14s", "", "", "", "write");
+	print_latency("", WRITE);
+	printf("\n%-10s requests %lu, bios merged %lu, requests merged %lu\n",
+	       "", res->nr_rqs, nr_bios - res->nr_rqs - res->nr_freed,
+	       res->nr_freed);
+}
+
+/* exponentially distributed, with the given mean */
+static double exp_random(double mean)
+{
+	return -mean * log((random() + 1.0) / (RAND_MAX + 2.0));
+}
+
+static void generate(unsigned long nr, double interarrival_us)
+{
+	static const sector_t capacity = 1ULL << 31;	/* 1TB */
+	sector_t stream_pos[4];
+	double t = 0;
+	unsigned long i;
+	int s;
+
+	for (s = 0; s < 4; s++)
+		stream_pos[s] = ((sector_t)random() << 16 ^ random()) %
+				capacity & ~7ULL;
+
+	for (i = 0; i < nr; i++) {
+		sector_t sector;
+		unsigned int nr_sect;
+
+		t += exp_random(interarrival_us / 1e6);
+		s = random() % 8;
+		if (s < 4) {
+			nr_sect = 32;
+			sector = stream_pos[s];
+			stream_pos[s] = (sector + nr_sect) % capacity;
+		} else {
+			nr_sect = 8;
+			sector = ((sector_t)random() << 16 ^ random()) %
+				 capacity & ~7ULL;
+		}
+
+		printf("  8,0    0 %8lu %14.9f %5d  Q  %2s %llu + %u [gen]\n",
+		       i + 1, t, 1000 + s, s < 4 ? "R" : "W", sector, nr_sect);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-e elevator]... [-o [elevator.]attr=value]...\n"
+		"       %*s [-q depth] [-b MB/s] [-t full_seek_ms] [-r rpm]\n"
+		"       %*s [-c sectors] [-v] trace|-\n"
+		"       %s -g bios [-s seed] [-i interarrival_us]\n",
+		prog, (int)strlen(prog), "", (int)strlen(prog), "", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *def_elevators[] = { "look", "deadline", "noop" };
+	unsigned long gen = 0;
+	double interarrival_us = 8000;
+	struct result res;
+	FILE *f;
+	int c, i, ret = 0;
+
+	srandom(1);
+
+	while ((c = getopt(argc, argv, "b:c:e:g:i:o:q:r:s:t:v")) != -1) {
+		switch (c) {
+		case 'b':
+			disk.bytes_per_sec = strtod(optarg, NULL) * 1e6;
+			break;
+		case 'c':
+			disk.capacity = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			if (nr_elevators == MAX_ELEVATORS)
+				usage(argv[0]);
+			elevators[nr_elevators++] = optarg;
+			break;
+		case 'g':
+			gen = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interarrival_us = strtod(optarg, NULL);
+			break;
+		case 'o':
+			if (nr_attrs == MAX_ATTRS || !strchr(optarg, '=')) {
+				fprintf(stderr, "bad attribute \"%s\"\n", optarg);
+				return 1;
+			}
+			attrs[nr_attrs++] = optarg;
+			break;
+		case 'q':
+			disk.depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			c = strtoul(optarg, NULL, 0);
+			disk.half_rot_ns = c ? 30000000000ULL / c : 0;
+			break;
+		case 's':
+			srandom(strtoul(optarg, NULL, 0));
+			break;
+		case 't':
+			disk.full_seek_ns = strtod(optarg, NULL) * 1e6;
+			disk.track_ns = min(disk.track_ns, disk.full_seek_ns);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (gen) {
+		generate(gen, interarrival_us);
+		return 0;
+	}
+
+	if (optind != argc - 1 || !disk.depth || !disk.bytes_per_sec)
+		usage(argv[0]);
+
+	if (!strcmp(argv[optind], "-")) {
+		f = stdin;
+	} else {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	ret = load_trace(f);
+	if (f != stdin)
+		fclose(f);
+	if (ret)
+		return 1;
+
+	if (!nr_elevators) {
+		for (i = 0; i < 3; i++)
+			elevators[i] = def_elevators[i];
+		nr_elevators = 3;
+	}
+
+	printf("%lu bios over %.3f s\n", nr_bios,
+	       (bios[nr_bios - 1].queued - bios[0].queued) / 1e9);
+	printf("%-10s %8s %8s %14s %9s %9s %9s %8s\n", "elevator", "MB/s",
+	       "IOPS", "seek", "mean(ms)", "p99(ms)", "max(ms)", "disp(ns)");
+
+	for (i = 0; i < nr_elevators && !ret; i++) {
+		ret = replay(elevators[i], &res);
+		if (!ret)
+			print_result(elevators[i], &res);
+	}
+
+	return ret ? 1 : 0;
+}
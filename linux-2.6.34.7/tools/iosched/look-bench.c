@@ -0,0 +1,161 @@
+/*
+ * look-bench: dispatch cost of the LOOK elevator against queue depth.
+ *
+ * Keeps the scheduler at a fixed depth of random 4k requests: each
+ * round dispatches one request and immediately queues a replacement.
+ * Only the dispatch call is timed, so the numbers show how the cost
+ * of picking the next request scales with the number of requests
+ * waiting in the scheduler.
+ *
+ * Usage: look-bench [-e elevator] [-n dispatches] [-s seed]
+ *                   [-o attr=value]... [depth...]
+ *
+ * -o sets a scheduler tunable, as if written to
+ * /sys/block/<dev>/queue/iosched/<attr>, before each run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "shim.h"
+
+struct bench_rq {
+	struct request rq;
+	struct bio bio;
+};
+
+static unsigned long long disk_sectors = 1ULL << 31;	/* 1TB */
+
+#define MAX_ATTRS	16
+static char *attrs[MAX_ATTRS];
+static int nr_attrs;
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_rq_init(struct bench_rq *b)
+{
+	sector_t sector = ((unsigned long long)random() << 16 ^ random()) %
+			  disk_sectors;
+
+	memset(b, 0, sizeof(*b));
+	b->bio.bi_sector = sector;
+	b->bio.bi_size = 4096;
+	b->rq.__sector = sector;
+	b->rq.__data_len = 4096;
+	b->rq.bio = b->rq.biotail = &b->bio;
+}
+
+static int run(const char *elevator, unsigned int depth, unsigned long nr)
+{
+	struct request_queue *q = shim_queue_create(elevator);
+	struct bench_rq *pool;
+	struct request *rq;
+	unsigned long long start, total = 0;
+	unsigned long i;
+
+	if (!q) {
+		fprintf(stderr, "no elevator \"%s\"\n", elevator);
+		return 1;
+	}
+
+	for (i = 0; i < nr_attrs; i++) {
+		char *val = strchr(attrs[i], '=');
+
+		*val = '\0';
+		if (shim_attr_store(q, attrs[i], val + 1) < 0) {
+			fprintf(stderr, "%s: cannot set %s\n", elevator,
+				attrs[i]);
+			return 1;
+		}
+		*val = '=';
+	}
+
+	pool = calloc(depth, sizeof(*pool));
+	if (!pool)
+		return 1;
+
+	for (i = 0; i < depth; i++) {
+		bench_rq_init(&pool[i]);
+		shim_add_request(q, &pool[i].rq);
+	}
+
+	for (i = 0; i < nr; i++) {
+		start = now_ns();
+		rq = shim_fetch_request(q);
+		total += now_ns() - start;
+
+		shim_complete_request(q, rq);
+		bench_rq_init(container_of(rq, struct bench_rq, rq));
+		shim_add_request(q, rq);
+	}
+
+	while ((rq = shim_fetch_request(q)))
+		shim_complete_request(q, rq);
+
+	printf("%-10s %8u %12lu %12.1f\n", elevator, depth, nr,
+	       (double)total / nr);
+
+	shim_queue_destroy(q);
+	free(pool);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int def_depths[] = {
+		1, 4, 16, 64, 256, 1024, 4096, 16384,
+	};
+	const char *elevator = "look";
+	unsigned long nr = 200000;
+	int c, i, ret = 0;
+
+	srandom(1);
+
+	while ((c = getopt(argc, argv, "e:n:o:s:")) != -1) {
+		switch (c) {
+		case 'e':
+			elevator = optarg;
+			break;
+		case 'n':
+			nr = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			if (nr_attrs == MAX_ATTRS || !strchr(optarg, '=')) {
+				fprintf(stderr, "bad attribute \"%s\"\n", optarg);
+				return 1;
+			}
+			attrs[nr_attrs++] = optarg;
+			break;
+		case 's':
+			srandom(strtoul(optarg, NULL, 0));
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-e elevator] [-n dispatches]"
+				" [-s seed] [-o attr=value]... [depth...]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%-10s %8s %12s %12s\n", "elevator", "depth", "dispatches",
+	       "ns/dispatch");
+
+	if (optind < argc) {
+		for (i = optind; i < argc && !ret; i++)
+			ret = run(elevator, strtoul(argv[i], NULL, 0), nr);
+	} else {
+		for (i = 0; i < sizeof(def_depths) / sizeof(def_depths[0]) &&
+			    !ret; i++)
+			ret = run(elevator, def_depths[i], nr);
+	}
+
+	return ret;
+}
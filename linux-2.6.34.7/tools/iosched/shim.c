@@ -0,0 +1,493 @@
+/*
+ * Userspace stand-ins for the parts of block/elevator.c that the
+ * I/O schedulers call back into, plus the queue plumbing the
+ * harness uses to drive them.
+ */
+#include "shim.h"
+
+#define MAX_ELEVATORS	8
+
+/* the merge hash, as in block/elevator.c */
+#define ELV_HASH_SHIFT		6
+#define ELV_HASH_ENTRIES	(1 << ELV_HASH_SHIFT)
+#define ELV_HASH_FN(sec)	\
+	((unsigned int)((((sec) >> 3) * 0x9e37fffffffc0001ULL) >> \
+			(64 - ELV_HASH_SHIFT)))
+#define rq_hash_key(rq)		(blk_rq_pos(rq) + blk_rq_sectors(rq))
+
+/* default request size limit, BLK_DEF_MAX_SECTORS */
+#define SHIM_MAX_SECTORS	1024
+
+unsigned long jiffies;
+
+static struct elevator_type *elevators[MAX_ELEVATORS];
+static int nr_elevators;
+
+void elv_register(struct elevator_type *e)
+{
+	assert(nr_elevators < MAX_ELEVATORS);
+	elevators[nr_elevators++] = e;
+}
+
+void elv_unregister(struct elevator_type *e)
+{
+}
+
+static struct elevator_type *elevator_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nr_elevators; i++)
+		if (!strcmp(elevators[i]->elevator_name, name))
+			return elevators[i];
+	return NULL;
+}
+
+static void elv_rqhash_del(struct request *rq)
+{
+	list_del_init(&rq->hash);
+}
+
+static void elv_rqhash_add(struct request_queue *q, struct request *rq)
+{
+	struct elevator_queue *e = q->elevator;
+
+	BUG_ON(!list_empty(&rq->hash));
+	list_add(&rq->hash, &e->hash[ELV_HASH_FN(rq_hash_key(rq))]);
+}
+
+static void elv_rqhash_reposition(struct request_queue *q, struct request *rq)
+{
+	elv_rqhash_del(rq);
+	elv_rqhash_add(q, rq);
+}
+
+static struct request *elv_rqhash_find(struct request_queue *q,
+				       sector_t offset)
+{
+	struct list_head *hash_list = &q->elevator->hash[ELV_HASH_FN(offset)];
+	struct request *rq;
+
+	list_for_each_entry(rq, hash_list, hash)
+		if (rq_hash_key(rq) == offset)
+			return rq;
+	return NULL;
+}
+
+/*
+ * Same insertion logic as the kernel's elv_dispatch_sort(), so the
+ * dispatch order seen by the harness matches what a driver would see.
+ */
+void elv_dispatch_sort(struct request_queue *q, struct request *rq)
+{
+	sector_t boundary;
+	struct list_head *entry;
+	int stop_flags;
+
+	if (q->last_merge == rq)
+		q->last_merge = NULL;
+
+	elv_rqhash_del(rq);
+
+	q->nr_sorted--;
+
+	boundary = q->end_sector;
+	stop_flags = REQ_SOFTBARRIER | REQ_HARDBARRIER | REQ_STARTED;
+	list_for_each_prev(entry, &q->queue_head) {
+		struct request *pos = list_entry_rq(entry);
+
+		if (rq_data_dir(rq) != rq_data_dir(pos))
+			break;
+		if (pos->cmd_flags & stop_flags)
+			break;
+		if (blk_rq_pos(rq) >= boundary) {
+			if (blk_rq_pos(pos) < boundary)
+				continue;
+		} else {
+			if (blk_rq_pos(pos) >= boundary)
+				break;
+		}
+		if (blk_rq_pos(rq) >= blk_rq_pos(pos))
+			break;
+	}
+
+	list_add(&rq->queuelist, entry);
+}
+
+void elv_dispatch_add_tail(struct request_queue *q, struct request *rq)
+{
+	if (q->last_merge == rq)
+		q->last_merge = NULL;
+
+	elv_rqhash_del(rq);
+
+	q->nr_sorted--;
+
+	q->end_sector = rq_end_sector(rq);
+	q->boundary_rq = rq;
+	list_add_tail(&rq->queuelist, &q->queue_head);
+}
+
+struct request *elv_rb_add(struct rb_root *root, struct request *rq)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+	struct request *__rq;
+
+	while (*p) {
+		parent = *p;
+		__rq = rb_entry(parent, struct request, rb_node);
+
+		if (blk_rq_pos(rq) < blk_rq_pos(__rq))
+			p = &(*p)->rb_left;
+		else if (blk_rq_pos(rq) > blk_rq_pos(__rq))
+			p = &(*p)->rb_right;
+		else
+			return __rq;
+	}
+
+	rb_link_node(&rq->rb_node, parent, p);
+	rb_insert_color(&rq->rb_node, root);
+	return NULL;
+}
+
+void elv_rb_del(struct rb_root *root, struct request *rq)
+{
+	BUG_ON(RB_EMPTY_NODE(&rq->rb_node));
+	rb_erase(&rq->rb_node, root);
+	RB_CLEAR_NODE(&rq->rb_node);
+}
+
+struct request *elv_rb_find(struct rb_root *root, sector_t sector)
+{
+	struct rb_node *n = root->rb_node;
+	struct request *rq;
+
+	while (n) {
+		rq = rb_entry(n, struct request, rb_node);
+
+		if (sector < blk_rq_pos(rq))
+			n = n->rb_left;
+		else if (sector > blk_rq_pos(rq))
+			n = n->rb_right;
+		else
+			return rq;
+	}
+
+	return NULL;
+}
+
+/*
+ * No special requests, discards or integrity data in the harness, so
+ * only the direction check and the scheduler's own veto are left.
+ */
+int elv_rq_merge_ok(struct request *rq, struct bio *bio)
+{
+	struct elevator_queue *e = rq->q->elevator;
+
+	if (bio_data_dir(bio) != rq_data_dir(rq))
+		return 0;
+
+	if (e->ops->elevator_allow_merge_fn)
+		return e->ops->elevator_allow_merge_fn(rq->q, rq, bio);
+
+	return 1;
+}
+
+struct request *elv_rb_former_request(struct request_queue *q,
+				      struct request *rq)
+{
+	struct rb_node *rbprev = rb_prev(&rq->rb_node);
+
+	if (rbprev)
+		return rb_entry_rq(rbprev);
+
+	return NULL;
+}
+
+struct request *elv_rb_latter_request(struct request_queue *q,
+				      struct request *rq)
+{
+	struct rb_node *rbnext = rb_next(&rq->rb_node);
+
+	if (rbnext)
+		return rb_entry_rq(rbnext);
+
+	return NULL;
+}
+
+/*
+ * Set up a queue running the named scheduler, or return NULL if no
+ * scheduler of that name was linked in.
+ */
+struct request_queue *shim_queue_create(const char *name)
+{
+	struct elevator_type *e = elevator_find(name);
+	struct request_queue *q;
+	int i;
+
+	if (!e)
+		return NULL;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return NULL;
+	q->elevator = calloc(1, sizeof(*q->elevator));
+	if (!q->elevator)
+		goto err_q;
+	q->elevator->hash = calloc(ELV_HASH_ENTRIES, sizeof(struct list_head));
+	if (!q->elevator->hash)
+		goto err_elevator;
+	for (i = 0; i < ELV_HASH_ENTRIES; i++)
+		INIT_LIST_HEAD(&q->elevator->hash[i]);
+
+	INIT_LIST_HEAD(&q->queue_head);
+	q->node = -1;
+	q->max_sectors = SHIM_MAX_SECTORS;
+	q->elevator->ops = &e->ops;
+	q->elevator->elevator_type = e;
+	q->elevator->elevator_data = e->ops.elevator_init_fn(q);
+	if (!q->elevator->elevator_data)
+		goto err_hash;
+	return q;
+
+err_hash:
+	free(q->elevator->hash);
+err_elevator:
+	free(q->elevator);
+err_q:
+	free(q);
+	return NULL;
+}
+
+void shim_queue_destroy(struct request_queue *q)
+{
+	q->elevator->ops->elevator_exit_fn(q->elevator);
+	free(q->elevator->hash);
+	free(q->elevator);
+	free(q);
+}
+
+/*
+ * Hand a new request to the scheduler, as elv_insert() does for
+ * ELEVATOR_INSERT_SORT, and make it visible to shim_merge_bio().
+ */
+void shim_add_request(struct request_queue *q, struct request *rq)
+{
+	rq->q = q;
+	rq->start_time = jiffies;
+	RB_CLEAR_NODE(&rq->rb_node);
+	INIT_LIST_HEAD(&rq->queuelist);
+	INIT_LIST_HEAD(&rq->hash);
+	q->nr_sorted++;
+	q->elevator->ops->elevator_add_req_fn(q, rq);
+
+	elv_rqhash_add(q, rq);
+	if (!q->last_merge)
+		q->last_merge = rq;
+}
+
+static int elv_try_merge(struct request *rq, struct bio *bio)
+{
+	if (!elv_rq_merge_ok(rq, bio))
+		return ELEVATOR_NO_MERGE;
+	if (rq_end_sector(rq) == bio->bi_sector)
+		return ELEVATOR_BACK_MERGE;
+	if (blk_rq_pos(rq) - bio_sectors(bio) == bio->bi_sector)
+		return ELEVATOR_FRONT_MERGE;
+	return ELEVATOR_NO_MERGE;
+}
+
+static int elv_merge(struct request_queue *q, struct request **req,
+		     struct bio *bio)
+{
+	struct request *rq;
+	int ret;
+
+	if (q->last_merge) {
+		ret = elv_try_merge(q->last_merge, bio);
+		if (ret != ELEVATOR_NO_MERGE) {
+			*req = q->last_merge;
+			return ret;
+		}
+	}
+
+	rq = elv_rqhash_find(q, bio->bi_sector);
+	if (rq && elv_rq_merge_ok(rq, bio)) {
+		*req = rq;
+		return ELEVATOR_BACK_MERGE;
+	}
+
+	if (q->elevator->ops->elevator_merge_fn)
+		return q->elevator->ops->elevator_merge_fn(q, req, bio);
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void elv_merged_request(struct request_queue *q, struct request *rq,
+			       int type)
+{
+	if (q->elevator->ops->elevator_merged_fn)
+		q->elevator->ops->elevator_merged_fn(q, rq, type);
+
+	if (type == ELEVATOR_BACK_MERGE)
+		elv_rqhash_reposition(q, rq);
+
+	q->last_merge = rq;
+}
+
+/*
+ * attempt_merge() from blk-core.c: fold @next into @rq if the two are
+ * now contiguous, returning 1 if the scheduler let go of @next.
+ */
+static int attempt_merge(struct request_queue *q, struct request *rq,
+			 struct request *next)
+{
+	if (rq_end_sector(rq) != blk_rq_pos(next))
+		return 0;
+	if (rq_data_dir(rq) != rq_data_dir(next))
+		return 0;
+	if (blk_rq_sectors(rq) + blk_rq_sectors(next) > q->max_sectors)
+		return 0;
+
+	/* the merged request is as old as the older of the two */
+	if (time_after(rq->start_time, next->start_time))
+		rq->start_time = next->start_time;
+
+	rq->biotail->bi_next = next->bio;
+	rq->biotail = next->biotail;
+	rq->__data_len += blk_rq_bytes(next);
+
+	if (q->elevator->ops->elevator_merge_req_fn)
+		q->elevator->ops->elevator_merge_req_fn(q, rq, next);
+
+	elv_rqhash_reposition(q, rq);
+	elv_rqhash_del(next);
+	q->nr_sorted--;
+	q->last_merge = rq;
+	return 1;
+}
+
+/*
+ * Try to add a new bio to a request the scheduler already holds, the
+ * way __make_request() does before allocating a request. Returns the
+ * request the bio went into, or NULL if the caller has to queue a new
+ * request for it. If the merge made two queued requests contiguous and
+ * they were merged as well, the one that is no longer in use is
+ * returned in @freed so the caller can release it.
+ */
+struct request *shim_merge_bio(struct request_queue *q, struct bio *bio,
+			       struct request **freed)
+{
+	struct request *rq, *other;
+	int type;
+
+	*freed = NULL;
+	bio->bi_next = NULL;
+
+	type = elv_merge(q, &rq, bio);
+	if (type == ELEVATOR_NO_MERGE)
+		return NULL;
+	if (blk_rq_sectors(rq) + bio_sectors(bio) > q->max_sectors)
+		return NULL;
+
+	if (type == ELEVATOR_BACK_MERGE) {
+		rq->biotail->bi_next = bio;
+		rq->biotail = bio;
+		rq->__data_len += bio->bi_size;
+
+		other = q->elevator->ops->elevator_latter_req_fn ?
+			q->elevator->ops->elevator_latter_req_fn(q, rq) : NULL;
+		if (other && attempt_merge(q, rq, other)) {
+			*freed = other;
+			return rq;
+		}
+	} else {
+		bio->bi_next = rq->bio;
+		rq->bio = bio;
+		rq->__sector = bio->bi_sector;
+		rq->__data_len += bio->bi_size;
+
+		other = q->elevator->ops->elevator_former_req_fn ?
+			q->elevator->ops->elevator_former_req_fn(q, rq) : NULL;
+		if (other && attempt_merge(q, other, rq)) {
+			*freed = rq;
+			return other;
+		}
+	}
+
+	elv_merged_request(q, rq, type);
+	return rq;
+}
+
+/*
+ * Take the next request off the dispatch queue, asking the scheduler
+ * to fill it when it runs dry, and tell the scheduler the driver has
+ * started it, as blk_peek_request() does. Returns NULL once the
+ * scheduler has nothing left.
+ */
+struct request *shim_fetch_request(struct request_queue *q)
+{
+	struct request *rq;
+
+	if (list_empty(&q->queue_head) &&
+	    !q->elevator->ops->elevator_dispatch_fn(q, 0))
+		return NULL;
+
+	rq = list_entry_rq(q->queue_head.next);
+	list_del_init(&rq->queuelist);
+	q->end_sector = rq_end_sector(rq);
+	q->boundary_rq = NULL;
+	q->in_flight++;
+
+	if (q->elevator->ops->elevator_activate_req_fn)
+		q->elevator->ops->elevator_activate_req_fn(q, rq);
+	return rq;
+}
+
+/*
+ * The driver has finished with a request from shim_fetch_request(),
+ * as in elv_completed_request().
+ */
+void shim_complete_request(struct request_queue *q, struct request *rq)
+{
+	BUG_ON(!q->in_flight);
+	q->in_flight--;
+
+	if (q->elevator->ops->elevator_completed_req_fn)
+		q->elevator->ops->elevator_completed_req_fn(q, rq);
+}
+
+static struct elv_fs_entry *shim_attr_find(struct request_queue *q,
+					   const char *name)
+{
+	struct elv_fs_entry *attr = q->elevator->elevator_type->elevator_attrs;
+
+	for (; attr && attr->attr.name; attr++)
+		if (!strcmp(attr->attr.name, name))
+			return attr;
+	return NULL;
+}
+
+/*
+ * Read or write a scheduler tunable, like /sys/block/<dev>/queue/iosched/.
+ * Both return -1 if the attribute does not exist or has no such method.
+ */
+ssize_t shim_attr_show(struct request_queue *q, const char *name, char *page)
+{
+	struct elv_fs_entry *attr = shim_attr_find(q, name);
+
+	if (!attr || !attr->show)
+		return -1;
+	return attr->show(q->elevator, page);
+}
+
+ssize_t shim_attr_store(struct request_queue *q, const char *name,
+			const char *page)
+{
+	struct elv_fs_entry *attr = shim_attr_find(q, name);
+
+	if (!attr || !attr->store)
+		return -1;
+	return attr->store(q->elevator, page, strlen(page));
+}
@@ -0,0 +1,440 @@
+/*
+ * Userspace shim for building I/O schedulers outside the kernel.
+ *
+ * Just enough of struct request_queue, struct request, struct bio and
+ * the elevator core for the schedulers in block/ to compile and run
+ * unmodified in a normal process. The stub headers under include/linux/
+ * all pull in this file, so the scheduler sources see their usual
+ * #includes.
+ *
+ * Nothing here tries to be faithful beyond what the schedulers use:
+ * there is no plugging and no driver. The harness feeds requests in
+ * with shim_add_request() and pulls them out with shim_fetch_request(),
+ * the same way elv_insert()/elv_next_request() would. shim_merge_bio()
+ * does what elv_merge() and __make_request() do with a new bio, so
+ * replayed traces see the same back, front and request merges.
+ */
+#ifndef _IOSCHED_SHIM_H
+#define _IOSCHED_SHIM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef unsigned long long u64;
+typedef unsigned long long sector_t;
+typedef unsigned int gfp_t;
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#ifndef offsetof
+#define offsetof(TYPE, MEMBER) ((size_t) &((TYPE *)0)->MEMBER)
+#endif
+#define container_of(ptr, type, member) ({			\
+	const typeof( ((type *)0)->member ) *__mptr = (ptr);	\
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+#define BUG()		assert(0)
+#define BUG_ON(x)	assert(!(x))
+#define WARN_ON(x)	({ int __w = !!(x); if (__w) fprintf(stderr, "WARN_ON %s:%d\n", __FILE__, __LINE__); __w; })
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#define max(x, y)	((x) > (y) ? (x) : (y))
+
+#define INT_MAX		((int)(~0U>>1))
+#define INT_MIN		(-INT_MAX - 1)
+#define UINT_MAX	(~0U)
+
+/* printk is a no-op so that logging does not dominate measurements */
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+#define KERN_WARNING	""
+#define KERN_ERR	""
+static inline int printk(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+static inline int printk(const char *fmt, ...)
+{
+	return 0;
+}
+
+/*
+ * module glue: module_init() runs at program start, so every scheduler
+ * linked into the harness registers itself before main().
+ */
+#define __init
+#define __exit
+#define __read_mostly
+#define THIS_MODULE	((struct module *)NULL)
+#define EXPORT_SYMBOL(sym)		struct __shim_module_info
+#define EXPORT_SYMBOL_GPL(sym)		struct __shim_module_info
+#define MODULE_AUTHOR(x)		struct __shim_module_info
+#define MODULE_LICENSE(x)		struct __shim_module_info
+#define MODULE_DESCRIPTION(x)		struct __shim_module_info
+#define module_init(fn)						\
+	static void __attribute__((constructor)) __shim_init_##fn(void)	\
+	{ fn(); }
+#define module_exit(fn)						\
+	static void (*__shim_exit_##fn)(void) __attribute__((unused)) = fn
+
+/*
+ * time: the harness owns jiffies and advances it as simulated time
+ * passes, with one jiffy per millisecond.
+ */
+#define HZ		1000
+extern unsigned long jiffies;
+
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+#define time_before_eq(a, b)	time_after_eq(b, a)
+
+static inline unsigned int jiffies_to_msecs(const unsigned long j)
+{
+	return j;
+}
+
+static inline unsigned long msecs_to_jiffies(const unsigned int m)
+{
+	return m;
+}
+
+/* memory */
+#define GFP_KERNEL	0x10u
+#define GFP_ATOMIC	0x20u
+#define __GFP_ZERO	0x8000u
+
+static inline void *kmalloc(size_t size, gfp_t gfp)
+{
+	return (gfp & __GFP_ZERO) ? calloc(1, size) : malloc(size);
+}
+#define kmalloc_node(size, gfp, node)	kmalloc(size, gfp)
+#define kzalloc(size, gfp)		kmalloc(size, (gfp) | __GFP_ZERO)
+#define kfree(p)			free((void *)(p))
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next)
+{
+	next->prev = prev;
+	prev->next = next;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head)
+{
+	__list_del(list->prev, list->next);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list,
+				  struct list_head *head)
+{
+	__list_del(list->prev, list->next);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_prev(pos, head) \
+	for (pos = (head)->prev; pos != (head); pos = pos->prev)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#include "../../include/linux/rbtree.h"
+
+/* block layer */
+#define READ			0
+#define WRITE			1
+
+#define REQ_RW			(1 << 0)
+#define REQ_SOFTBARRIER		(1 << 3)
+#define REQ_HARDBARRIER		(1 << 9)
+#define REQ_STARTED		(1 << 5)
+#define REQ_RW_SYNC		(1 << 18)
+
+struct bio {
+	sector_t		bi_sector;
+	struct bio		*bi_next;
+	unsigned long		bi_rw;
+	unsigned int		bi_size;
+};
+
+#define bio_sectors(bio)	((bio)->bi_size >> 9)
+#define bio_data_dir(bio)	((bio)->bi_rw & 1)
+
+struct request_queue;
+
+struct request {
+	struct list_head queuelist;
+	struct {
+		struct list_head list;
+	} csd;
+
+	struct request_queue *q;
+
+	struct list_head hash;	/* merge hash */
+
+	unsigned int cmd_flags;
+
+	unsigned int __data_len;
+	sector_t __sector;
+
+	struct bio *bio;
+	struct bio *biotail;
+
+	union {
+		struct rb_node rb_node;
+		void *completion_data;
+	};
+
+	void *elevator_private;
+	void *elevator_private2;
+
+	unsigned long start_time;
+};
+
+#define rq_data_dir(rq)		((rq)->cmd_flags & 1)
+#define rq_is_sync(rq)		(rq_data_dir((rq)) == READ || \
+				 ((rq)->cmd_flags & REQ_RW_SYNC))
+#define list_entry_rq(ptr)	list_entry((ptr), struct request, queuelist)
+
+static inline sector_t blk_rq_pos(const struct request *rq)
+{
+	return rq->__sector;
+}
+
+static inline unsigned int blk_rq_bytes(const struct request *rq)
+{
+	return rq->__data_len;
+}
+
+static inline unsigned int blk_rq_sectors(const struct request *rq)
+{
+	return blk_rq_bytes(rq) >> 9;
+}
+
+struct elevator_queue;
+
+struct request_queue {
+	struct list_head queue_head;
+	struct request *last_merge;
+	struct elevator_queue *elevator;
+
+	sector_t end_sector;
+	struct request *boundary_rq;
+
+	unsigned int nr_sorted;
+	unsigned int in_flight;
+	unsigned int max_sectors;
+	int node;
+};
+
+/* elevator */
+typedef int (elevator_merge_fn) (struct request_queue *, struct request **,
+				 struct bio *);
+typedef void (elevator_merge_req_fn) (struct request_queue *, struct request *, struct request *);
+typedef void (elevator_merged_fn) (struct request_queue *, struct request *, int);
+typedef int (elevator_allow_merge_fn) (struct request_queue *, struct request *, struct bio *);
+typedef int (elevator_dispatch_fn) (struct request_queue *, int);
+typedef void (elevator_add_req_fn) (struct request_queue *, struct request *);
+typedef int (elevator_queue_empty_fn) (struct request_queue *);
+typedef struct request *(elevator_request_list_fn) (struct request_queue *, struct request *);
+typedef void (elevator_completed_req_fn) (struct request_queue *, struct request *);
+typedef int (elevator_may_queue_fn) (struct request_queue *, int);
+typedef void (elevator_activate_req_fn) (struct request_queue *, struct request *);
+typedef void (elevator_deactivate_req_fn) (struct request_queue *, struct request *);
+typedef void *(elevator_init_fn) (struct request_queue *);
+typedef void (elevator_exit_fn) (struct elevator_queue *);
+
+struct elevator_ops {
+	elevator_merge_fn *elevator_merge_fn;
+	elevator_merged_fn *elevator_merged_fn;
+	elevator_merge_req_fn *elevator_merge_req_fn;
+	elevator_allow_merge_fn *elevator_allow_merge_fn;
+
+	elevator_dispatch_fn *elevator_dispatch_fn;
+	elevator_add_req_fn *elevator_add_req_fn;
+	elevator_activate_req_fn *elevator_activate_req_fn;
+	elevator_deactivate_req_fn *elevator_deactivate_req_fn;
+
+	elevator_queue_empty_fn *elevator_queue_empty_fn;
+	elevator_completed_req_fn *elevator_completed_req_fn;
+
+	elevator_request_list_fn *elevator_former_req_fn;
+	elevator_request_list_fn *elevator_latter_req_fn;
+
+	elevator_may_queue_fn *elevator_may_queue_fn;
+
+	elevator_init_fn *elevator_init_fn;
+	elevator_exit_fn *elevator_exit_fn;
+};
+
+#define ELV_NAME_MAX	(16)
+
+struct module;
+struct elevator_queue;
+
+/* sysfs attributes, the harness can read and write them by name */
+#define S_IWUSR		00200
+#define S_IRUGO		00444
+
+struct attribute {
+	const char *name;
+	mode_t mode;
+};
+
+struct elv_fs_entry {
+	struct attribute attr;
+	ssize_t (*show)(struct elevator_queue *, char *);
+	ssize_t (*store)(struct elevator_queue *, const char *, size_t);
+};
+
+#define __ATTR(_name, _mode, _show, _store) {				\
+	.attr = { .name = #_name, .mode = _mode },			\
+	.show	= _show,						\
+	.store	= _store,						\
+}
+#define __ATTR_NULL { .attr = { .name = NULL } }
+
+static inline bool sysfs_streq(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+
+	if (*s1 == *s2)
+		return true;
+	if (!*s1 && *s2 == '\n' && !s2[1])
+		return true;
+	if (*s1 == '\n' && !s1[1] && !*s2)
+		return true;
+	return false;
+}
+
+static inline long simple_strtol(const char *cp, char **endp,
+				 unsigned int base)
+{
+	return strtol(cp, endp, base);
+}
+
+struct elevator_type {
+	struct list_head list;
+	struct elevator_ops ops;
+	struct elv_fs_entry *elevator_attrs;
+	char elevator_name[ELV_NAME_MAX];
+	struct module *elevator_owner;
+};
+
+struct elevator_queue {
+	struct elevator_ops *ops;
+	void *elevator_data;
+	struct elevator_type *elevator_type;
+	struct list_head *hash;
+};
+
+#define ELEVATOR_NO_MERGE	0
+#define ELEVATOR_FRONT_MERGE	1
+#define ELEVATOR_BACK_MERGE	2
+
+#define rq_end_sector(rq)	(blk_rq_pos(rq) + blk_rq_sectors(rq))
+#define rb_entry_rq(node)	rb_entry((node), struct request, rb_node)
+
+#define rq_fifo_time(rq)	((unsigned long) (rq)->csd.list.next)
+#define rq_set_fifo_time(rq,exp)	((rq)->csd.list.next = (void *) (exp))
+#define rq_entry_fifo(ptr)	list_entry((ptr), struct request, queuelist)
+#define rq_fifo_clear(rq)	do {		\
+	list_del_init(&(rq)->queuelist);	\
+	INIT_LIST_HEAD(&(rq)->csd.list);	\
+	} while (0)
+
+extern void elv_register(struct elevator_type *);
+extern void elv_unregister(struct elevator_type *);
+extern void elv_dispatch_sort(struct request_queue *, struct request *);
+extern void elv_dispatch_add_tail(struct request_queue *, struct request *);
+extern struct request *elv_rb_former_request(struct request_queue *, struct request *);
+extern struct request *elv_rb_latter_request(struct request_queue *, struct request *);
+extern struct request *elv_rb_add(struct rb_root *, struct request *);
+extern void elv_rb_del(struct rb_root *, struct request *);
+extern struct request *elv_rb_find(struct rb_root *, sector_t);
+extern int elv_rq_merge_ok(struct request *, struct bio *);
+
+/* harness entry points, see shim.c */
+extern struct request_queue *shim_queue_create(const char *name);
+extern void shim_queue_destroy(struct request_queue *q);
+extern void shim_add_request(struct request_queue *q, struct request *rq);
+extern struct request *shim_fetch_request(struct request_queue *q);
+extern struct request *shim_merge_bio(struct request_queue *q,
+				      struct bio *bio, struct request **freed);
+extern void shim_complete_request(struct request_queue *q,
+				  struct request *rq);
+extern ssize_t shim_attr_show(struct request_queue *q, const char *name,
+			      char *page);
+extern ssize_t shim_attr_store(struct request_queue *q, const char *name,
+			       const char *page);
+
+#endif /* _IOSCHED_SHIM_H */
@@ -0,0 +1,281 @@
+/*
+ * Userspace stand-ins for the page allocator, bitmap helpers and
+ * procfs that mm/slob.c calls, plus the accounting the harness uses
+ * to measure it.
+ */
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#include "shim.h"
+
+/* address space for pages, reserved up front and touched on demand */
+#define ARENA_SHIFT	36
+#define ARENA_PAGES	(1UL << (ARENA_SHIFT - PAGE_SHIFT))
+#define MAX_ORDER	11
+
+static char *arena;
+static struct page *pages;
+static unsigned char *orders;		/* order of each allocated block */
+static unsigned long arena_brk;		/* pages handed out so far */
+static struct list_head free_area[MAX_ORDER];
+
+static struct task_struct init_task;
+struct task_struct *current = &init_task;
+
+unsigned long shim_pages;
+unsigned long shim_peak_pages;
+
+#define MAX_PROC_FILES	4
+
+static struct proc_file {
+	const char *name;
+	const struct file_operations *fops;
+} proc_files[MAX_PROC_FILES];
+static int nr_proc_files;
+
+static void *map(unsigned long size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static void arena_init(void)
+{
+	int i;
+
+	arena = map(ARENA_PAGES << PAGE_SHIFT);
+	pages = map(ARENA_PAGES * sizeof(struct page));
+	orders = map(ARENA_PAGES);
+	for (i = 0; i < MAX_ORDER; i++)
+		INIT_LIST_HEAD(&free_area[i]);
+}
+
+/*
+ * Blocks of each order are recycled through their own free list and
+ * never split or merged, so the arena only grows as far as the largest
+ * number of blocks of each order ever live at once. That is all the
+ * harness needs: it measures how many pages SLOB holds, not how well
+ * the page allocator could satisfy it.
+ */
+struct page *alloc_pages(gfp_t gfp, unsigned int order)
+{
+	struct page *page;
+
+	if (!arena)
+		arena_init();
+	if (order >= MAX_ORDER)
+		return NULL;
+
+	if (free_area[order].next != &free_area[order]) {
+		page = list_entry(free_area[order].next, struct page, lru);
+		list_del(&page->lru);
+	} else {
+		if (arena_brk + (1UL << order) > ARENA_PAGES)
+			return NULL;
+		page = &pages[arena_brk];
+		arena_brk += 1UL << order;
+	}
+
+	memset(page, 0, sizeof(*page));
+	page->_count.counter = 1;
+	page->_mapcount.counter = -1;
+	orders[page - pages] = order;
+
+	shim_pages += 1UL << order;
+	shim_peak_pages = max(shim_peak_pages, shim_pages);
+	if (gfp & __GFP_ZERO)
+		memset(page_address(page), 0, PAGE_SIZE << order);
+	return page;
+}
+
+void free_pages(unsigned long addr, unsigned int order)
+{
+	struct page *page = virt_to_page((void *)addr);
+
+	BUG_ON(orders[page - pages] != order);
+	shim_pages -= 1UL << order;
+	list_add(&page->lru, &free_area[order]);
+}
+
+void put_page(struct page *page)
+{
+	if (!--page->_count.counter)
+		free_pages((unsigned long)page_address(page),
+			   orders[page - pages]);
+}
+
+int compound_order(struct page *page)
+{
+	return orders[page - pages];
+}
+
+void *page_address(const struct page *page)
+{
+	return arena + ((page - pages) << PAGE_SHIFT);
+}
+
+struct page *virt_to_page(const void *addr)
+{
+	BUG_ON((char *)addr < arena ||
+	       (char *)addr >= arena + (ARENA_PAGES << PAGE_SHIFT));
+	return &pages[((char *)addr - arena) >> PAGE_SHIFT];
+}
+
+/* bitmaps, a word at a time as in lib/bitmap.c and lib/find_next_bit.c */
+unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+			    unsigned long offset)
+{
+	unsigned long word;
+
+	while (offset < size) {
+		word = addr[offset / BITS_PER_LONG] >> (offset % BITS_PER_LONG);
+		if (word)
+			return min(offset + __builtin_ctzl(word), size);
+		offset = ALIGN(offset + 1, BITS_PER_LONG);
+	}
+	return size;
+}
+
+#define BITMAP_FIRST_WORD_MASK(start) (~0UL << ((start) % BITS_PER_LONG))
+#define BITMAP_LAST_WORD_MASK(nbits)					\
+(									\
+	((nbits) % BITS_PER_LONG) ?					\
+		(1UL<<((nbits) % BITS_PER_LONG))-1 : ~0UL		\
+)
+
+void bitmap_set(unsigned long *map, int start, int nr)
+{
+	unsigned long *p = map + start / BITS_PER_LONG;
+	const int size = start + nr;
+	int bits_to_set = BITS_PER_LONG - (start % BITS_PER_LONG);
+	unsigned long mask_to_set = BITMAP_FIRST_WORD_MASK(start);
+
+	while (nr - bits_to_set >= 0) {
+		*p |= mask_to_set;
+		nr -= bits_to_set;
+		bits_to_set = BITS_PER_LONG;
+		mask_to_set = ~0UL;
+		p++;
+	}
+	if (nr) {
+		mask_to_set &= BITMAP_LAST_WORD_MASK(size);
+		*p |= mask_to_set;
+	}
+}
+
+void bitmap_clear(unsigned long *map, int start, int nr)
+{
+	unsigned long *p = map + start / BITS_PER_LONG;
+	const int size = start + nr;
+	int bits_to_clear = BITS_PER_LONG - (start % BITS_PER_LONG);
+	unsigned long mask_to_clear = BITMAP_FIRST_WORD_MASK(start);
+
+	while (nr - bits_to_clear >= 0) {
+		*p &= ~mask_to_clear;
+		nr -= bits_to_clear;
+		bits_to_clear = BITS_PER_LONG;
+		mask_to_clear = ~0UL;
+		p++;
+	}
+	if (nr) {
+		mask_to_clear &= BITMAP_LAST_WORD_MASK(size);
+		*p &= ~mask_to_clear;
+	}
+}
+
+/* seq_file, into a buffer that grows as needed */
+static void seq_reserve(struct seq_file *m, size_t len)
+{
+	if (m->count + len + 1 <= m->size)
+		return;
+	m->size = max(m->size * 2, m->count + len + 1);
+	m->buf = realloc(m->buf, m->size);
+	if (!m->buf) {
+		perror("realloc");
+		exit(1);
+	}
+}
+
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	seq_reserve(m, len);
+	va_start(args, fmt);
+	vsnprintf(m->buf + m->count, len + 1, fmt, args);
+	va_end(args);
+	m->count += len;
+	return 0;
+}
+
+int seq_puts(struct seq_file *m, const char *s)
+{
+	return seq_printf(m, "%s", s);
+}
+
+int seq_putc(struct seq_file *m, char c)
+{
+	return seq_printf(m, "%c", c);
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	file->seq.show = show;
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+void *proc_create(const char *name, mode_t mode, void *parent,
+		  const struct file_operations *fops)
+{
+	assert(nr_proc_files < MAX_PROC_FILES);
+	proc_files[nr_proc_files].name = name;
+	proc_files[nr_proc_files].fops = fops;
+	return &proc_files[nr_proc_files++];
+}
+
+/*
+ * Read /proc/<name> into buf, as much as fits with a terminating NUL.
+ * Returns the length of the whole file, or -ENOENT.
+ */
+int shim_proc_read(const char *name, char *buf, size_t size)
+{
+	struct file file;
+	int i, ret;
+
+	for (i = 0; i < nr_proc_files; i++)
+		if (!strcmp(proc_files[i].name, name))
+			break;
+	if (i == nr_proc_files)
+		return -ENOENT;
+
+	memset(&file, 0, sizeof(file));
+	ret = proc_files[i].fops->open(NULL, &file);
+	if (!ret)
+		ret = file.seq.show(&file.seq, NULL);
+	if (!ret) {
+		ret = file.seq.count;
+		if (size)
+			snprintf(buf, size, "%s",
+				 file.seq.buf ? file.seq.buf : "");
+	}
+	proc_files[i].fops->release(NULL, &file);
+	free(file.seq.buf);
+	return ret;
+}
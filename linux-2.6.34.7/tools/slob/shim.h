@@ -0,0 +1,436 @@
+/*
+ * Userspace shim for building the SLOB allocator outside the kernel.
+ *
+ * Just enough of the page allocator, struct page, per-CPU data and
+ * procfs for mm/slob.c to compile and run unmodified in a normal
+ * process. The stub headers under include/linux/ and include/asm/ all
+ * pull in this file, so slob.c sees its usual #includes.
+ *
+ * Pages come from one large anonymous mmap(), with a struct page for
+ * each, so virt_to_page() and page_address() are simple arithmetic as
+ * on a flat-memory kernel. spin_lock_irqsave() takes a pthread mutex,
+ * which costs about what an uncontended spinlock does. There is one
+ * CPU and one node. Build with -DSHIM_UP to compile slob.c as for a
+ * uniprocessor kernel, without its per-CPU magazines.
+ *
+ * The harness reads /proc/slobinfo with shim_proc_read() and watches
+ * what SLOB holds with shim_pages and shim_peak_pages.
+ */
+#ifndef _SLOB_SHIM_H
+#define _SLOB_SHIM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef int16_t s16;
+typedef int32_t s32;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef unsigned int gfp_t;
+
+#ifndef SHIM_UP
+#define CONFIG_SMP	1
+#endif
+#define CONFIG_PROC_FS	1
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#ifndef offsetof
+#define offsetof(TYPE, MEMBER) ((size_t) &((TYPE *)0)->MEMBER)
+#endif
+#define container_of(ptr, type, member) ({			\
+	const typeof( ((type *)0)->member ) *__mptr = (ptr);	\
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+#define BUG()		assert(0)
+#define BUG_ON(x)	assert(!(x))
+#define BUILD_BUG_ON(c)	((void)sizeof(char[1 - 2*!!(c)]))
+#define WARN_ON(x)	({ int __w = !!(x); if (__w) fprintf(stderr, "WARN_ON %s:%d\n", __FILE__, __LINE__); __w; })
+
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#define max(x, y)	((x) > (y) ? (x) : (y))
+#define min_t(type, x, y)	min((type)(x), (type)(y))
+#define max_t(type, x, y)	max((type)(x), (type)(y))
+#define ALIGN(x, a)	(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define BITS_PER_LONG	(8 * (int)sizeof(long))
+
+static inline int fls(int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline unsigned long __fls(unsigned long word)
+{
+	return BITS_PER_LONG - 1 - __builtin_clzl(word);
+}
+
+/* printk is a no-op so that logging does not dominate measurements */
+#define KERN_INFO	""
+#define KERN_ERR	""
+static inline int printk(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+static inline int printk(const char *fmt, ...)
+{
+	return 0;
+}
+
+#define panic(...)	do { fprintf(stderr, __VA_ARGS__); abort(); } while (0)
+
+/*
+ * module and boot glue: module_init() runs at program start, and boot
+ * parameters are never parsed; the harness sets tunables directly.
+ */
+#define __init
+#define __cpuinit
+#define __read_mostly
+#define ____cacheline_aligned_in_smp
+#define _RET_IP_	0UL
+#define EXPORT_SYMBOL(sym)		struct __shim_module_info
+#define module_init(fn)						\
+	static void __attribute__((constructor)) __shim_init_##fn(void)	\
+	{ fn(); }
+#define __setup(str, fn)					\
+	static int (*__shim_setup_##fn)(char *) __attribute__((unused)) = fn
+
+static inline int get_option(char **str, int *pint)
+{
+	char *cur = *str;
+
+	if (!cur || !*cur)
+		return 0;
+	*pint = strtol(cur, str, 0);
+	if (cur == *str)
+		return 0;
+	if (**str == ',') {
+		(*str)++;
+		return 2;
+	}
+	return 1;
+}
+
+/* bitmaps */
+#define BITS_TO_LONGS(nr)	DIV_ROUND_UP(nr, BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits)	unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void __set_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+extern unsigned long find_next_bit(const unsigned long *addr,
+				   unsigned long size, unsigned long offset);
+extern void bitmap_set(unsigned long *map, int start, int nr);
+extern void bitmap_clear(unsigned long *map, int start, int nr);
+
+static inline void bitmap_zero(unsigned long *dst, int nbits)
+{
+	memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+		n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+/* locks */
+typedef struct {
+	int counter;
+} atomic_t;
+
+typedef struct {
+	pthread_mutex_t m;
+} spinlock_t;
+
+#define spin_lock_init(l)	pthread_mutex_init(&(l)->m, NULL)
+#define spin_lock_irqsave(l, flags) \
+	do { (void)(flags); pthread_mutex_lock(&(l)->m); } while (0)
+#define spin_unlock_irqrestore(l, flags) \
+	do { (void)(flags); pthread_mutex_unlock(&(l)->m); } while (0)
+#define local_irq_save(flags)		do { (void)(flags); } while (0)
+#define local_irq_restore(flags)	do { (void)(flags); } while (0)
+
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_lock(l)		pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)		pthread_mutex_unlock(&(l)->m)
+
+/* one CPU */
+#define DEFINE_PER_CPU(type, name)	type name
+#define this_cpu_ptr(ptr)		(ptr)
+#define this_cpu_add(var, val)		((var) += (val))
+#define per_cpu(var, cpu)		(*((void)(cpu), &(var)))
+#define per_cpu_ptr(ptr, cpu)		((void)(cpu), (ptr))
+#define alloc_percpu(type)		((type *)calloc(1, sizeof(type)))
+#define free_percpu(ptr)		free(ptr)
+#define for_each_possible_cpu(cpu)	for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define on_each_cpu(func, info, wait)	({ (func)(info); 0; })
+
+struct notifier_block;
+#define CPU_DEAD		0x0007
+#define CPU_DEAD_FROZEN		0x0017
+#define NOTIFY_OK		0x0001
+#define hotcpu_notifier(fn, pri)	do { (void)(fn); } while (0)
+
+/* one node */
+#define MAX_NUMNODES		1
+#define nr_node_ids		1
+#define numa_node_id()		0
+#define for_each_online_node(node) \
+	for ((node) = 0; (node) < MAX_NUMNODES; (node)++)
+
+/* gfp */
+#define GFP_KERNEL	0xd0u
+#define GFP_ATOMIC	0x20u
+#define __GFP_COMP	0x4000u
+#define __GFP_ZERO	0x8000u
+#define __GFP_THISNODE	0u
+
+/* pages */
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
+#define L1_CACHE_BYTES	64
+
+struct page {
+	unsigned long flags;
+	atomic_t _count;
+	atomic_t _mapcount;
+	unsigned long private;
+	void *mapping;
+	unsigned long index;
+	struct list_head lru;
+};
+
+#define PG_slab		7
+#define PG_slob_free	10
+
+#define PageSlab(page)		(!!((page)->flags & (1UL << PG_slab)))
+#define __SetPageSlab(page)	((page)->flags |= 1UL << PG_slab)
+#define __ClearPageSlab(page)	((page)->flags &= ~(1UL << PG_slab))
+#define PageSlobFree(page)	(!!((page)->flags & (1UL << PG_slob_free)))
+#define __SetPageSlobFree(page)	((page)->flags |= 1UL << PG_slob_free)
+#define __ClearPageSlobFree(page) ((page)->flags &= ~(1UL << PG_slob_free))
+
+static inline void reset_page_mapcount(struct page *page)
+{
+	page->_mapcount.counter = -1;
+}
+
+static inline int page_to_nid(const struct page *page)
+{
+	return 0;
+}
+
+static inline int get_order(unsigned long size)
+{
+	int order = 0;
+
+	size = (size - 1) >> PAGE_SHIFT;
+	while (size) {
+		order++;
+		size >>= 1;
+	}
+	return order;
+}
+
+extern struct page *alloc_pages(gfp_t gfp, unsigned int order);
+#define alloc_pages_exact_node(node, gfp, order) alloc_pages(gfp, order)
+extern void free_pages(unsigned long addr, unsigned int order);
+extern void put_page(struct page *page);
+extern int compound_order(struct page *page);
+extern void *page_address(const struct page *page);
+extern struct page *virt_to_page(const void *addr);
+
+/* the heap is in the process's address space, so map it 1:1 */
+#define __pa(x)			((unsigned long)(x))
+#define __va(x)			((void *)(unsigned long)(x))
+
+struct reclaim_state {
+	unsigned long reclaimed_slab;
+};
+
+struct task_struct {
+	struct reclaim_state *reclaim_state;
+};
+
+extern struct task_struct *current;
+
+/* RCU callbacks run at once: there are no concurrent readers */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+#define INIT_RCU_HEAD(head)	do { } while (0)
+
+static inline void call_rcu(struct rcu_head *head,
+			    void (*func)(struct rcu_head *head))
+{
+	func(head);
+}
+
+static inline void rcu_barrier(void)
+{
+}
+
+/* slab.h */
+#define SLAB_HWCACHE_ALIGN	0x00002000UL
+#define SLAB_PANIC		0x00040000UL
+#define SLAB_DESTROY_BY_RCU	0x00080000UL
+#define SLAB_SLOT_PAGES		0x04000000UL
+
+#define ZERO_SIZE_PTR ((void *)16)
+#define ZERO_OR_NULL_PTR(x) ((unsigned long)(x) <= \
+				(unsigned long)ZERO_SIZE_PTR)
+
+struct kmem_cache;
+
+extern struct kmem_cache *kmem_cache_create(const char *, size_t, size_t,
+					    unsigned long, void (*)(void *));
+extern void kmem_cache_destroy(struct kmem_cache *);
+extern void *kmem_cache_alloc_node(struct kmem_cache *, gfp_t, int);
+extern void kmem_cache_free(struct kmem_cache *, void *);
+extern int kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+extern void kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+extern void *__kmalloc_node(size_t size, gfp_t flags, int node);
+extern void kfree(const void *);
+extern size_t ksize(const void *);
+extern void kmem_cache_init(void);
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return __kmalloc_node(size, flags, -1);
+}
+
+/* tracing and debugging hooks compile away */
+static inline void trace_kmalloc_node(unsigned long call_site,
+				      const void *ptr, size_t bytes_req,
+				      size_t bytes_alloc, gfp_t gfp, int node)
+{
+}
+#define trace_kmem_cache_alloc_node	trace_kmalloc_node
+#define trace_kfree(...)			do { } while (0)
+#define trace_kmem_cache_free(...)		do { } while (0)
+#define kmemleak_alloc(...)			do { } while (0)
+#define kmemleak_free(...)			do { } while (0)
+#define kmemleak_alloc_recursive(...)		do { } while (0)
+#define kmemleak_free_recursive(...)		do { } while (0)
+#define lockdep_trace_alloc(gfp)		do { } while (0)
+
+/* procfs: files are kept by name for shim_proc_read() */
+#define S_IRUGO		00444
+
+struct inode;
+
+struct seq_file {
+	char *buf;
+	size_t size;
+	size_t count;
+	int (*show)(struct seq_file *, void *);
+};
+
+struct file {
+	struct seq_file seq;
+};
+
+struct file_operations {
+	int (*open)(struct inode *, struct file *);
+	void *read;
+	void *llseek;
+	int (*release)(struct inode *, struct file *);
+};
+
+#define seq_read	NULL
+#define seq_lseek	NULL
+
+extern int seq_printf(struct seq_file *m, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+extern int seq_puts(struct seq_file *m, const char *s);
+extern int seq_putc(struct seq_file *m, char c);
+extern int single_open(struct file *file,
+		       int (*show)(struct seq_file *, void *), void *data);
+extern int single_release(struct inode *inode, struct file *file);
+extern void *proc_create(const char *name, mode_t mode, void *parent,
+			 const struct file_operations *fops);
+
+/* harness entry points, see shim.c */
+extern unsigned long shim_pages;	/* pages SLOB holds */
+extern unsigned long shim_peak_pages;	/* most it ever held */
+extern int shim_proc_read(const char *name, char *buf, size_t size);
+
+#endif /* _SLOB_SHIM_H */
@@ -0,0 +1,731 @@
+/*
+ * slob-replay: replay a kernel allocation trace through mm/slob.c.
+ *
+ * Reads the kmalloc, kmem_cache_alloc, kfree and kmem_cache_free
+ * events of a trace and makes the same calls, in the same order, into
+ * the SLOB allocator built against the userspace shim. Objects freed
+ * in the trace that it never saw allocated, because they were
+ * allocated before tracing started, are skipped. Every kmem_cache_alloc
+ * size gets a cache of its own.
+ *
+ * Each configuration of the fit tunables is replayed in a fresh process,
+ * so runs do not see each other's heap. For each it reports:
+ *
+ *   mean, p50, p99, p99.9, max
+ *                   CPU time of each allocation call, in ns
+ *   free            mean CPU time of each free call, in ns
+ *   peak, end       pages SLOB held at most and at the end of the
+ *                   replay, including those of page-sized objects
+ *   frag            external fragmentation of the heap from
+ *                   /proc/slobinfo, in thousandths: the mean of the
+ *                   samples taken during the replay, and at the end
+ *
+ * Usage: slob-replay [-f candidates,waste]... [-i events] [-S] [-v] trace|-
+ *        slob-replay -g events [-s seed]
+ *
+ * -f sets vm.slob_fit_candidates and vm.slob_fit_waste for a run; by
+ * default the kernel's defaults, an exhaustive best fit (0,0) and a
+ * first fit within each size class (1,0) are compared. /proc/slobinfo
+ * is sampled every -i events, 100 times over the replay by default,
+ * and -v prints every sample: event number, trace time, pages held,
+ * heap pages, live and free KB in the heap and fragmentation. -S
+ * creates the caches with SLAB_SLOT_PAGES.
+ *
+ * Traces are text, in any of the formats the kernel prints allocation
+ * events in:
+ *
+ *   perf kmem record <command>; perf trace > trace.txt
+ *   echo 1 > /sys/kernel/debug/tracing/events/kmem/enable;
+ *	cat /sys/kernel/debug/tracing/trace > trace.txt
+ *   echo kmemtrace > /sys/kernel/debug/tracing/current_tracer;
+ *	cat /sys/kernel/debug/tracing/trace > trace.txt
+ *
+ * the last also with the kmem_minimalistic trace option set. -g writes
+ * a synthetic trace in perf trace format to stdout instead: a working
+ * set of mostly small kmalloc and cache objects that are freed in
+ * random order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "shim.h"
+
+extern int slob_fit_candidates, slob_fit_waste;
+
+enum {
+	EV_KMALLOC,
+	EV_CACHE_ALLOC,
+	EV_FREE,
+};
+
+struct event {
+	double t;		/* seconds, as in the trace */
+	unsigned int obj;	/* which object */
+	unsigned char op;
+};
+
+struct object {
+	unsigned int size;
+	int cache;		/* index into cache_size, or -1 for kmalloc */
+};
+
+struct sample {
+	unsigned long event;
+	double t;
+	unsigned long pages;
+	unsigned long heap_pages;
+	unsigned long live_bytes;
+	unsigned long free_bytes;
+	unsigned long frag;
+};
+
+struct result {
+	unsigned int *alloc_ns;
+	unsigned long nr_allocs;
+	u64 free_ns;
+	unsigned long nr_frees;
+	struct sample *samples;
+	unsigned long nr_samples;
+};
+
+struct fit {
+	int candidates;
+	int waste;
+};
+
+static struct event *events;
+static unsigned long nr_events;
+static struct object *objects;
+static unsigned long nr_objects;
+
+#define MAX_CACHES	256
+static unsigned int cache_size[MAX_CACHES];
+static int nr_caches;
+
+#define MAX_FITS	8
+static struct fit fits[MAX_FITS];
+static int nr_fits;
+static unsigned long interval;
+static unsigned long cache_flags;
+static int verbose;
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (!p) {
+		perror("realloc");
+		exit(1);
+	}
+	return p;
+}
+
+/*
+ * Live objects by their address in the trace: open addressing with
+ * linear probing, 0 for an empty slot.
+ */
+static unsigned long *map_ptr;
+static unsigned int *map_obj;
+static unsigned long map_mask, map_nr;
+
+static unsigned long map_slot(unsigned long ptr)
+{
+	unsigned long i = (ptr >> 4) * 0x9e37fffffffc0001ULL & map_mask;
+
+	while (map_ptr[i] && map_ptr[i] != ptr)
+		i = (i + 1) & map_mask;
+	return i;
+}
+
+static void map_insert(unsigned long ptr, unsigned int obj);
+
+static void map_grow(void)
+{
+	unsigned long *old_ptr = map_ptr, old_size = map_mask + 1, i;
+	unsigned int *old_obj = map_obj;
+
+	map_mask = old_ptr ? old_size * 2 - 1 : 4095;
+	map_ptr = calloc(map_mask + 1, sizeof(*map_ptr));
+	map_obj = calloc(map_mask + 1, sizeof(*map_obj));
+	if (!map_ptr || !map_obj) {
+		perror("calloc");
+		exit(1);
+	}
+	map_nr = 0;
+	if (!old_ptr)
+		return;
+	for (i = 0; i < old_size; i++)
+		if (old_ptr[i])
+			map_insert(old_ptr[i], old_obj[i]);
+	free(old_ptr);
+	free(old_obj);
+}
+
+static void map_insert(unsigned long ptr, unsigned int obj)
+{
+	unsigned long i;
+
+	if (!map_ptr || (map_nr + 1) * 2 > map_mask + 1)
+		map_grow();
+	i = map_slot(ptr);
+	if (!map_ptr[i])
+		map_nr++;
+	map_ptr[i] = ptr;
+	map_obj[i] = obj;
+}
+
+/* remove ptr, returning its object, or -1 if it is not live */
+static long map_remove(unsigned long ptr)
+{
+	unsigned long i, j, k;
+	long obj;
+
+	if (!map_ptr)
+		return -1;
+	i = map_slot(ptr);
+	if (!map_ptr[i])
+		return -1;
+	obj = map_obj[i];
+	map_nr--;
+
+	/* close the gap, as entries after it may have probed past it */
+	for (j = (i + 1) & map_mask; map_ptr[j]; j = (j + 1) & map_mask) {
+		k = (map_ptr[j] >> 4) * 0x9e37fffffffc0001ULL & map_mask;
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && k <= i && k > j)) {
+			map_ptr[i] = map_ptr[j];
+			map_obj[i] = map_obj[j];
+			i = j;
+		}
+	}
+	map_ptr[i] = 0;
+	return obj;
+}
+
+static int cache_index(unsigned int size)
+{
+	int i;
+
+	for (i = 0; i < nr_caches; i++)
+		if (cache_size[i] == size)
+			return i;
+	if (nr_caches == MAX_CACHES) {
+		fprintf(stderr, "more than %d cache object sizes\n",
+			MAX_CACHES);
+		exit(1);
+	}
+	cache_size[nr_caches] = size;
+	return nr_caches++;
+}
+
+static void add_event(int op, double t, unsigned int obj)
+{
+	static unsigned long size;
+	struct event *ev;
+
+	if (nr_events == size) {
+		size = size ? size * 2 : 65536;
+		events = xrealloc(events, size * sizeof(*events));
+	}
+	ev = &events[nr_events++];
+	ev->t = t;
+	ev->obj = obj;
+	ev->op = op;
+}
+
+static void add_alloc(int cache, double t, unsigned long ptr,
+		      unsigned int size)
+{
+	static unsigned long objects_size;
+	struct object *o;
+
+	/* failed allocations and kmalloc(0) */
+	if (ptr <= 16)
+		return;
+	/* an allocation whose free the trace missed stays live */
+	map_remove(ptr);
+
+	if (nr_objects == objects_size) {
+		objects_size = objects_size ? objects_size * 2 : 65536;
+		objects = xrealloc(objects, objects_size * sizeof(*objects));
+	}
+	o = &objects[nr_objects];
+	o->size = size;
+	o->cache = cache;
+	map_insert(ptr, nr_objects);
+	add_event(cache < 0 ? EV_KMALLOC : EV_CACHE_ALLOC, t, nr_objects++);
+}
+
+/* returns 0 if the trace never saw ptr allocated */
+static int add_free(double t, unsigned long ptr)
+{
+	long obj = map_remove(ptr);
+
+	if (obj < 0)
+		return 0;
+	add_event(EV_FREE, t, obj);
+	return 1;
+}
+
+/*
+ * The timestamp of an ftrace or perf trace line is the field ending in
+ * a colon just before the event at ev.
+ */
+static int line_time(const char *line, const char *ev, double *t)
+{
+	const char *end = ev, *p;
+
+	while (end > line && end[-1] == ' ')
+		end--;
+	if (end == line || end[-1] != ':')
+		return 0;
+	for (p = end - 1; p > line && p[-1] != ' '; p--)
+		;
+	*t = strtod(p, NULL);
+	return 1;
+}
+
+/*
+ * Load the allocation events of a trace. Page allocations and lines
+ * that are not events are skipped.
+ */
+static int load_trace(FILE *f)
+{
+	static const struct {
+		const char *name;
+		int op;
+	} tracepoints[] = {
+		{ " kmalloc: ",			EV_KMALLOC },
+		{ " kmalloc_node: ",		EV_KMALLOC },
+		{ " kmem_cache_alloc: ",	EV_CACHE_ALLOC },
+		{ " kmem_cache_alloc_node: ",	EV_CACHE_ALLOC },
+		{ " kfree: ",			EV_FREE },
+		{ " kmem_cache_free: ",		EV_FREE },
+	};
+	unsigned long ptr, size, unknown = 0;
+	char line[1024], sign, type;
+	double t = 0;
+	int i, op, type_id, n;
+	const char *p;
+
+	while (fgets(line, sizeof(line), f)) {
+		for (i = 0; i < ARRAY_SIZE(tracepoints); i++)
+			if ((p = strstr(line, tracepoints[i].name)))
+				break;
+
+		if (i < ARRAY_SIZE(tracepoints)) {
+			/* tracepoint format, from perf trace or ftrace */
+			const char *q = strstr(p, "ptr=");
+
+			line_time(line, p + 1, &t);
+			op = tracepoints[i].op;
+			if (!q)
+				continue;
+			ptr = strtoul(q + 4, NULL, 16);
+			if (op == EV_FREE) {
+				unknown += !add_free(t, ptr);
+				continue;
+			}
+			q = strstr(p, "bytes_req=");
+			if (!q)
+				continue;
+			size = strtoul(q + 10, NULL, 10);
+		} else if ((p = strstr(line, "type_id "))) {
+			/* the kmemtrace tracer */
+			line_time(line, p, &t);
+			n = sscanf(p, "type_id %d call_site %*s ptr %lu "
+				   "bytes_req %lu", &type_id, &ptr, &size);
+			if (n < 2 || type_id > 1)
+				continue;
+			if (n == 2) {
+				unknown += !add_free(t, ptr);
+				continue;
+			}
+			op = type_id ? EV_CACHE_ALLOC : EV_KMALLOC;
+		} else if (sscanf(line, " %c %c", &sign, &type) == 2 &&
+			   (sign == '+' || sign == '-') &&
+			   (type == 'K' || type == 'C')) {
+			/* the kmemtrace tracer with kmem_minimalistic */
+			if (sign == '-') {
+				if (sscanf(line, " - %*c %lx", &ptr) == 1)
+					unknown += !add_free(t, ptr);
+				continue;
+			}
+			if (sscanf(line, " + %*c %lu %*u %*x %lx", &size,
+				   &ptr) != 2)
+				continue;
+			op = type == 'C' ? EV_CACHE_ALLOC : EV_KMALLOC;
+		} else {
+			continue;
+		}
+
+		add_alloc(op == EV_CACHE_ALLOC ? cache_index(size) : -1,
+			  t, ptr, size);
+	}
+
+	if (unknown)
+		fprintf(stderr, "skipped %lu frees of objects allocated "
+			"before the trace\n", unknown);
+	if (!nr_events) {
+		fprintf(stderr, "no allocations in trace\n");
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned long slobinfo_field(const char *info, const char *name)
+{
+	const char *p = strstr(info, name);
+
+	return p ? strtoul(p + strlen(name), NULL, 10) : 0;
+}
+
+static void sample(struct result *res, unsigned long event,
+		   unsigned long live_bytes)
+{
+	struct sample *s;
+	char info[4096];
+
+	if (shim_proc_read("slobinfo", info, sizeof(info)) < 0) {
+		fprintf(stderr, "no /proc/slobinfo\n");
+		exit(1);
+	}
+
+	s = &res->samples[res->nr_samples++];
+	s->event = event;
+	s->t = events[event ? event - 1 : 0].t;
+	s->pages = shim_pages;
+	s->heap_pages = slobinfo_field(info, "\nheap_pages");
+	s->free_bytes = slobinfo_field(info, "\nfree_bytes");
+	s->frag = slobinfo_field(info, "\nfrag_index");
+	s->live_bytes = live_bytes;
+}
+
+static int replay(struct fit *fit, struct result *res)
+{
+	struct kmem_cache *caches[MAX_CACHES];
+	unsigned long i, live_bytes = 0;
+	u64 start;
+	void **ptrs;
+	int c;
+
+	slob_fit_candidates = fit->candidates;
+	slob_fit_waste = fit->waste;
+	kmem_cache_init();
+
+	memset(res, 0, sizeof(*res));
+	res->alloc_ns = malloc(nr_objects * sizeof(*res->alloc_ns));
+	res->samples = malloc((nr_events / interval + 2) *
+			      sizeof(*res->samples));
+	ptrs = malloc(nr_objects * sizeof(*ptrs));
+	if (!res->alloc_ns || !res->samples || !ptrs) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (c = 0; c < nr_caches; c++) {
+		caches[c] = kmem_cache_create("replay", cache_size[c], 0,
+					      cache_flags, NULL);
+		if (!caches[c]) {
+			fprintf(stderr, "cannot create cache\n");
+			return -1;
+		}
+	}
+
+	for (i = 0; i < nr_events; i++) {
+		struct event *ev = &events[i];
+		struct object *o = &objects[ev->obj];
+
+		if (i && !(i % interval))
+			sample(res, i, live_bytes);
+
+		start = now_ns();
+		switch (ev->op) {
+		case EV_KMALLOC:
+			ptrs[ev->obj] = kmalloc(o->size, GFP_KERNEL);
+			break;
+		case EV_CACHE_ALLOC:
+			ptrs[ev->obj] = kmem_cache_alloc_node(caches[o->cache],
+							      GFP_KERNEL, -1);
+			break;
+		case EV_FREE:
+			if (o->cache < 0)
+				kfree(ptrs[ev->obj]);
+			else
+				kmem_cache_free(caches[o->cache],
+						ptrs[ev->obj]);
+			res->free_ns += now_ns() - start;
+			res->nr_frees++;
+			live_bytes -= o->size;
+			continue;
+		}
+		res->alloc_ns[res->nr_allocs++] = now_ns() - start;
+		live_bytes += o->size;
+
+		if (!ptrs[ev->obj]) {
+			fprintf(stderr, "allocation of %u bytes failed\n",
+				o->size);
+			return -1;
+		}
+	}
+	sample(res, nr_events, live_bytes);
+
+	free(ptrs);
+	return 0;
+}
+
+static int uint_cmp(const void *a, const void *b)
+{
+	const unsigned int *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static void print_result(struct fit *fit, struct result *res)
+{
+	unsigned int *ns = res->alloc_ns;
+	unsigned long n = res->nr_allocs, i, frag = 0;
+	struct sample *end = &res->samples[res->nr_samples - 1];
+	u64 sum = 0;
+	char name[32];
+
+	for (i = 0; i < n; i++)
+		sum += ns[i];
+	qsort(ns, n, sizeof(*ns), uint_cmp);
+	for (i = 0; i < res->nr_samples; i++)
+		frag += res->samples[i].frag;
+
+	snprintf(name, sizeof(name), "%d,%d", fit->candidates, fit->waste);
+	printf("%-10s %8.0f %7u %7u %7u %8u %8.0f %8lu %8lu %5lu %5lu\n",
+	       name, (double)sum / n, ns[(n * 50 + 99) / 100 - 1],
+	       ns[(n * 99 + 99) / 100 - 1], ns[(n * 999 + 999) / 1000 - 1],
+	       ns[n - 1], res->nr_frees ?
+	       (double)res->free_ns / res->nr_frees : 0.0,
+	       shim_peak_pages, shim_pages, frag / res->nr_samples,
+	       end->frag);
+
+	if (!verbose)
+		return;
+
+	for (i = 0; i < res->nr_samples; i++) {
+		struct sample *s = &res->samples[i];
+
+		printf("  %10lu %12.6f pages %7lu heap %7lu live %8lu KB "
+		       "free %8lu KB frag %4lu\n", s->event, s->t, s->pages,
+		       s->heap_pages, s->live_bytes >> 10,
+		       s->free_bytes >> 10, s->frag);
+	}
+}
+
+/*
+ * Replay in a child, so that every run starts from an empty heap and
+ * page arena.
+ */
+static int run(struct fit *fit)
+{
+	struct result res;
+	int status;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (!pid) {
+		if (replay(fit, &res))
+			exit(1);
+		print_result(fit, &res);
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		perror("waitpid");
+		return -1;
+	}
+	return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+static int parse_fit(const char *arg, struct fit *fit)
+{
+	char *end;
+
+	fit->candidates = strtol(arg, &end, 0);
+	if (end == arg || *end != ',')
+		return -1;
+	arg = end + 1;
+	fit->waste = strtol(arg, &end, 0);
+	if (end == arg || *end || fit->candidates < 0 || fit->waste < 0)
+		return -1;
+	return 0;
+}
+
+/* exponentially distributed, with the given mean */
+static double exp_random(double mean)
+{
+	return -mean * log((random() + 1.0) / (RAND_MAX + 2.0));
+}
+
+/* a size from a distribution skewed, like most kernels', to small objects */
+static unsigned int gen_size(void)
+{
+	int r = random() % 100;
+
+	if (r < 60)
+		return 8 + random() % 89;
+	if (r < 90)
+		return 96 + random() % 417;
+	if (r < 98)
+		return 512 + random() % 1537;
+	return 2048 + random() % 6145;
+}
+
+static void generate(unsigned long nr)
+{
+	static const unsigned int gen_caches[] = { 16, 48, 104, 192, 256, 640 };
+	unsigned long target = max(nr / 20, 1000UL), live = 0, id = 0, i;
+	struct gen_obj {
+		unsigned long ptr;
+		int cache;
+	} *objs = malloc((nr + 1) * sizeof(*objs));
+	double t = 0;
+
+	if (!objs) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0; i < nr; i++) {
+		int alloc = !live || random() % 100 < (live < target ? 60 : 40);
+
+		t += exp_random(2e-6);
+		if (alloc) {
+			struct gen_obj *o = &objs[live++];
+			int c = random() % 10 < 3 ?
+				random() % ARRAY_SIZE(gen_caches) : -1;
+			unsigned int size = c < 0 ? gen_size() : gen_caches[c];
+
+			o->ptr = 0xffff880000000000UL + (++id << 6);
+			o->cache = c;
+			printf("      gen-1000  [000] %12.6f: %s: "
+			       "call_site=ffffffff81000000 ptr=0x%lx "
+			       "bytes_req=%u bytes_alloc=%u "
+			       "gfp_flags=GFP_KERNEL\n", t,
+			       c < 0 ? "kmalloc" : "kmem_cache_alloc",
+			       o->ptr, size, size);
+		} else {
+			unsigned long k = random() % live;
+
+			printf("      gen-1000  [000] %12.6f: %s: "
+			       "call_site=ffffffff81000000 ptr=0x%lx\n", t,
+			       objs[k].cache < 0 ? "kfree" : "kmem_cache_free",
+			       objs[k].ptr);
+			objs[k] = objs[--live];
+		}
+	}
+	free(objs);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-f candidates,waste]... [-i events] [-S] [-v] "
+		"trace|-\n"
+		"       %s -g events [-s seed]\n", prog, prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct fit def_fits[] = { { 32, 8 }, { 0, 0 }, { 1, 0 } };
+	unsigned long gen = 0;
+	FILE *f;
+	int c, i, ret = 0;
+
+	srandom(1);
+
+	while ((c = getopt(argc, argv, "f:g:i:s:Sv")) != -1) {
+		switch (c) {
+		case 'f':
+			if (nr_fits == MAX_FITS ||
+			    parse_fit(optarg, &fits[nr_fits])) {
+				fprintf(stderr, "bad fit \"%s\"\n", optarg);
+				return 1;
+			}
+			nr_fits++;
+			break;
+		case 'g':
+			gen = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			srandom(strtoul(optarg, NULL, 0));
+			break;
+		case 'S':
+			cache_flags |= SLAB_SLOT_PAGES;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (gen) {
+		generate(gen);
+		return 0;
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if (!strcmp(argv[optind], "-")) {
+		f = stdin;
+	} else {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	ret = load_trace(f);
+	if (f != stdin)
+		fclose(f);
+	if (ret)
+		return 1;
+
+	if (!nr_fits) {
+		for (i = 0; i < ARRAY_SIZE(def_fits); i++)
+			fits[i] = def_fits[i];
+		nr_fits = ARRAY_SIZE(def_fits);
+	}
+	if (!interval)
+		interval = max(nr_events / 100, 1UL);
+
+	printf("%lu events, %lu objects in %d caches and kmalloc, "
+	       "over %.3f s\n", nr_events, nr_objects, nr_caches,
+	       events[nr_events - 1].t - events[0].t);
+	printf("%-10s %8s %7s %7s %7s %8s %8s %8s %8s %5s %5s\n", "fit",
+	       "mean(ns)", "p50", "p99", "p99.9", "max", "free(ns)", "peak",
+	       "end", "frag", "end");
+
+	for (i = 0; i < nr_fits && !ret; i++)
+		ret = run(&fits[i]);
+
+	return ret ? 1 : 0;
+}